@@ -18,12 +18,27 @@
 #define SOUND_UPDATE_STRUCT             "(" SOUND_UPDATE_ITEM ")"
 #define SOUND_UPDATE_SGN                SOUND_UPDATE_DATA "a" SOUND_UPDATE_STRUCT
 
+#define SOUND_METHOD_LOG                "setLogLevel"
+#define SOUND_METHOD_LOG_SGN            "sy"
+#define SOUND_LOG_GLOBAL                0xFF    // Level making a file follow the global one
+
+#define SOUND_METHOD_GAIN               "setGain"
+#define SOUND_METHOD_GAIN_SGN           "yu"    // Sound type, gain in ENGINE_GAIN_SHIFT fixed point
+
 #define SOUND_METHOD_RETURN             "b"
 
 // Properties
 #define SOUND_PROP_STATE                "state"
 #define SOUND_PROP_PLAYING              "playing"
 #define SOUND_PROP_VOLUME               "volume"
+#define SOUND_PROP_LATENCY              "latency"
+#define SOUND_PROP_REALTIME             "realtime"
+#define SOUND_PROP_CACHE                "cache"
+#define SOUND_PROP_CACHE_SGN            "a{st}"
+#define SOUND_PROP_LOG                  "logLevels"
+#define SOUND_PROP_LOG_SGN              "a{sy}"
+#define SOUND_PROP_XRUNS                "xruns"
+#define SOUND_PROP_XRUNS_SGN            "a{st}"
 
 // Subscription
 #define DBUS_GW                       "gateway"
@@ -39,7 +54,6 @@
 
 int dbus_init ();
 void dbus_deinit ();
-int dbus_loop ();
 int dbus_get_data ();
 void dbus_emit_state ();
 void dbus_emit_playing ();
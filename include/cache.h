@@ -0,0 +1,53 @@
+/**
+ * @file cache.h
+ * @author Denys Stovbun (denis.stovbun@lanars.com)
+ * @brief Transcoded sound cache
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ *
+ *
+ */
+#pragma once
+
+#include "app.h"
+#include "md5.h"
+
+#define CACHE_MAGIC             "DSND"
+#define CACHE_VERSION           2
+#define CACHE_EXT               ".snd"
+// Downloads kept as they are, named after the sound id
+#define CACHE_SOURCE_EXT        ".wav"
+// Samples start on a page boundary so the mapping needs no copy
+#define CACHE_DATA_OFFSET       4096
+
+// Cache file header, host endian, padded with zeros up to CACHE_DATA_OFFSET
+typedef struct CacheHeaderStruct {
+    char                magic[4];       // CACHE_MAGIC
+    uint16_t            version;        // CACHE_VERSION
+    uint16_t            channels;
+    uint32_t            rate;
+    int32_t             format;         // snd_pcm_format_t
+    uint64_t            frames;
+    uint32_t            dataCrc;        // CRC-32 of the samples
+    uint32_t            headerCrc;      // CRC-32 of this header with headerCrc = 0
+    char                hash[2 * MD5_SIZE + 1]; // Source file MD5, hex, also the file name
+} CacheHeader;
+
+typedef struct CacheStatsStruct {
+    uint64_t            hits;
+    uint64_t            misses;
+    uint64_t            evictions;
+    uint64_t            bytes;          // Size of all entries and kept downloads
+    uint64_t            budget;         // CACHE_BUDGET
+    uint32_t            files;
+} CacheStats;
+
+int cache_init (const char *dir);
+void cache_deinit ();
+int cache_load (SoundData *data, const char *hash);
+int cache_store (const SoundData *data, const char *hash);
+int cache_contains (const char *name);
+void cache_sweep (int (*keep) (const char *name));
+void cache_trim (int (*keep) (const char *name));
+void cache_stats (CacheStats *stats);
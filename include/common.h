@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <systemd/sd-bus.h>
 #include <alsa/asoundlib.h>
 
@@ -20,6 +21,7 @@
 extern char     card[64];
 extern int      gLogLevel;
 extern uint8_t  gVolume;
+extern int      gRealtime;
 
 /*************************
  *  SERVICE ENUMERATIONS
@@ -45,6 +47,9 @@ typedef struct SoundShortStruct {
     char                url[MAX_URL_SIZE + 1];
 } SoundShort;
 
+typedef struct SoundStreamStruct SoundStream;
+typedef struct GrowBufStruct GrowBuf;
+
 typedef struct SoundDataStruct {
     SoundType           type;
     uint64_t            id;
@@ -57,6 +62,11 @@ typedef struct SoundDataStruct {
     uint16_t            bits;   // Bit resolution
     uint16_t            align;  // Block align
     uint16_t            channels; // Number of channels in the wave file
+    void               *map;    // File mapping data points into, NULL if data is on heap
+    size_t              mapSize; // Mapping length, 0 for the built-in resource
+    SoundStream        *stream; // Decoder feeding the engine, NULL if data is preloaded
+    GrowBuf            *progress; // Download data points into while it runs, NULL otherwise
+    int                 locked; // Samples are locked in RAM
 } SoundData;
 
 
@@ -126,25 +136,58 @@ typedef struct SoundDataStruct {
 #define LOG_TYPE_NORMAL     0
 #define LOG_TYPE_EXTENDED   1
 
+#ifndef LOG_LEVEL_BUILD
+#define LOG_LEVEL_BUILD     LOG_LEVEL_MAX
+#endif
+
+// Module level values besides the log levels
+#define LOG_MODULE_NEW      -3  // Not registered yet
+#define LOG_MODULE_GLOBAL   -2  // Follows gLogLevel
+
+// Runtime level of a source file, every file that logs has its own
+typedef struct LogModuleStruct {
+    const char                 *file;
+    _Atomic int                 level;
+    struct LogModuleStruct     *next;
+} LogModule;
+
+// __BASE_FILE__ is the source file including this header
+static LogModule logModule __attribute__ ((unused)) = { __BASE_FILE__, LOG_MODULE_NEW, NULL };
+
 // Global functions
-const char * selfLogTimestamp ();
-void selfLogOutput (const char *file, int line, const char *func, int lvl, const char *tms, const char *msg);
 void selfLogFunction (const char *file, int line, const char *func, int lvl, const char* fmt, ...);
+int log_module_register (LogModule *m);
+
+static inline int log_module_level (LogModule *m) {
+    int lvl = atomic_load_explicit (&m->level, memory_order_relaxed);
+
+    if (lvl == LOG_MODULE_NEW)
+        lvl = log_module_register (m);
+    return lvl == LOG_MODULE_GLOBAL ? gLogLevel : lvl;
+}
+
 // Help macros
 #define LOG_FILENAME()      ((const char *)(__FILE__))
 #define LOG_FUNCTION()      ((const char *)(__PRETTY_FUNCTION__))
+// Levels above LOG_LEVEL_BUILD are compiled out, the rest are checked before the arguments are evaluated
+#define LOG_ENABLED(LVL)    ((LVL) <= LOG_LEVEL_BUILD && (LVL) <= log_module_level (&logModule))
+#define selfLogLevel(LVL, FMT, ...) \
+    do { \
+        if (LOG_ENABLED (LVL)) \
+            selfLogFunction (LOG_FILENAME(), __LINE__, LOG_FUNCTION(), LVL, FMT __VA_OPT__ (,) __VA_ARGS__); \
+    } while (0)
 // Log always
 #define selfLog(FMT, ...)    selfLogFunction (LOG_FILENAME(), __LINE__, LOG_FUNCTION(), LOG_LEVEL_ALWAYS,  FMT __VA_OPT__ (,) __VA_ARGS__)
 // Log ERROR level
-#define selfLogErr(FMT, ...) selfLogFunction (LOG_FILENAME(), __LINE__, LOG_FUNCTION(), LOG_LEVEL_ERROR,   FMT __VA_OPT__ (,) __VA_ARGS__)
+#define selfLogErr(FMT, ...) selfLogLevel (LOG_LEVEL_ERROR,   FMT __VA_OPT__ (,) __VA_ARGS__)
 // Log WARNING level
-#define selfLogWrn(FMT, ...) selfLogFunction (LOG_FILENAME(), __LINE__, LOG_FUNCTION(), LOG_LEVEL_WARNING, FMT __VA_OPT__ (,) __VA_ARGS__)
+#define selfLogWrn(FMT, ...) selfLogLevel (LOG_LEVEL_WARNING, FMT __VA_OPT__ (,) __VA_ARGS__)
 // Log INFO level
-#define selfLogInf(FMT, ...) selfLogFunction (LOG_FILENAME(), __LINE__, LOG_FUNCTION(), LOG_LEVEL_INFO,    FMT __VA_OPT__ (,) __VA_ARGS__)
+#define selfLogInf(FMT, ...) selfLogLevel (LOG_LEVEL_INFO,    FMT __VA_OPT__ (,) __VA_ARGS__)
 // Log DEBUG level
-#define selfLogDbg(FMT, ...) selfLogFunction (LOG_FILENAME(), __LINE__, LOG_FUNCTION(), LOG_LEVEL_DEBUG,   FMT __VA_OPT__ (,) __VA_ARGS__)
+#define selfLogDbg(FMT, ...) selfLogLevel (LOG_LEVEL_DEBUG,   FMT __VA_OPT__ (,) __VA_ARGS__)
 // Log TRACE level
-#define selfLogTrc(FMT, ...) selfLogFunction (LOG_FILENAME(), __LINE__, LOG_FUNCTION(), LOG_LEVEL_TRACE,   FMT __VA_OPT__ (,) __VA_ARGS__)
+#define selfLogTrc(FMT, ...) selfLogLevel (LOG_LEVEL_TRACE,   FMT __VA_OPT__ (,) __VA_ARGS__)
 
 #define returnIfFailLevel(LVL, EXPR, FMT, ...) \
     do { \
@@ -152,11 +195,7 @@ void selfLogFunction (const char *file, int line, const char *func, int lvl, con
             { } \
         else \
         { \
-            selfLogFunction (LOG_FILENAME() \
-                , __LINE__ \
-                , LOG_FUNCTION() \
-                , LVL \
-                , FMT __VA_OPT__ (,) __VA_ARGS__); \
+            selfLogLevel (LVL, FMT __VA_OPT__ (,) __VA_ARGS__); \
             return; \
         } \
     } while (0)
@@ -167,11 +206,7 @@ void selfLogFunction (const char *file, int line, const char *func, int lvl, con
             { } \
         else \
         { \
-            selfLogFunction (LOG_FILENAME() \
-                , __LINE__ \
-                , LOG_FUNCTION() \
-                , LVL \
-                , FMT __VA_OPT__ (,) __VA_ARGS__); \
+            selfLogLevel (LVL, FMT __VA_OPT__ (,) __VA_ARGS__); \
             return (VAL); \
         } \
     } while (0)
@@ -0,0 +1,17 @@
+/**
+ * @file convert.h
+ * @author Denys Stovbun (denis.stovbun@lanars.com)
+ * @brief Sample format conversion
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ *
+ *
+ */
+#pragma once
+
+#include "app.h"
+
+int convert_sound (SoundData *data);
+int convert_is_native (const SoundData *data);
+void convert_remix (const int16_t *src, snd_pcm_uframes_t frames, uint16_t channels, int16_t *dst);
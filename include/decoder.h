@@ -0,0 +1,26 @@
+/**
+ * @file decoder.h
+ * @author Denys Stovbun (denis.stovbun@lanars.com)
+ * @brief Compressed sound decoders
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ *
+ *
+ */
+#pragma once
+
+#include "app.h"
+
+typedef enum DecoderTypeEnum {
+      DecoderUnknown
+    , DecoderWave
+    , DecoderMp3
+    , DecoderVorbis
+    , DecoderFlac
+    , DecoderMAX
+} DecoderType;
+
+DecoderType decoder_probe (const uint8_t *file, size_t size);
+int decoder_decode (DecoderType type, const uint8_t *file, size_t size, SoundData *data);
+const char * decoder_name (DecoderType type);
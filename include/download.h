@@ -1,26 +1,67 @@
 #pragma once
 
+#include <curl/curl.h>
+
 #include "app.h"
+#include "md5.h"
+#include "index.h"
+#include "growbuf.h"
 
 typedef enum DownloadStateEnum {
     DL_Init,
     DL_Process,
-    DL_Finished
+    DL_Finished,
+    DL_NotModified,
+    DL_Failed
 } DownloadState;
 
+typedef struct ChunkDataStruct {
+    uint32_t cnt;
+    size_t size;
+    FILE *fd;
+} ChunkData;
+
+#define DOWNLOAD_PART_EXT       ".part"
+#define DOWNLOAD_VALIDATOR_SIZE 127
+
 typedef struct DownloadDataStruct {
     uint64_t id;
     SoundType type;
     char url[MAX_URL_SIZE + 1];
     char filename[MAX_FILE_SIZE + 1];
+    char part[MAX_FILE_SIZE + sizeof (DOWNLOAD_PART_EXT)]; // Written until verified
+    char etag[DOWNLOAD_VALIDATOR_SIZE + 1];
+    char lastModified[DOWNLOAD_VALIDATOR_SIZE + 1];
+    char md5[2 * MD5_SIZE + 1]; // Expected digest from the url fragment, the actual one once verified, hex
+    uint64_t baseId;    // Sound whose content the request revalidates, 0 for a plain download
+    uint64_t size;      // Verified file size
     DownloadState state;
+    uint64_t seq;       // Request order, the newest request is served first
+    uint32_t attempt;   // Failed attempts so far
+    uint64_t retryAt;   // Monotonic ms of the next attempt
+    curl_off_t offset;  // Bytes kept from earlier attempts
+    int checked;        // Response code of this attempt was checked
+    int progressive;    // A new sound, played while it arrives
+    int announced;      // Main thread was told the sound is playable
+    GrowBuf *grow;      // Copy of the file in memory for progressive play
+    CURL *curl;
+    struct curl_slist *headers;
+    ChunkData cd;
+    struct DownloadDataStruct *next;
 } DownloadData;
 
-typedef struct ChunkDataStruct {
-    uint32_t cnt;
-    size_t size;
-    FILE *fd;
-} ChunkData;
+// New sound becoming playable while it is downloaded
+typedef struct DownloadStartStruct {
+    uint64_t id;
+    SoundType type;
+    char url[MAX_URL_SIZE + 1];
+    uint64_t seq;
+    GrowBuf *grow;
+    struct DownloadStartStruct *next;
+} DownloadStart;
 
-int download_sound (SoundData *data);
-int download_count ();
\ No newline at end of file
+int download_init ();
+void download_deinit ();
+int download_sound (SoundData *data, const IndexSound *base);
+int download_count ();
+void download_dispatch ();
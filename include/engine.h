@@ -0,0 +1,56 @@
+/**
+ * @file engine.h
+ * @author Denys Stovbun (denis.stovbun@lanars.com)
+ * @brief Persistent PCM output engine
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ *
+ *
+ */
+#pragma once
+
+#include "app.h"
+
+// Device configuration the PCM is opened with on service start
+#define ENGINE_FORMAT           SND_PCM_FORMAT_S16_LE
+#define ENGINE_CHANNELS         2
+#define ENGINE_RATE             48000
+#define ENGINE_FRAME_BYTES      (ENGINE_CHANNELS * sizeof (int16_t))
+// Requested ring buffer latency (us), ALSA splits it into 4 periods
+#define ENGINE_LATENCY          40000
+
+// Voice gains are fixed point, ENGINE_UNITY is 0 dB and the maximum
+#define ENGINE_GAIN_SHIFT       16
+#define ENGINE_UNITY            (1 << ENGINE_GAIN_SHIFT)
+// Gain of a voice while a higher priority one plays (-12 dB)
+#define ENGINE_DUCK_GAIN        16384
+// Gain changes are ramped over 10 ms, starts and stops fade over 5 ms
+#define ENGINE_RAMP_FRAMES      (ENGINE_RATE / 100)
+#define ENGINE_FADE_FRAMES      (ENGINE_RATE / 200)
+// Audio thread stack, allocated and touched on start
+#define ENGINE_STACK_SIZE       (256 * 1024)
+
+// Output glitches heard while a sound played, SoundNone for the silence after sounds
+typedef struct EngineStatsStruct {
+    uint64_t            xruns;          // Underruns and other recovered device errors
+    uint64_t            recoveryUs;     // Time spent recovering, silence padding included
+    uint64_t            recoveryMaxUs;  // Longest recovery
+    uint64_t            shortWrites;    // Writes queuing less than asked
+} EngineStats;
+
+// Control calls below are made from the service main thread only
+int engine_start ();
+void engine_shutdown ();
+int engine_play (SoundData *data);
+int engine_cancel (SoundType type);
+void engine_release (SoundData *data);
+void engine_set_gain (SoundType type, uint32_t gain);
+void engine_set_master (uint32_t gain);
+uint32_t engine_latency ();
+int engine_realtime ();
+void engine_stats (SoundType type, EngineStats *st);
+void engine_lock_data (SoundData *data);
+void engine_unlock_data (SoundData *data);
+int engine_event_fd ();
+void engine_dispatch ();
@@ -0,0 +1,25 @@
+/**
+ * @file growbuf.h
+ * @author Denys Stovbun (denis.stovbun@lanars.com)
+ * @brief Buffer filled by one thread while others read it
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ *
+ *
+ */
+#pragma once
+
+#include "app.h"
+
+typedef struct GrowBufStruct GrowBuf;
+
+GrowBuf * growbuf_new (size_t size);
+GrowBuf * growbuf_ref (GrowBuf *g);
+void growbuf_unref (GrowBuf *g);
+int growbuf_append (GrowBuf *g, const void *buf, size_t len);
+void growbuf_finish (GrowBuf *g, int complete);
+const uint8_t * growbuf_data (const GrowBuf *g);
+size_t growbuf_size (const GrowBuf *g);
+size_t growbuf_available (const GrowBuf *g);
+int growbuf_done (const GrowBuf *g);
@@ -0,0 +1,36 @@
+/**
+ * @file index.h
+ * @author Denys Stovbun (denis.stovbun@lanars.com)
+ * @brief Index of downloaded sounds
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ *
+ *
+ */
+#pragma once
+
+#include "app.h"
+
+/**
+ * @brief What is known about a downloaded sound
+ */
+typedef struct IndexSoundStruct {
+    uint64_t    id;
+    const char *url;
+    const char *etag;           // Validators the server sent, NULL if none
+    const char *last_modified;
+    uint64_t    size;           // Bytes downloaded
+    const char *md5;            // Digest of the downloaded file, hex
+} IndexSound;
+
+typedef struct IndexDataStruct {
+    IndexSound *sounds;
+    uint32_t    sounds_count;
+} IndexData;
+
+int index_init (const char *path);
+void index_deinit ();
+const IndexSound * index_find (uint64_t id);
+int index_set (const IndexSound *sound);
+void index_retain (int (*keep) (const IndexSound *sound));
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "common.h"
+#include "cyaml/cyaml.h"
+#include "index.h"
+
+/**
+ * @brief Downloaded sound fields schema
+ * @param id            - Sound Id
+ * @param url           - Sound url
+ * @param etag          - ETag of the downloaded file (optional)
+ * @param last_modified - Last-Modified of the downloaded file (optional)
+ * @param size          - Downloaded file size
+ * @param md5           - Downloaded file MD5, hex
+ */
+static const cyaml_schema_field_t schemaIndexSoundFields[] = {
+    CYAML_FIELD_UINT       ("id",   CYAML_FLAG_STRICT
+        , IndexSound, id),
+
+    CYAML_FIELD_STRING_PTR ("url",  CYAML_FLAG_POINTER
+        , IndexSound, url, 0, CYAML_UNLIMITED),
+
+    CYAML_FIELD_STRING_PTR ("etag", CYAML_FLAG_POINTER | CYAML_FLAG_OPTIONAL
+        , IndexSound, etag, 0, CYAML_UNLIMITED),
+
+    CYAML_FIELD_STRING_PTR ("last_modified", CYAML_FLAG_POINTER | CYAML_FLAG_OPTIONAL
+        , IndexSound, last_modified, 0, CYAML_UNLIMITED),
+
+    CYAML_FIELD_UINT       ("size", CYAML_FLAG_OPTIONAL
+        , IndexSound, size),
+
+    CYAML_FIELD_STRING_PTR ("md5",  CYAML_FLAG_POINTER | CYAML_FLAG_OPTIONAL
+        , IndexSound, md5, 0, CYAML_UNLIMITED),
+
+    CYAML_FIELD_END
+};
+
+/**
+ * @brief Downloaded sound mapping schema
+ */
+static const cyaml_schema_value_t schemaIndexSound = {
+    CYAML_VALUE_MAPPING (CYAML_FLAG_DEFAULT, IndexSound, schemaIndexSoundFields),
+};
+
+/**
+ * @brief Sound index fields schema
+ * @param sounds - downloaded sounds (sequence)
+ */
+static const cyaml_schema_field_t schemaIndexFields[] = {
+    CYAML_FIELD_SEQUENCE ("sounds", CYAML_FLAG_POINTER | CYAML_FLAG_OPTIONAL, IndexData, sounds
+        , &schemaIndexSound, 0, CYAML_UNLIMITED),
+
+    CYAML_FIELD_END
+};
+
+/**
+ * @brief Top Yaml mapping schema
+ */
+static const cyaml_schema_value_t schemaIndex = {
+    CYAML_VALUE_MAPPING (CYAML_FLAG_POINTER, IndexData, schemaIndexFields),
+};
+
+/**
+ * @brief CYaml config
+ * @param log_fn - lib logging function (disable it)
+ * @param mem_fn - lib memory allocation function
+ */
+static cyaml_config_t ymlIndexConfig = {
+    .log_fn = NULL,
+    .mem_fn = cyaml_mem
+};
@@ -0,0 +1,21 @@
+/**
+ * @file log.h
+ * @author Denys Stovbun (denis.stovbun@lanars.com)
+ * @brief Asynchronous log writer
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ *
+ *
+ */
+#pragma once
+
+#include "app.h"
+
+#define LOG_OVERRIDES       32      // Files with their own level
+
+int log_start (int type);
+void log_stop ();
+const char * log_level_header (int lvl);
+int log_set_level (const char *file, int level);
+int log_levels (const char **files, int *levels, int max);
@@ -0,0 +1,21 @@
+/**
+ * @file loop.h
+ * @author Denys Stovbun (denis.stovbun@lanars.com)
+ * @brief Service main event loop
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ *
+ *
+ */
+#pragma once
+
+#include <systemd/sd-event.h>
+
+#include "app.h"
+
+int loop_init ();
+void loop_deinit ();
+sd_event * loop_event ();
+int loop_run ();
+void loop_quit (int code);
@@ -0,0 +1,26 @@
+/**
+ * @file md5.h
+ * @author Denys Stovbun (denis.stovbun@lanars.com)
+ * @brief MD5 digest (RFC 1321)
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ *
+ *
+ */
+#pragma once
+
+#include "app.h"
+
+#define MD5_SIZE                16
+
+typedef struct Md5Struct {
+    uint32_t            state[4];
+    uint64_t            bytes;
+    uint8_t             block[64];
+} Md5;
+
+void md5_init (Md5 *c);
+void md5_update (Md5 *c, const void *data, size_t len);
+void md5_final (Md5 *c, uint8_t digest[MD5_SIZE]);
+int md5_file (const char *filename, uint8_t digest[MD5_SIZE]);
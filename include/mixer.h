@@ -2,5 +2,7 @@
 
 #include <stdint.h>
 
+int mixer_init ();
+void mixer_deinit ();
 int mixer_set_volume ();
 int mixer_get_volume ();
\ No newline at end of file
@@ -0,0 +1,34 @@
+/**
+ * @file resample.h
+ * @author Denys Stovbun (denis.stovbun@lanars.com)
+ * @brief Polyphase sample rate converter
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ *
+ *
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum ResampleQualityEnum {
+      ResampleFast
+    , ResampleMedium
+    , ResampleBest
+    , ResampleQualityMAX
+} ResampleQuality;
+
+typedef struct ResamplerStruct Resampler;
+
+Resampler * resample_new (uint32_t inRate, uint32_t outRate, uint16_t channels, ResampleQuality quality);
+void resample_free (Resampler *r);
+int resample_copy (Resampler *dst, const Resampler *src);
+size_t resample_max_out (const Resampler *r, size_t inFrames);
+size_t resample_process (Resampler *r, const int16_t *in, size_t inFrames, int16_t *out);
+size_t resample_flush (Resampler *r, int16_t *out);
+int16_t * resample_buffer (const int16_t *in, size_t frames, uint32_t inRate, uint32_t outRate
+    , uint16_t channels, ResampleQuality quality, size_t *outFrames);
+int resample_set_simd (int enable);
+const char * resample_quality_name (ResampleQuality quality);
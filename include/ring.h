@@ -0,0 +1,20 @@
+/**
+ * @file ring.h
+ * @author Denys Stovbun (denis.stovbun@lanars.com)
+ * @brief Lock-free single producer, single consumer ring
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ *
+ *
+ */
+#pragma once
+
+#include "app.h"
+
+typedef struct RingStruct Ring;
+
+Ring * ring_new (uint32_t count, size_t size);
+void ring_free (Ring *r);
+int ring_push (Ring *r, const void *item);
+int ring_pop (Ring *r, void *item);
@@ -0,0 +1,29 @@
+/**
+ * @file sample.h
+ * @author Denys Stovbun (denis.stovbun@lanars.com)
+ * @brief Sample format conversion kernels
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ *
+ *
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <alsa/asoundlib.h>
+
+// Mix gains are fixed point, SAMPLE_GAIN_UNITY is 0 dB and the maximum
+#define SAMPLE_GAIN_SHIFT   16
+#define SAMPLE_GAIN_UNITY   (1 << SAMPLE_GAIN_SHIFT)
+
+int sample_to_s16 (snd_pcm_format_t format, const void *src, int16_t *dst, size_t samples);
+int sample_from_s16 (snd_pcm_format_t format, const int16_t *src, void *dst, size_t samples);
+int sample_to_float (snd_pcm_format_t format, const void *src, float *dst, size_t samples);
+int sample_from_float (snd_pcm_format_t format, const float *src, void *dst, size_t samples);
+void sample_mix_s16 (int32_t *acc, const int16_t *src, uint32_t gain, size_t samples);
+void sample_clip_s16 (const int32_t *src, int16_t *dst, size_t samples);
+int sample_width (snd_pcm_format_t format);
+int sample_set_simd (int enable);
+const char * sample_simd_name ();
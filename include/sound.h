@@ -8,6 +8,11 @@ int sound_start_service ();
 int sound_play (SoundType soundId);
 int sound_stop (SoundType soundId);
 int sound_update (SoundShort *soundData, int count);
+void sound_downloaded (SoundShort *snd);
+void sound_progress (SoundShort *snd, GrowBuf *grow);
+void sound_not_modified (SoundShort *snd);
 void sound_playing (int *call, int *open);
+void sound_set_playing (SoundType type, int playing);
+void sound_free_data (SoundData *data);
 AppState sound_state ();
 const char * sound_state_name ();
\ No newline at end of file
@@ -0,0 +1,24 @@
+/**
+ * @file stream.h
+ * @author Denys Stovbun (denis.stovbun@lanars.com)
+ * @brief Streaming decoder for long sounds
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ *
+ *
+ */
+#pragma once
+
+#include "app.h"
+
+// Output frames decoded per chunk (170 ms at 48 kHz)
+#define STREAM_CHUNK_FRAMES     8192
+// Chunks decoded ahead of the audio thread
+#define STREAM_BUFFERS          3
+
+SoundStream * stream_open (const SoundData *data);
+void stream_close (SoundStream *s);
+snd_pcm_uframes_t stream_frames (SoundStream *s);
+snd_pcm_uframes_t stream_read (SoundStream *s, snd_pcm_uframes_t pos, int16_t *dst, snd_pcm_uframes_t frames);
+uint32_t stream_underruns (const SoundStream *s);
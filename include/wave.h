@@ -0,0 +1,70 @@
+/**
+ * @file wave.h
+ * @author Denys Stovbun (denis.stovbun@lanars.com)
+ * @brief Incremental RIFF/RIFX WAVE parser
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * The parser is fed with byte chunks of any size, as they come from a
+ * download, a mapping or a whole built-in image. It keeps no copy of the
+ * samples: data regions point into the chunk just pushed.
+ *
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <alsa/asoundlib.h>
+
+#define WAVE_FMT_MAX    40  // sizeof (WaveFmtExtensibleBody), the rest of fmt is skipped
+
+typedef enum WaveEventEnum {
+      WaveNeedMore      // Input is used up, push the next chunk
+    , WaveFormat        // Format fields are known
+    , WaveData          // Data chunk header is read, dataOffset and dataLength are known
+    , WaveSamples       // WaveRegion holds samples of the data chunk
+    , WaveEnd           // Data chunk is complete, the rest of the input is ignored
+    , WaveError         // Not a playable WAVE, see error
+} WaveEvent;
+
+typedef enum WaveStateEnum {
+      WaveStateHeader
+    , WaveStateChunk
+    , WaveStateFmt
+    , WaveStateSkip
+    , WaveStateData
+    , WaveStateDone
+    , WaveStateError
+} WaveState;
+
+typedef struct WaveRegionStruct {
+    const uint8_t      *data;       // Inside the pushed chunk
+    size_t              size;       // Bytes
+    uint64_t            offset;     // From the start of the data chunk
+} WaveRegion;
+
+typedef struct WaveParserStruct {
+    // Valid after WaveFormat
+    snd_pcm_format_t    format;
+    uint32_t            rate;
+    uint16_t            channels;
+    uint16_t            align;
+    uint16_t            bits;
+    int                 bigEndian;
+    // Valid after WaveData
+    uint64_t            dataOffset; // From the start of the file
+    uint64_t            dataLength; // As the chunk header says
+    const char         *error;
+
+    // Private
+    WaveState           state;
+    uint64_t            pos;        // Bytes consumed so far
+    uint64_t            left;       // Bytes left in the current chunk
+    uint32_t            chunk;      // Current chunk length
+    uint32_t            have;       // Bytes gathered in hdr
+    int                 formatted;
+    uint8_t             hdr[WAVE_FMT_MAX];
+} WaveParser;
+
+void wave_init (WaveParser *p);
+WaveEvent wave_parse (WaveParser *p, const uint8_t **buf, size_t *len, WaveRegion *region);
@@ -8,6 +8,7 @@
  *
  *
  */
+#include <stdio.h>
 #include <semaphore.h>
 
 #include "app.h"
@@ -15,20 +16,33 @@
 #include "sound.h"
 #include "mixer.h"
 #include "config.h"
+#include "engine.h"
+#include "cache.h"
+#include "loop.h"
+#include "log.h"
 
 // Local function definitions
 static int dbus_get_state_cb (sd_bus *b, const char *p, const char *i, const char *name, sd_bus_message *reply, void *_data, sd_bus_error *retError);
 static int dbus_get_playing_cb (sd_bus *b, const char *p, const char *i, const char *name, sd_bus_message *reply, void *_data, sd_bus_error *retError);
 static int dbus_get_volume_cb (sd_bus *b, const char *p, const char *i, const char *name, sd_bus_message *reply, void *_data, sd_bus_error *retError);
 static int dbus_set_volume_cb (sd_bus *b, const char *p, const char *i, const char *name, sd_bus_message *value, void *_data, sd_bus_error *retError);
+static int dbus_get_latency_cb (sd_bus *b, const char *p, const char *i, const char *name, sd_bus_message *reply, void *_data, sd_bus_error *retError);
+static int dbus_get_realtime_cb (sd_bus *b, const char *p, const char *i, const char *name, sd_bus_message *reply, void *_data, sd_bus_error *retError);
+static int dbus_get_cache_cb (sd_bus *b, const char *p, const char *i, const char *name, sd_bus_message *reply, void *_data, sd_bus_error *retError);
+static int dbus_get_log_cb (sd_bus *b, const char *p, const char *i, const char *name, sd_bus_message *reply, void *_data, sd_bus_error *retError);
+static int dbus_get_xruns_cb (sd_bus *b, const char *p, const char *i, const char *name, sd_bus_message *reply, void *_data, sd_bus_error *retError);
 static int dbus_play_cb (sd_bus_message *m, void *userdata, sd_bus_error *retError);
 static int dbus_stop_cb (sd_bus_message *m, void *userdata, sd_bus_error *retError);
 static int dbus_update_cb (sd_bus_message *m, void *userdata, sd_bus_error *retError);
+static int dbus_log_cb (sd_bus_message *m, void *userdata, sd_bus_error *retError);
+static int dbus_gain_cb (sd_bus_message *m, void *userdata, sd_bus_error *retError);
 static int dbus_read_update(sd_bus_message *m);
 static const char *bus_get_error (const sd_bus_error *e, int error);
 
 // Local variables
 static sd_bus       *bus;
+// Key prefixes of the xruns property, SoundNone is output after the sounds
+static const char   *xrunNames[SoundMAX] = { "idle", "test", "open", "call" };
 
 /**
  * @brief Service interface items table
@@ -47,9 +61,26 @@ static const sd_bus_vtable vTable[] = {
         , dbus_stop_cb
         , BUS_COMMON_FLAGS
     ),
+    SD_BUS_METHOD_WITH_NAMES(SOUND_METHOD_LOG
+        , SOUND_METHOD_LOG_SGN, SD_BUS_PARAM (file) SD_BUS_PARAM (level)
+        , SOUND_METHOD_RETURN,  SD_BUS_PARAM (ok)
+        , dbus_log_cb
+        , BUS_COMMON_FLAGS
+    ),
+    SD_BUS_METHOD_WITH_NAMES(SOUND_METHOD_GAIN
+        , SOUND_METHOD_GAIN_SGN, SD_BUS_PARAM (soundType) SD_BUS_PARAM (gain)
+        , SOUND_METHOD_RETURN,   SD_BUS_PARAM (ok)
+        , dbus_gain_cb
+        , BUS_COMMON_FLAGS
+    ),
     SD_BUS_PROPERTY (SOUND_PROP_STATE,   "y",  dbus_get_state_cb,   0, BUS_COMMON_FLAGS | SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
     SD_BUS_PROPERTY (SOUND_PROP_PLAYING, "ay", dbus_get_playing_cb, 0, BUS_COMMON_FLAGS | SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
     SD_BUS_WRITABLE_PROPERTY (SOUND_PROP_VOLUME, "y", dbus_get_volume_cb, dbus_set_volume_cb, 0, BUS_COMMON_FLAGS),
+    SD_BUS_PROPERTY (SOUND_PROP_LATENCY, "u",  dbus_get_latency_cb, 0, BUS_COMMON_FLAGS),
+    SD_BUS_PROPERTY (SOUND_PROP_REALTIME, "b", dbus_get_realtime_cb, 0, BUS_COMMON_FLAGS),
+    SD_BUS_PROPERTY (SOUND_PROP_CACHE, SOUND_PROP_CACHE_SGN, dbus_get_cache_cb, 0, BUS_COMMON_FLAGS),
+    SD_BUS_PROPERTY (SOUND_PROP_LOG,   SOUND_PROP_LOG_SGN,   dbus_get_log_cb,   0, BUS_COMMON_FLAGS),
+    SD_BUS_PROPERTY (SOUND_PROP_XRUNS, SOUND_PROP_XRUNS_SGN, dbus_get_xruns_cb, 0, BUS_COMMON_FLAGS),
     SD_BUS_VTABLE_END
 };
 
@@ -86,6 +117,11 @@ int dbus_init () {
     r = sd_bus_request_name (bus, DBUS_THIS_NAME, 0);
     returnValIfFailErr (DBUS_OK (r), r, "Failed to acquire service name (%d): %s", r, strerror (-r));
 
+    // Requests are dispatched by the main event loop
+    r = sd_bus_attach_event (bus, loop_event (), SD_EVENT_PRIORITY_NORMAL);
+    returnValIfFailErr (DBUS_OK (r), r, "Attach bus to event loop error (%d): %s", r, strerror (-r));
+    sd_bus_set_exit_on_disconnect (bus, TRUE);
+
     r = sd_bus_get_unique_name (bus, &uniqueName);
     if (DBUS_OK (r))
         selfLogDbg ("Unique name: %s", uniqueName);
@@ -98,22 +134,8 @@ int dbus_init () {
 
 void dbus_deinit () {
     if (bus)
-        sd_bus_unref (bus);
-}
-
-int dbus_loop () {
-    int r;
-    // Process requests
-    r = sd_bus_process (bus, NULL);
-    returnValIfFailErr (DBUS_OK (r), -r, "Failed to process bus (%d): %s", r, strerror (-r));
-    if (r > 0) // we processed a request, try to process another one, right-away
-        return EXIT_SUCCESS;
-
-    // Wait for the next request to process
-    r = sd_bus_wait (bus, 100000UL);
-    returnValIfFailErr (DBUS_OK (r), -r, "Failed to wait on bus: %s", strerror (-r));
-
-    return EXIT_SUCCESS;
+        sd_bus_flush_close_unref (bus);
+    bus = NULL;
 }
 
 int dbus_get_data () {
@@ -205,6 +227,70 @@ static int dbus_set_volume_cb (sd_bus *b, const char *p, const char *i, const ch
     return 0;
 }
 
+static int dbus_get_latency_cb (sd_bus *b, const char *p, const char *i, const char *name, sd_bus_message *reply, void *_data, sd_bus_error *retError) {
+    return sd_bus_message_append (reply, "u", engine_latency ());
+}
+
+static int dbus_get_realtime_cb (sd_bus *b, const char *p, const char *i, const char *name, sd_bus_message *reply, void *_data, sd_bus_error *retError) {
+    return sd_bus_message_append (reply, "b", engine_realtime ());
+}
+
+static int dbus_get_cache_cb (sd_bus *b, const char *p, const char *i, const char *name, sd_bus_message *reply, void *_data, sd_bus_error *retError) {
+    CacheStats st;
+
+    cache_stats (&st);
+    return sd_bus_message_append (reply, SOUND_PROP_CACHE_SGN, 6
+        , "hits",      st.hits
+        , "misses",    st.misses
+        , "evictions", st.evictions
+        , "bytes",     st.bytes
+        , "budget",    st.budget
+        , "files",     (uint64_t) st.files);
+}
+
+static int dbus_get_log_cb (sd_bus *b, const char *p, const char *i, const char *name, sd_bus_message *reply, void *_data, sd_bus_error *retError) {
+    const char *files[LOG_OVERRIDES];
+    int levels[LOG_OVERRIDES];
+    int r, n, k;
+
+    n = log_levels (files, levels, LOG_OVERRIDES);
+
+    // The global level comes first under an empty name
+    r = sd_bus_message_open_container (reply, 'a', "{sy}");
+    if (r >= 0)
+        r = sd_bus_message_append (reply, "{sy}", "", (uint8_t) gLogLevel);
+    for (k = 0; k < n && r >= 0; k++)
+        r = sd_bus_message_append (reply, "{sy}", files[k], (uint8_t) levels[k]);
+    if (r >= 0)
+        r = sd_bus_message_close_container (reply);
+
+    return r;
+}
+
+static int dbus_get_xruns_cb (sd_bus *b, const char *p, const char *i, const char *name, sd_bus_message *reply, void *_data, sd_bus_error *retError) {
+    EngineStats st;
+    char key[4][32];
+    int r, t;
+
+    r = sd_bus_message_open_container (reply, 'a', "{st}");
+    for (t = SoundNone; t < SoundMAX && r >= 0; t++) {
+        engine_stats (t, &st);
+        snprintf (key[0], sizeof (key[0]), "%s.xruns", xrunNames[t]);
+        snprintf (key[1], sizeof (key[1]), "%s.recovery_us", xrunNames[t]);
+        snprintf (key[2], sizeof (key[2]), "%s.recovery_max_us", xrunNames[t]);
+        snprintf (key[3], sizeof (key[3]), "%s.short_writes", xrunNames[t]);
+        r = sd_bus_message_append (reply, "{st}{st}{st}{st}"
+            , key[0], st.xruns
+            , key[1], st.recoveryUs
+            , key[2], st.recoveryMaxUs
+            , key[3], st.shortWrites);
+    }
+    if (r >= 0)
+        r = sd_bus_message_close_container (reply);
+
+    return r;
+}
+
 static int dbus_play_cb (sd_bus_message *m, void *userdata, sd_bus_error *retError) {
     // Variables
     int r;
@@ -241,6 +327,50 @@ static int dbus_stop_cb (sd_bus_message *m, void *userdata, sd_bus_error *retErr
     return sd_bus_reply_method_return(m, "b", r);
 }
 
+static int dbus_log_cb (sd_bus_message *m, void *userdata, sd_bus_error *retError) {
+    // Variables
+    int r;
+    const char *file = NULL;
+    uint8_t level = 0;
+
+    // Read method parameters
+    r = sd_bus_message_read (m, SOUND_METHOD_LOG_SGN, &file, &level);
+    dbusReplyErrorOnFail (r, m, "Read method argument error(%d): %s", r, strerror (-r));
+
+    r = log_set_level (file, level == SOUND_LOG_GLOBAL ? LOG_MODULE_GLOBAL : level);
+    if (r < 0)
+        return sd_bus_reply_method_errorf (m, SD_BUS_ERROR_INVALID_ARGS, "Can't set log level %u of '%s': %s", level, file, strerror (-r));
+    if (level > LOG_LEVEL_BUILD && level != SOUND_LOG_GLOBAL)
+        selfLogWrn ("Log level %u is above the built-in %d", level, LOG_LEVEL_BUILD);
+
+    selfLogInf ("Log level of '%s' is %u", file, level);
+
+    // Reply bool result
+    return sd_bus_reply_method_return(m, "b", TRUE);
+}
+
+static int dbus_gain_cb (sd_bus_message *m, void *userdata, sd_bus_error *retError) {
+    // Variables
+    int r;
+    uint8_t id = SoundNone;
+    uint32_t gain = 0;
+
+    // Read method parameters
+    r = sd_bus_message_read (m, SOUND_METHOD_GAIN_SGN, &id, &gain);
+    dbusReplyErrorOnFail (r, m, "Read method argument error(%d): %s", r, strerror (-r));
+
+    if (id <= SoundNone || id >= SoundMAX)
+        return sd_bus_reply_method_errorf (m, SD_BUS_ERROR_INVALID_ARGS, "Invalid sound type: %d", id);
+    if (gain > ENGINE_UNITY)
+        selfLogWrn ("Gain %u is above unity, limited to %u", gain, ENGINE_UNITY);
+
+    engine_set_gain ((SoundType) id, gain);
+    selfLogInf ("Gain of %u is %u", id, gain > ENGINE_UNITY ? ENGINE_UNITY : gain);
+
+    // Reply bool result
+    return sd_bus_reply_method_return(m, "b", TRUE);
+}
+
 static int dbus_update_cb (sd_bus_message *m, void *userdata, sd_bus_error *retError) {
     // Read update
     int r = dbus_read_update (m);
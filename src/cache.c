@@ -0,0 +1,542 @@
+/**
+ * @file cache.c
+ * @author Denys Stovbun (denis.stovbun@lanars.com)
+ * @brief Transcoded sound cache
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * A downloaded sound is decoded and converted to the engine format once,
+ * then stored behind a small header carrying its format, frame count and
+ * checksums. Later starts map the file and play the samples in place with
+ * no parsing at all. An entry that does not match its header is dropped
+ * so the sound gets downloaded again. The samples are checked against
+ * their checksum once, when the entry is written, so a start never reads
+ * the entries in full.
+ *
+ * Entries are named after the MD5 of the downloaded file, so sounds with
+ * different ids and the same content share one entry. Downloads that are
+ * not converted (compressed or streamed sounds) stay in the same folder
+ * under their id. Entries and downloads together fit in CACHE_BUDGET
+ * bytes: the least recently used ones are evicted first, the sounds in
+ * use never. The file mtime is the last use time and survives restarts.
+ * The folder belongs to the service, files nobody refers to are removed.
+ *
+ */
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "app.h"
+#include "cache.h"
+#include "engine.h"
+
+#define CACHE_HASH_SIZE         (2 * MD5_SIZE)
+// Longest file name tracked, entries and downloads are much shorter
+#define CACHE_NAME_SIZE         63
+
+typedef struct CacheEntryStruct {
+    char                name[CACHE_NAME_SIZE + 1];  // File name in the cache folder
+    uint64_t            size;
+    uint64_t            used;           // Last use, ns since the epoch
+} CacheEntry;
+
+static pthread_once_t   crcOnce = PTHREAD_ONCE_INIT;
+static uint32_t         crcTable[256];
+static char             cacheDir[MAX_FILE_SIZE + 1] = {0};
+static CacheEntry      *entries = NULL;
+static uint32_t         entriesCount = 0;
+static CacheStats       stats = { .budget = CACHE_BUDGET };
+
+static const char * cache_check (const CacheHeader *h, size_t fileSize, const char *hash);
+static void cache_scan (int init);
+static void cache_path (char *path, const char *name);
+static void cache_name (char *name, const char *hash);
+static int cache_is_hash (const char *name, size_t len);
+static int cache_has_ext (const char *name, const char *ext);
+static CacheEntry * cache_find (const char *name);
+static void cache_add (const char *name, uint64_t size, uint64_t used);
+static void cache_remove (const char *name);
+static uint64_t cache_now ();
+static uint32_t cache_crc (uint32_t crc, const void *buf, size_t len);
+static int cache_write (int fd, const void *buf, size_t len);
+static int cache_verify (int fd, size_t bytes, uint32_t crc);
+
+/**
+ * @brief Indexes the entries and downloads found in the cache folder
+ *
+ * The folder is created when missing. Leftovers of interrupted writes and
+ * entries of older versions are removed.
+ *
+ * @param dir cache folder
+ * @return int TRUE on success
+ */
+int cache_init (const char *dir) {
+    strncpy (cacheDir, dir, MAX_FILE_SIZE);
+
+    if (mkdir (cacheDir, 0755) && errno != EEXIST) {
+        selfLogErr ("Create cache folder [%s] error: %m", cacheDir);
+        return FALSE;
+    }
+
+    cache_scan (TRUE);
+
+    selfLogInf ("Cache [%s] has %u sound(s), %lu of %lu bytes", cacheDir, stats.files, stats.bytes, stats.budget);
+    return TRUE;
+}
+
+void cache_deinit () {
+    free (entries);
+    entries = NULL;
+    entriesCount = 0;
+    stats.files = 0;
+    stats.bytes = 0;
+}
+
+/**
+ * @brief Maps a cached sound
+ *
+ * Stale or corrupted entries are removed.
+ *
+ * @param data sound, filled on success
+ * @param hash MD5 of the downloaded file, hex, NULL if it is not known yet
+ * @return int TRUE if the sound is ready to play
+ */
+int cache_load (SoundData *data, const char *hash) {
+    char                path[MAX_FILE_SIZE + 1];
+    char                name[CACHE_NAME_SIZE + 1];
+    const CacheHeader  *h;
+    const char         *err;
+    struct stat         st;
+    void               *map;
+    int                 fd;
+
+    if (!hash) {
+        stats.misses++;
+        return FALSE;
+    }
+
+    cache_name (name, hash);
+    cache_path (path, name);
+    if ((fd = open (path, O_RDONLY | O_CLOEXEC)) < 0) {
+        if (errno != ENOENT)
+            selfLogWrn ("Can't open cache [%s]: %m", path);
+        stats.misses++;
+        return FALSE;
+    }
+
+    if (fstat (fd, &st) || st.st_size < CACHE_DATA_OFFSET) {
+        close (fd);
+        selfLogWrn ("Drop cache [%s]: too short", path);
+        unlink (path);
+        cache_remove (name);
+        stats.misses++;
+        return FALSE;
+    }
+
+    map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        selfLogErr ("Map cache [%s] error: %m", path);
+        close (fd);
+        stats.misses++;
+        return FALSE;
+    }
+
+    h = (const CacheHeader *) map;
+    err = cache_check (h, st.st_size, hash);
+    if (err) {
+        selfLogWrn ("Drop cache [%s]: %s", path, err);
+        close (fd);
+        munmap (map, st.st_size);
+        unlink (path);
+        cache_remove (name);
+        stats.misses++;
+        return FALSE;
+    }
+
+    // Last use time for the eviction order
+    futimens (fd, NULL);
+    close (fd);
+    cache_remove (name);
+    cache_add (name, st.st_size, cache_now ());
+    stats.hits++;
+
+    madvise (map, st.st_size, MADV_WILLNEED);
+    data->map = map;
+    data->mapSize = st.st_size;
+    data->data = (uint8_t *) map + CACHE_DATA_OFFSET;
+    data->format = (snd_pcm_format_t) h->format;
+    data->rate = h->rate;
+    data->channels = h->channels;
+    data->bits = snd_pcm_format_physical_width (data->format);
+    data->align = data->channels * data->bits / 8;
+    data->size = h->frames;
+    strncpy (data->filename, path, MAX_FILE_SIZE);
+
+    selfLogDbg ("Cached [%s] %lu frames", path, data->size);
+    return TRUE;
+}
+
+/**
+ * @brief Writes converted sound data to the cache
+ *
+ * The file is written aside and renamed, so a crash never leaves a
+ * half-written entry under the final name.
+ *
+ * @param data sound in the engine format
+ * @param hash MD5 of the downloaded file, hex
+ * @return int TRUE on success
+ */
+int cache_store (const SoundData *data, const char *hash) {
+    CacheHeader        *h;
+    char                path[MAX_FILE_SIZE + 1];
+    char                name[CACHE_NAME_SIZE + 1];
+    char                tmp[MAX_FILE_SIZE + 8];
+    size_t              bytes;
+    int                 fd, ok;
+
+    returnValIfFailErr (data->data && data->format == ENGINE_FORMAT && data->rate == ENGINE_RATE
+        && data->channels == ENGINE_CHANNELS, FALSE, "Sound [%s] is not in the engine format", data->filename);
+    returnValIfFailErr (cache_is_hash (hash, strlen (hash)), FALSE, "Wrong cache key [%s]", hash);
+
+    bytes = data->size * ENGINE_FRAME_BYTES;
+
+    // Zeroed block keeps the header padding, and so its checksum, stable
+    h = (CacheHeader *) calloc (1, CACHE_DATA_OFFSET);
+    returnValIfFailErr (h, FALSE, "Allocate cache header error: %m");
+
+    memcpy (h->magic, CACHE_MAGIC, sizeof (h->magic));
+    h->version = CACHE_VERSION;
+    h->channels = data->channels;
+    h->rate = data->rate;
+    h->format = data->format;
+    h->frames = data->size;
+    h->dataCrc = cache_crc (0, data->data, bytes);
+    strcpy (h->hash, hash);
+    h->headerCrc = cache_crc (0, h, sizeof (CacheHeader));
+
+    cache_name (name, hash);
+    cache_path (path, name);
+    snprintf (tmp, sizeof (tmp), "%s.tmp", path);
+    fd = open (tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        selfLogErr ("Create cache [%s] error: %m", tmp);
+        free (h);
+        return FALSE;
+    }
+
+    ok = cache_write (fd, h, CACHE_DATA_OFFSET)
+        && cache_write (fd, data->data, bytes)
+        && !fsync (fd);
+    if (!ok)
+        selfLogErr ("Write cache [%s] error: %m", tmp);
+    else if (!(ok = cache_verify (fd, bytes, h->dataCrc)))
+        selfLogErr ("Cache [%s] reads back other samples", tmp);
+    close (fd);
+    free (h);
+
+    if (ok && rename (tmp, path)) {
+        selfLogErr ("Rename cache [%s] error: %m", tmp);
+        ok = FALSE;
+    }
+    if (!ok) {
+        unlink (tmp);
+        return FALSE;
+    }
+
+    cache_remove (name);
+    cache_add (name, CACHE_DATA_OFFSET + bytes, cache_now ());
+
+    selfLogInf ("Cached [%s] as [%s], %lu frames", data->filename, path, data->size);
+    return TRUE;
+}
+
+/**
+ * @brief Tells whether a file is kept in the cache folder
+ *
+ * @param name file name, an entry (<md5>.snd) or a download
+ * @return int TRUE if it is there
+ */
+int cache_contains (const char *name) {
+    return cache_find (name) != NULL;
+}
+
+/**
+ * @brief Removes the files in the cache folder nobody refers to
+ *
+ * Entries are left to the eviction, they are shared by content. Every
+ * other file is offered to the callback and removed unless it is kept.
+ *
+ * @param keep tells whether a file name is still referred to
+ */
+void cache_sweep (int (*keep) (const char *name)) {
+    char            path[MAX_FILE_SIZE + 1];
+    struct dirent  *e;
+    DIR            *d;
+
+    d = opendir (cacheDir);
+    returnIfFailErr (d, "Open cache folder [%s] error: %m", cacheDir);
+
+    while ((e = readdir (d))) {
+        if (e->d_name[0] == '.' || cache_has_ext (e->d_name, CACHE_EXT) || keep (e->d_name))
+            continue;
+
+        snprintf (path, sizeof (path), "%s/%s", cacheDir, e->d_name);
+        selfLogInf ("Drop unreferenced [%s]", path);
+        unlink (path);
+        cache_remove (e->d_name);
+    }
+    closedir (d);
+}
+
+/**
+ * @brief Evicts the least recently used files until the cache fits its budget
+ *
+ * The folder is scanned again first, so the downloads that came and went
+ * since the last trim are counted.
+ *
+ * @param keep tells whether a file name belongs to a sound in use, never evicted
+ */
+void cache_trim (int (*keep) (const char *name)) {
+    char        path[MAX_FILE_SIZE + 1];
+    CacheEntry *e, *victim;
+    uint32_t    i;
+
+    cache_scan (FALSE);
+
+    while (stats.bytes > stats.budget) {
+        victim = NULL;
+        for (i = 0; i < entriesCount; i++) {
+            e = entries + i;
+            if (!keep (e->name) && (!victim || e->used < victim->used))
+                victim = e;
+        }
+
+        // Only the sounds in use are left
+        if (!victim)
+            break;
+
+        cache_path (path, victim->name);
+        selfLogInf ("Evict cache [%s] %lu bytes", path, victim->size);
+        unlink (path);
+        cache_remove (victim->name);
+        stats.evictions++;
+    }
+
+    if (stats.bytes > stats.budget)
+        selfLogWrn ("Sounds in use take %lu bytes, over the cache budget %lu", stats.bytes, stats.budget);
+}
+
+void cache_stats (CacheStats *out) {
+    *out = stats;
+}
+
+/**
+ * @brief Validates a mapped cache entry against the sound it should hold
+ *
+ * @return const char* reason to drop the entry, NULL if it is good
+ */
+static const char * cache_check (const CacheHeader *h, size_t fileSize, const char *hash) {
+    CacheHeader hdr;
+
+    if (memcmp (h->magic, CACHE_MAGIC, sizeof (h->magic)))
+        return "bad magic";
+    if (h->version != CACHE_VERSION)
+        return "other version";
+
+    memcpy (&hdr, h, sizeof (hdr));
+    hdr.headerCrc = 0;
+    if (cache_crc (0, &hdr, sizeof (hdr)) != h->headerCrc)
+        return "header checksum mismatch";
+
+    if (strncmp (h->hash, hash, sizeof (h->hash)))
+        return "other sound";
+    if (h->format != ENGINE_FORMAT || h->rate != ENGINE_RATE || h->channels != ENGINE_CHANNELS)
+        return "other device format";
+    if (!h->frames || fileSize != CACHE_DATA_OFFSET + h->frames * ENGINE_FRAME_BYTES)
+        return "size mismatch";
+
+    // Samples were verified on store, reading them here would fault in every entry
+    return NULL;
+}
+
+/**
+ * @brief Indexes the entries and the kept downloads of the cache folder anew
+ *
+ * @param init TRUE at start, when leftovers of interrupted writes are removed
+ */
+static void cache_scan (int init) {
+    char            path[MAX_FILE_SIZE + 1];
+    struct dirent  *e;
+    struct stat     st;
+    size_t          len;
+    DIR            *d;
+
+    d = opendir (cacheDir);
+    returnIfFailErr (d, "Open cache folder [%s] error: %m", cacheDir);
+
+    entriesCount = 0;
+    stats.files = 0;
+    stats.bytes = 0;
+
+    while ((e = readdir (d))) {
+        len = strlen (e->d_name);
+        snprintf (path, sizeof (path), "%s/%s", cacheDir, e->d_name);
+
+        if (init && strstr (e->d_name, CACHE_EXT ".tmp")) {
+            selfLogInf ("Drop cache [%s]", path);
+            unlink (path);
+            continue;
+        }
+
+        if (cache_has_ext (e->d_name, CACHE_EXT)) {
+            if (!cache_is_hash (e->d_name, len - strlen (CACHE_EXT))) {
+                selfLogInf ("Drop cache [%s]", path);
+                unlink (path);
+                continue;
+            }
+        } else if (!cache_has_ext (e->d_name, CACHE_SOURCE_EXT) || len > CACHE_NAME_SIZE) {
+            continue;
+        }
+
+        if (stat (path, &st) || !S_ISREG (st.st_mode))
+            continue;
+        cache_add (e->d_name, st.st_size, (uint64_t) st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec);
+    }
+    closedir (d);
+}
+
+static void cache_path (char *path, const char *name) {
+    snprintf (path, MAX_FILE_SIZE, "%s/%s", cacheDir, name);
+}
+
+static void cache_name (char *name, const char *hash) {
+    snprintf (name, CACHE_NAME_SIZE + 1, "%s" CACHE_EXT, hash);
+}
+
+static int cache_is_hash (const char *name, size_t len) {
+    size_t i;
+
+    if (len != CACHE_HASH_SIZE)
+        return FALSE;
+
+    for (i = 0; i < len; i++)
+        if (!strchr ("0123456789abcdef", name[i]))
+            return FALSE;
+
+    return TRUE;
+}
+
+static int cache_has_ext (const char *name, const char *ext) {
+    size_t len = strlen (name);
+
+    return len > strlen (ext) && !strcmp (name + len - strlen (ext), ext);
+}
+
+static CacheEntry * cache_find (const char *name) {
+    uint32_t i;
+
+    for (i = 0; i < entriesCount; i++)
+        if (!strcmp (entries[i].name, name))
+            return entries + i;
+
+    return NULL;
+}
+
+static void cache_add (const char *name, uint64_t size, uint64_t used) {
+    CacheEntry *e;
+
+    e = (CacheEntry *) realloc (entries, sizeof (CacheEntry) * (entriesCount + 1));
+    returnIfFailErr (e, "Cache reallocate error(%d): %m", errno);
+    entries = e;
+
+    e = entries + entriesCount++;
+    strncpy (e->name, name, CACHE_NAME_SIZE);
+    e->name[CACHE_NAME_SIZE] = 0;
+    e->size = size;
+    e->used = used;
+
+    stats.files++;
+    stats.bytes += size;
+}
+
+static void cache_remove (const char *name) {
+    CacheEntry *e = cache_find (name);
+
+    if (!e)
+        return;
+
+    stats.files--;
+    stats.bytes -= e->size;
+    *e = entries[--entriesCount];
+}
+
+static uint64_t cache_now () {
+    struct timespec ts;
+
+    clock_gettime (CLOCK_REALTIME, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void cache_crc_init () {
+    uint32_t c, n, k;
+
+    // Reflected IEEE 802.3 polynomial, same as zlib
+    for (n = 0; n < 256; n++) {
+        c = n;
+        for (k = 0; k < 8; k++)
+            c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        crcTable[n] = c;
+    }
+}
+
+static uint32_t cache_crc (uint32_t crc, const void *buf, size_t len) {
+    const uint8_t *p = (const uint8_t *) buf;
+
+    pthread_once (&crcOnce, cache_crc_init);
+
+    crc = ~crc;
+    while (len--)
+        crc = crcTable[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+
+    return ~crc;
+}
+
+/**
+ * @brief Checks the samples of a written entry against their checksum
+ */
+static int cache_verify (int fd, size_t bytes, uint32_t crc) {
+    void *map;
+    int ok;
+
+    map = mmap (NULL, CACHE_DATA_OFFSET + bytes, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        return FALSE;
+
+    ok = cache_crc (0, (const uint8_t *) map + CACHE_DATA_OFFSET, bytes) == crc;
+    munmap (map, CACHE_DATA_OFFSET + bytes);
+
+    return ok;
+}
+
+static int cache_write (int fd, const void *buf, size_t len) {
+    const uint8_t *p = (const uint8_t *) buf;
+    ssize_t r;
+
+    while (len) {
+        r = write (fd, p, len);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return FALSE;
+        }
+        p += r;
+        len -= r;
+    }
+
+    return TRUE;
+}
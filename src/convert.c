@@ -0,0 +1,126 @@
+/**
+ * @file convert.c
+ * @author Denys Stovbun (denis.stovbun@lanars.com)
+ * @brief Sample format conversion
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * Loaded sounds are converted once into the engine's native sample
+ * format, channel count and rate, so playback never goes through the
+ * ALSA plug and rate converters.
+ *
+ */
+#include "app.h"
+#include "engine.h"
+#include "convert.h"
+#include "sound.h"
+#include "sample.h"
+#include "resample.h"
+
+static int16_t * convert_to_s16 (const SoundData *data);
+static int16_t * convert_channels (const int16_t *src, snd_pcm_uframes_t frames, uint16_t channels);
+
+/**
+ * @brief Converts loaded sound data into the engine format
+ *
+ * @param data sound with data in any format the WAVE parser produces
+ * @return int TRUE on success
+ */
+int convert_sound (SoundData *data) {
+    int16_t *buf, *tmp;
+    snd_pcm_uframes_t frames;
+
+    returnValIfFailErr (data && data->data && data->channels && data->rate, FALSE, "No sound data");
+
+    if (convert_is_native (data))
+        return TRUE;
+
+    frames = data->size;
+
+    // Sample format
+    buf = convert_to_s16 (data);
+    returnValIfFailErr (buf, FALSE, "Convert %s to S16 error: %m", snd_pcm_format_name (data->format));
+
+    // Channel count
+    if (data->channels != ENGINE_CHANNELS) {
+        tmp = convert_channels (buf, frames, data->channels);
+        free (buf);
+        buf = tmp;
+        returnValIfFailErr (buf, FALSE, "Convert %d to %d channels error: %m", data->channels, ENGINE_CHANNELS);
+    }
+
+    // Sample rate
+    if (data->rate != ENGINE_RATE) {
+        size_t outFrames = 0;
+        tmp = resample_buffer (buf, frames, data->rate, ENGINE_RATE, ENGINE_CHANNELS, RESAMPLE_QUALITY, &outFrames);
+        free (buf);
+        buf = tmp;
+        frames = outFrames;
+        returnValIfFailErr (buf, FALSE, "Convert %u to %u Hz (%s) error: %m"
+            , data->rate, ENGINE_RATE, resample_quality_name (RESAMPLE_QUALITY));
+    }
+
+    selfLogDbg ("Converted [%s] %s %uHz %uch %lu frames to %s %uHz %uch %lu frames"
+        , data->filename, snd_pcm_format_name (data->format), data->rate, data->channels, data->size
+        , snd_pcm_format_name (ENGINE_FORMAT), ENGINE_RATE, ENGINE_CHANNELS, frames);
+
+    sound_free_data (data);
+    data->data = (uint8_t *) buf;
+    data->format = ENGINE_FORMAT;
+    data->rate = ENGINE_RATE;
+    data->channels = ENGINE_CHANNELS;
+    data->bits = 16;
+    data->align = ENGINE_CHANNELS * sizeof (int16_t);
+    data->size = frames;
+
+    return TRUE;
+}
+
+/**
+ * @brief Tests whether sound data can be played as is
+ */
+int convert_is_native (const SoundData *data) {
+    return data->format == ENGINE_FORMAT
+        && data->channels == ENGINE_CHANNELS
+        && data->rate == ENGINE_RATE
+        && data->align == ENGINE_CHANNELS * sizeof (int16_t);
+}
+
+static int16_t * convert_to_s16 (const SoundData *data) {
+    snd_pcm_uframes_t samples = data->size * data->channels;
+    int16_t *buf = (int16_t *) malloc (samples * sizeof (int16_t));
+
+    if (!buf)
+        return NULL;
+
+    if (sample_to_s16 (data->format, data->data, buf, samples) < 0) {
+        free (buf);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return buf;
+}
+
+/**
+ * @brief Maps S16 frames of any channel count to the engine channels
+ */
+void convert_remix (const int16_t *src, snd_pcm_uframes_t frames, uint16_t channels, int16_t *dst) {
+    snd_pcm_uframes_t n;
+    uint16_t ch;
+
+    // Mono is duplicated, extra channels are dropped
+    for (n = 0; n < frames; n++, src += channels)
+        for (ch = 0; ch < ENGINE_CHANNELS; ch++)
+            *dst++ = src[ch < channels ? ch : channels - 1];
+}
+
+static int16_t * convert_channels (const int16_t *src, snd_pcm_uframes_t frames, uint16_t channels) {
+    int16_t *buf = (int16_t *) malloc (frames * ENGINE_CHANNELS * sizeof (int16_t));
+
+    if (!buf)
+        return NULL;
+
+    convert_remix (src, frames, channels, buf);
+    return buf;
+}
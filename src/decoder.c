@@ -0,0 +1,541 @@
+/**
+ * @file decoder.c
+ * @author Denys Stovbun (denis.stovbun@lanars.com)
+ * @brief Compressed sound decoders
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * Downloaded sounds may be MP3, Ogg Vorbis or FLAC instead of WAVE.
+ * The format is told by the leading magic bytes, not by the file name.
+ * Each backend decodes the whole file from memory into interleaved
+ * native S16 on the heap, which then goes through the usual conversion
+ * path. Backends are built only when their library is found.
+ *
+ */
+#include <stdio.h>
+#include <pthread.h>
+
+#include "app.h"
+#include "formats.h"
+#include "decoder.h"
+
+#ifdef HAVE_MPG123
+#include <mpg123.h>
+#endif
+#ifdef HAVE_VORBISFILE
+#include <vorbis/vorbisfile.h>
+#endif
+#ifdef HAVE_FLAC
+#include <FLAC/stream_decoder.h>
+#endif
+
+// Decoded frames the output buffer grows by
+#define DECODER_GROW_FRAMES     65536
+#define DECODER_ID3_SIZE        10
+
+typedef struct DecoderStruct {
+    const char     *name;
+    int           (*probe) (const uint8_t *file, size_t size);
+    int           (*decode) (const uint8_t *file, size_t size, SoundData *data);
+} Decoder;
+
+// Growing decoder output
+typedef struct DecoderOutStruct {
+    int16_t            *buf;
+    size_t              frames;
+    size_t              cap;
+    uint16_t            channels;
+    int                 tooLong;
+} DecoderOut;
+
+// Memory source for callback based libraries
+typedef struct DecoderSourceStruct {
+    const uint8_t      *file;
+    size_t              size;
+    size_t              pos;
+} DecoderSource;
+
+static int decoder_probe_wave (const uint8_t *file, size_t size);
+static int decoder_probe_mp3 (const uint8_t *file, size_t size);
+static int decoder_probe_vorbis (const uint8_t *file, size_t size);
+static int decoder_probe_flac (const uint8_t *file, size_t size);
+static size_t decoder_id3_size (const uint8_t *file, size_t size);
+static int16_t * decoder_reserve (DecoderOut *out, size_t frames);
+static int decoder_finish (DecoderOut *out, uint32_t rate, SoundData *data);
+
+#ifdef HAVE_MPG123
+static int decoder_decode_mp3 (const uint8_t *file, size_t size, SoundData *data);
+#endif
+#ifdef HAVE_VORBISFILE
+static int decoder_decode_vorbis (const uint8_t *file, size_t size, SoundData *data);
+#endif
+#ifdef HAVE_FLAC
+static int decoder_decode_flac (const uint8_t *file, size_t size, SoundData *data);
+#endif
+
+static const Decoder decoders[DecoderMAX] = {
+    [DecoderUnknown]    = { "unknown",  NULL,                   NULL },
+    // WAVE is parsed in place by the sound loader
+    [DecoderWave]       = { "wave",     decoder_probe_wave,     NULL },
+#ifdef HAVE_MPG123
+    [DecoderMp3]        = { "mp3",      decoder_probe_mp3,      decoder_decode_mp3 },
+#else
+    [DecoderMp3]        = { "mp3",      decoder_probe_mp3,      NULL },
+#endif
+#ifdef HAVE_VORBISFILE
+    [DecoderVorbis]     = { "vorbis",   decoder_probe_vorbis,   decoder_decode_vorbis },
+#else
+    [DecoderVorbis]     = { "vorbis",   decoder_probe_vorbis,   NULL },
+#endif
+#ifdef HAVE_FLAC
+    [DecoderFlac]       = { "flac",     decoder_probe_flac,     decoder_decode_flac },
+#else
+    [DecoderFlac]       = { "flac",     decoder_probe_flac,     NULL },
+#endif
+};
+
+/**
+ * @brief Detects the container by its magic bytes
+ *
+ * @param file file contents
+ * @param size contents size
+ * @return DecoderType detected type or DecoderUnknown
+ */
+DecoderType decoder_probe (const uint8_t *file, size_t size) {
+    int i;
+
+    for (i = DecoderUnknown + 1; i < DecoderMAX; i++)
+        if (decoders[i].probe (file, size))
+            return (DecoderType) i;
+
+    return DecoderUnknown;
+}
+
+/**
+ * @brief Decodes a whole compressed file into a heap buffer
+ *
+ * On success data->data holds interleaved native S16 frames and the
+ * format fields describe them, the file is not referenced anymore.
+ *
+ * @param type type returned by decoder_probe
+ * @param file file contents
+ * @param size contents size
+ * @param data sound to fill
+ * @return int TRUE on success
+ */
+int decoder_decode (DecoderType type, const uint8_t *file, size_t size, SoundData *data) {
+    returnValIfFailErr (type > DecoderUnknown && type < DecoderMAX, FALSE, "Unknown format of [%s]", data->filename);
+    returnValIfFailErr (decoders[type].decode, FALSE, "No %s decoder built in for [%s]", decoders[type].name, data->filename);
+
+    return decoders[type].decode (file, size, data);
+}
+
+const char * decoder_name (DecoderType type) {
+    return type < DecoderMAX ? decoders[type].name : "unknown";
+}
+
+/***********************
+ *  PROBES
+ ***********************/
+static int decoder_probe_wave (const uint8_t *file, size_t size) {
+    return size >= sizeof (WaveHeader)
+        && (!memcmp (file, "RIFF", 4) || !memcmp (file, "RIFX", 4))
+        && !memcmp (file + 8, "WAVE", 4);
+}
+
+static int decoder_probe_mp3 (const uint8_t *file, size_t size) {
+    size_t off = decoder_id3_size (file, size);
+
+    if (off + 4 > size)
+        return FALSE;
+    file += off;
+
+    // Frame sync, valid layer, bitrate and sample rate indexes
+    return file[0] == 0xFF
+        && (file[1] & 0xE0) == 0xE0
+        && (file[1] & 0x06) != 0x00
+        && (file[2] & 0xF0) != 0xF0
+        && (file[2] & 0x0C) != 0x0C;
+}
+
+static int decoder_probe_vorbis (const uint8_t *file, size_t size) {
+    // First Ogg page carries the Vorbis identification header
+    return size >= 35
+        && !memcmp (file, "OggS", 4)
+        && !memcmp (file + 28, "\x01vorbis", 7);
+}
+
+static int decoder_probe_flac (const uint8_t *file, size_t size) {
+    size_t off = decoder_id3_size (file, size);
+
+    return off + 4 <= size && !memcmp (file + off, "fLaC", 4);
+}
+
+/**
+ * @brief Length of a leading ID3v2 tag
+ */
+static size_t decoder_id3_size (const uint8_t *file, size_t size) {
+    if (size < DECODER_ID3_SIZE || memcmp (file, "ID3", 3))
+        return 0;
+
+    // Syncsafe size, plus the footer if present
+    return DECODER_ID3_SIZE
+        + ((size_t) (file[6] & 0x7F) << 21 | (size_t) (file[7] & 0x7F) << 14 | (size_t) (file[8] & 0x7F) << 7 | (file[9] & 0x7F))
+        + (file[5] & 0x10 ? DECODER_ID3_SIZE : 0);
+}
+
+/***********************
+ *  OUTPUT
+ ***********************/
+static int16_t * decoder_reserve (DecoderOut *out, size_t frames) {
+    size_t cap, limit;
+    int16_t *buf;
+
+    // Decoded sounds stay in RAM and can't be streamed, so they are held to the stream threshold
+    limit = STREAM_THRESHOLD / (out->channels * sizeof (int16_t));
+    if (out->frames + frames > limit) {
+        if (out->frames >= limit) {
+            out->tooLong = TRUE;
+            return NULL;
+        }
+        frames = limit - out->frames;
+    }
+
+    if (out->frames + frames > out->cap) {
+        cap = out->cap + (frames > DECODER_GROW_FRAMES ? frames : DECODER_GROW_FRAMES);
+        buf = (int16_t *) realloc (out->buf, cap * out->channels * sizeof (int16_t));
+        if (!buf)
+            return NULL;
+        out->buf = buf;
+        out->cap = cap;
+    }
+
+    return out->buf + out->frames * out->channels;
+}
+
+static int decoder_finish (DecoderOut *out, uint32_t rate, SoundData *data) {
+    if (out->tooLong) {
+        free (out->buf);
+        selfLogErr ("Decoded [%s] is over %u bytes", data->filename, STREAM_THRESHOLD);
+        return FALSE;
+    }
+
+    if (!out->frames || !out->channels || !rate) {
+        free (out->buf);
+        selfLogErr ("Nothing decoded from [%s]", data->filename);
+        return FALSE;
+    }
+
+    data->data = (uint8_t *) out->buf;
+    data->format = SND_PCM_FORMAT_S16;
+    data->rate = rate;
+    data->channels = out->channels;
+    data->bits = 16;
+    data->align = out->channels * sizeof (int16_t);
+    data->size = out->frames;
+
+    selfLogInf ("Decoded [%s] %uHz %uch %lu frames", data->filename, rate, out->channels, data->size);
+    return TRUE;
+}
+
+#ifdef HAVE_MPG123
+/***********************
+ *  MP3 (libmpg123)
+ ***********************/
+static pthread_once_t mpg123Once = PTHREAD_ONCE_INIT;
+
+static void decoder_mpg123_init () {
+    mpg123_init ();
+}
+
+static int decoder_decode_mp3 (const uint8_t *file, size_t size, SoundData *data) {
+    DecoderOut out = { 0 };
+    mpg123_handle *mh;
+    const long *rates;
+    size_t nRates, i, done;
+    long rate = 0;
+    int err, channels = 0, encoding = 0;
+    int16_t *dst;
+
+    pthread_once (&mpg123Once, decoder_mpg123_init);
+
+    mh = mpg123_new (NULL, &err);
+    returnValIfFailErr (mh, FALSE, "Create mp3 decoder error: %s", mpg123_plain_strerror (err));
+
+    // Ask for S16 whatever the stream is
+    mpg123_format_none (mh);
+    mpg123_rates (&rates, &nRates);
+    for (i = 0; i < nRates; i++)
+        mpg123_format (mh, rates[i], MPG123_MONO | MPG123_STEREO, MPG123_ENC_SIGNED_16);
+
+    err = mpg123_open_feed (mh);
+    if (err == MPG123_OK)
+        err = mpg123_feed (mh, file, size);
+
+    while (err == MPG123_OK || err == MPG123_NEW_FORMAT) {
+        if (err == MPG123_NEW_FORMAT) {
+            mpg123_getformat (mh, &rate, &channels, &encoding);
+            if (out.channels && out.channels != channels) {
+                selfLogErr ("Channels count changes in [%s]", data->filename);
+                break;
+            }
+            out.channels = channels;
+        }
+
+        if (!out.channels) {
+            err = mpg123_read (mh, NULL, 0, &done);
+            continue;
+        }
+
+        dst = decoder_reserve (&out, DECODER_GROW_FRAMES);
+        if (!dst) {
+            if (!out.tooLong)
+                selfLogErr ("Allocate decoded data error: %m");
+            break;
+        }
+
+        err = mpg123_read (mh, dst, (out.cap - out.frames) * out.channels * sizeof (int16_t), &done);
+        out.frames += done / (out.channels * sizeof (int16_t));
+    }
+
+    // Whole file was fed, so running out of input is the end of the stream
+    if (err != MPG123_NEED_MORE && err != MPG123_DONE)
+        selfLogWrn ("Decode mp3 [%s] stopped: %s", data->filename, mpg123_plain_strerror (err));
+
+    mpg123_delete (mh);
+    return decoder_finish (&out, (uint32_t) rate, data);
+}
+#endif
+
+#if defined(HAVE_VORBISFILE) || defined(HAVE_FLAC)
+/***********************
+ *  MEMORY SOURCE
+ ***********************/
+static size_t decoder_source_read (DecoderSource *src, void *dst, size_t bytes) {
+    if (bytes > src->size - src->pos)
+        bytes = src->size - src->pos;
+    memcpy (dst, src->file + src->pos, bytes);
+    src->pos += bytes;
+    return bytes;
+}
+
+static int decoder_source_seek (DecoderSource *src, int64_t offset, int whence) {
+    int64_t pos;
+
+    switch (whence) {
+        case SEEK_SET: pos = offset; break;
+        case SEEK_CUR: pos = (int64_t) src->pos + offset; break;
+        case SEEK_END: pos = (int64_t) src->size + offset; break;
+        default: return -1;
+    }
+    if (pos < 0 || pos > (int64_t) src->size)
+        return -1;
+
+    src->pos = (size_t) pos;
+    return 0;
+}
+#endif
+
+#ifdef HAVE_VORBISFILE
+/***********************
+ *  OGG VORBIS (libvorbisfile)
+ ***********************/
+static size_t decoder_vorbis_read (void *ptr, size_t size, size_t nmemb, void *src) {
+    return size ? decoder_source_read ((DecoderSource *) src, ptr, size * nmemb) / size : 0;
+}
+
+static int decoder_vorbis_seek (void *src, ogg_int64_t offset, int whence) {
+    return decoder_source_seek ((DecoderSource *) src, offset, whence);
+}
+
+static long decoder_vorbis_tell (void *src) {
+    return (long) ((DecoderSource *) src)->pos;
+}
+
+static int decoder_decode_vorbis (const uint8_t *file, size_t size, SoundData *data) {
+    DecoderSource src = { file, size, 0 };
+    ov_callbacks cb = { decoder_vorbis_read, decoder_vorbis_seek, NULL, decoder_vorbis_tell };
+    DecoderOut out = { 0 };
+    OggVorbis_File vf;
+    vorbis_info *vi;
+    ogg_int64_t total;
+    int16_t *dst;
+    uint32_t rate;
+    int err, section;
+    long r;
+
+    err = ov_open_callbacks (&src, &vf, NULL, 0, cb);
+    returnValIfFailErr (err == 0, FALSE, "Open vorbis [%s] error(%d)", data->filename, err);
+
+    vi = ov_info (&vf, -1);
+    if (!vi) {
+        ov_clear (&vf);
+        selfLogErr ("No vorbis info in [%s]", data->filename);
+        return FALSE;
+    }
+    rate = (uint32_t) vi->rate;
+    out.channels = (uint16_t) vi->channels;
+
+    // Exact length is known for seekable streams
+    total = ov_pcm_total (&vf, -1);
+    if (total > 0 && !decoder_reserve (&out, (size_t) total) && !out.tooLong) {
+        ov_clear (&vf);
+        selfLogErr ("Allocate decoded data error: %m");
+        return FALSE;
+    }
+
+    for (;;) {
+        dst = decoder_reserve (&out, DECODER_GROW_FRAMES / 16);
+        if (!dst) {
+            if (!out.tooLong)
+                selfLogErr ("Allocate decoded data error: %m");
+            break;
+        }
+
+        // Host endian, 16 bit, signed
+        r = ov_read (&vf, (char *) dst, (out.cap - out.frames) * out.channels * sizeof (int16_t)
+            , __BYTE_ORDER == __BIG_ENDIAN, 2, 1, &section);
+        if (r == OV_HOLE)
+            continue;
+        if (r <= 0) {
+            if (r < 0)
+                selfLogWrn ("Decode vorbis [%s] stopped(%ld)", data->filename, r);
+            break;
+        }
+
+        vi = ov_info (&vf, section);
+        if (vi && (vi->channels != out.channels || (uint32_t) vi->rate != rate)) {
+            selfLogErr ("Format changes in chained [%s]", data->filename);
+            break;
+        }
+        out.frames += r / (out.channels * sizeof (int16_t));
+    }
+
+    ov_clear (&vf);
+    return decoder_finish (&out, rate, data);
+}
+#endif
+
+#ifdef HAVE_FLAC
+/***********************
+ *  FLAC (libFLAC)
+ ***********************/
+typedef struct FlacContextStruct {
+    DecoderSource       src;
+    DecoderOut          out;
+    uint32_t            rate;
+    uint32_t            bits;
+    int                 failed;
+} FlacContext;
+
+static FLAC__StreamDecoderReadStatus decoder_flac_read (const FLAC__StreamDecoder *dec, FLAC__byte buffer[], size_t *bytes, void *ptr) {
+    FlacContext *f = (FlacContext *) ptr;
+    UNUSED_ARG (dec);
+
+    *bytes = decoder_source_read (&f->src, buffer, *bytes);
+    return *bytes ? FLAC__STREAM_DECODER_READ_STATUS_CONTINUE : FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
+}
+
+static FLAC__StreamDecoderSeekStatus decoder_flac_seek (const FLAC__StreamDecoder *dec, FLAC__uint64 offset, void *ptr) {
+    UNUSED_ARG (dec);
+    return decoder_source_seek (&((FlacContext *) ptr)->src, (int64_t) offset, SEEK_SET)
+        ? FLAC__STREAM_DECODER_SEEK_STATUS_ERROR : FLAC__STREAM_DECODER_SEEK_STATUS_OK;
+}
+
+static FLAC__StreamDecoderTellStatus decoder_flac_tell (const FLAC__StreamDecoder *dec, FLAC__uint64 *offset, void *ptr) {
+    UNUSED_ARG (dec);
+    *offset = ((FlacContext *) ptr)->src.pos;
+    return FLAC__STREAM_DECODER_TELL_STATUS_OK;
+}
+
+static FLAC__StreamDecoderLengthStatus decoder_flac_length (const FLAC__StreamDecoder *dec, FLAC__uint64 *length, void *ptr) {
+    UNUSED_ARG (dec);
+    *length = ((FlacContext *) ptr)->src.size;
+    return FLAC__STREAM_DECODER_LENGTH_STATUS_OK;
+}
+
+static FLAC__bool decoder_flac_eof (const FLAC__StreamDecoder *dec, void *ptr) {
+    FlacContext *f = (FlacContext *) ptr;
+    UNUSED_ARG (dec);
+    return f->src.pos >= f->src.size;
+}
+
+static FLAC__StreamDecoderWriteStatus decoder_flac_write (const FLAC__StreamDecoder *dec, const FLAC__Frame *frame
+    , const FLAC__int32 * const buffer[], void *ptr) {
+    FlacContext *f = (FlacContext *) ptr;
+    uint32_t n, ch, bits = frame->header.bits_per_sample;
+    int16_t *dst;
+    UNUSED_ARG (dec);
+
+    if (!f->out.channels) {
+        f->out.channels = (uint16_t) frame->header.channels;
+        f->rate = frame->header.sample_rate;
+    }
+    if (frame->header.channels != f->out.channels || !bits || bits > 32) {
+        f->failed = TRUE;
+        return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+    }
+
+    dst = decoder_reserve (&f->out, frame->header.blocksize);
+    if (dst && f->out.cap - f->out.frames < frame->header.blocksize)
+        f->out.tooLong = TRUE;
+    if (!dst || f->out.tooLong) {
+        f->failed = TRUE;
+        return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+    }
+
+    // Samples are right-justified at the stream bit depth
+    for (n = 0; n < frame->header.blocksize; n++)
+        for (ch = 0; ch < f->out.channels; ch++)
+            *dst++ = (int16_t) (bits >= 16 ? buffer[ch][n] >> (bits - 16) : buffer[ch][n] << (16 - bits));
+
+    f->out.frames += frame->header.blocksize;
+    return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+}
+
+static void decoder_flac_metadata (const FLAC__StreamDecoder *dec, const FLAC__StreamMetadata *meta, void *ptr) {
+    FlacContext *f = (FlacContext *) ptr;
+    UNUSED_ARG (dec);
+
+    if (meta->type != FLAC__METADATA_TYPE_STREAMINFO)
+        return;
+
+    f->rate = meta->data.stream_info.sample_rate;
+    f->out.channels = (uint16_t) meta->data.stream_info.channels;
+    if (meta->data.stream_info.total_samples)
+        decoder_reserve (&f->out, (size_t) meta->data.stream_info.total_samples);
+}
+
+static void decoder_flac_error (const FLAC__StreamDecoder *dec, FLAC__StreamDecoderErrorStatus status, void *ptr) {
+    UNUSED_ARG (dec);
+    UNUSED_ARG (ptr);
+    selfLogWrn ("FLAC decode error: %s", FLAC__StreamDecoderErrorStatusString[status]);
+}
+
+static int decoder_decode_flac (const uint8_t *file, size_t size, SoundData *data) {
+    FlacContext f = { .src = { file, size, 0 } };
+    FLAC__StreamDecoder *dec;
+    FLAC__StreamDecoderInitStatus st;
+    FLAC__bool ok;
+
+    dec = FLAC__stream_decoder_new ();
+    returnValIfFailErr (dec, FALSE, "Create FLAC decoder error");
+
+    st = FLAC__stream_decoder_init_stream (dec, decoder_flac_read, decoder_flac_seek, decoder_flac_tell
+        , decoder_flac_length, decoder_flac_eof, decoder_flac_write, decoder_flac_metadata, decoder_flac_error, &f);
+    if (st != FLAC__STREAM_DECODER_INIT_STATUS_OK) {
+        selfLogErr ("Init FLAC [%s] error: %s", data->filename, FLAC__StreamDecoderInitStatusString[st]);
+        FLAC__stream_decoder_delete (dec);
+        return FALSE;
+    }
+
+    ok = FLAC__stream_decoder_process_until_end_of_stream (dec);
+    if (!ok || f.failed)
+        selfLogWrn ("Decode FLAC [%s] stopped: %s", data->filename
+            , FLAC__StreamDecoderStateString[FLAC__stream_decoder_get_state (dec)]);
+
+    FLAC__stream_decoder_finish (dec);
+    FLAC__stream_decoder_delete (dec);
+    return decoder_finish (&f.out, f.rate, data);
+}
+#endif
@@ -1,31 +1,199 @@
 #include <curl/curl.h>
 #include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <limits.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/random.h>
+#include <sys/eventfd.h>
 
 #include "app.h"
 #include "sound.h"
 #include "download.h"
 
-static pthread_mutex_t  mutexLoader;
+// Idle worker sleeps until curl_multi_wakeup (), a curl timeout or the next retry bound it
+#define DOWNLOAD_IDLE_MS        INT_MAX
+// Attempts per sound, the delay between them doubles up to the maximum
+#define DOWNLOAD_RETRIES        6
+#define DOWNLOAD_RETRY_MS       1000
+#define DOWNLOAD_RETRY_MAX_MS   60000
+// A transfer slower than 1 byte/s for this long (s) is dropped and retried
+#define DOWNLOAD_STALL_TIME     30L
+#define DOWNLOAD_CONNECT_TIME   15L
+// Url fragment carrying the expected digest, never sent to the server
+#define DOWNLOAD_MD5_FRAGMENT   "#md5="
+// A new sound is handed over for play once this much arrived
+#define DOWNLOAD_PROGRESS_BYTES 65536
+// Bigger files are not kept in memory for progressive play
+#define DOWNLOAD_PROGRESS_MAX   (16 * 1024 * 1024)
+
+static pthread_mutex_t  mutexLoader = PTHREAD_MUTEX_INITIALIZER;
 static int              loaderCount = 0;
+static DownloadData    *pending     = NULL; // Queued requests, newest first
+static DownloadData    *finished    = NULL; // Done downloads waiting for the main thread
+static DownloadStart   *started     = NULL; // Playable new sounds waiting for the main thread
+static int              stopping    = FALSE;
+static int              eventFd     = -1;   // Signalled when a download is done
+static pthread_t        worker      = 0UL;
+static CURLM           *multi       = NULL;
+static CURLSH          *share       = NULL;
+static uint64_t         seqCounter  = 0;
+static uint64_t         latest[SoundMAX] = { 0 }; // Newest request of each sound type, main thread only
+static DownloadData    *transfers   = NULL; // Running transfers, worker thread only
+static DownloadData    *retries     = NULL; // Failed transfers waiting for the next attempt, worker thread only
+static unsigned int     jitterSeed  = 0;    // Retry jitter, differs between devices, worker thread only
 
 
-static DownloadData * download_new (SoundData *data);
-static int download_start (DownloadData *load);
+static DownloadData * download_new (SoundData *data, const IndexSound *base);
 static void * download_process (void *ptr);
+static int download_begin (DownloadData *load);
+static void download_end (DownloadData *load, CURLcode res);
+static const char * download_verify (DownloadData *load, curl_off_t length);
+static int download_retryable (CURLcode res, long code);
+static void download_retry (DownloadData *load);
+static void download_done (DownloadData *load, DownloadState state);
+static void download_drop_retries (SoundType type);
+static void download_progress (DownloadData *load, const void *ptr, size_t len);
+static void download_progress_end (DownloadData *load, int complete);
+static int download_etag_md5 (const char *etag, char *md5);
+static uint64_t download_now ();
+static void download_free (DownloadData *load);
+static void download_decrement ();
+
+/**
+ * @brief Starts the download worker
+ *
+ * All transfers run on one thread through a single curl multi handle, at
+ * most DOWNLOAD_CONCURRENCY at a time. DNS answers and TLS sessions are
+ * shared between transfers, connections are reused by the multi handle.
+ *
+ * @return int descriptor readable when downloads are done, or negative error code
+ */
+int download_init () {
+    int r;
+
+    eventFd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+    returnValIfFailErr (eventFd >= 0, -errno, "Create download event error: %m");
+
+    // Devices on one firmware must not retry in lockstep after a server outage
+    if (getrandom (&jitterSeed, sizeof (jitterSeed), GRND_NONBLOCK) != sizeof (jitterSeed))
+        jitterSeed = (unsigned int) time (NULL) ^ ((unsigned int) getpid () << 16);
+
+    returnValIfFailErr (curl_global_init (CURL_GLOBAL_DEFAULT) == CURLE_OK, -ENOMEM, "Init curl error");
+
+    // Only the worker thread uses the handles, the share needs no locks
+    share = curl_share_init ();
+    returnValIfFailErr (share, -ENOMEM, "Create curl share error");
+    curl_share_setopt (share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt (share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
+    multi = curl_multi_init ();
+    returnValIfFailErr (multi, -ENOMEM, "Create curl multi error");
+    curl_multi_setopt (multi, CURLMOPT_MAXCONNECTS, (long) DOWNLOAD_CONCURRENCY);
+
+    r = pthread_create (&worker, NULL, download_process, NULL);
+    if (r) {
+        worker = 0UL;
+        selfLogErr ("Start download thread error(%d): %s", r, strerror (r));
+        return -r;
+    }
+
+    return eventFd;
+}
+
+void download_deinit () {
+    DownloadData *load;
+    DownloadStart *start;
+
+    if (worker) {
+        pthread_mutex_lock (&mutexLoader);
+        stopping = TRUE;
+        pthread_mutex_unlock (&mutexLoader);
+        curl_multi_wakeup (multi);
+        pthread_join (worker, NULL);
+        worker = 0UL;
+    }
+
+    while ((load = pending)) {
+        pending = load->next;
+        download_free (load);
+    }
+    while ((load = finished)) {
+        finished = load->next;
+        download_free (load);
+    }
+    while ((start = started)) {
+        started = start->next;
+        growbuf_unref (start->grow);
+        free (start);
+    }
+
+    if (multi)
+        curl_multi_cleanup (multi);
+    if (share)
+        curl_share_cleanup (share);
+    multi = NULL;
+    share = NULL;
+    curl_global_cleanup ();
 
-int download_sound (SoundData *data) {
-    DownloadData *load = download_new (data);
+    if (eventFd >= 0)
+        close (eventFd);
+    eventFd = -1;
+}
+
+/**
+ * @brief Queues a sound download, main thread only
+ *
+ * The request goes to the head of the queue. A queued request for the
+ * same sound type is obsolete and dropped.
+ *
+ * With a base the request is conditional: the server answers 304 and
+ * sends nothing when the content is the one downloaded for the base.
+ *
+ * @param data sound with url and filename set
+ * @param base downloaded sound with the same url, or NULL
+ * @return int TRUE if queued
+ */
+int download_sound (SoundData *data, const IndexSound *base) {
+    DownloadData *load, *old, **p;
+
+    returnValIfFailErr (worker, FALSE, "Download worker is not running");
+
+    load = download_new (data, base);
     if (!load)
         return FALSE;
+    // Revalidated sound plays on meanwhile, only a new one is played while it arrives
+    load->progressive = !base;
 
-    if (!download_start (load))
-        return FALSE;
+    pthread_mutex_lock (&mutexLoader);
+    for (p = &pending; *p; ) {
+        if ((*p)->type == load->type) {
+            old = *p;
+            *p = old->next;
+            selfLogDbg ("Drop queued download %lu for %lu", old->id, load->id);
+            download_free (old);
+            loaderCount--;
+        } else {
+            p = &(*p)->next;
+        }
+    }
+
+    load->seq = ++seqCounter;
+    load->next = pending;
+    pending = load;
+    loaderCount++;
+    pthread_mutex_unlock (&mutexLoader);
 
+    latest[load->type] = load->seq;
+    curl_multi_wakeup (multi);
+
+    selfLogTrc ("Queued download %lu [%s]", load->id, load->url);
     return TRUE;
 }
 
 int download_count () {
-    static int cnt;
+    int cnt;
 
     pthread_mutex_lock (&mutexLoader);
     cnt = loaderCount;
@@ -34,6 +202,86 @@ int download_count () {
     return cnt;
 }
 
+/**
+ * @brief Loads finished downloads, main thread only
+ *
+ * The download worker never touches sounds itself, the engine is driven
+ * from the main thread alone.
+ */
+void download_dispatch () {
+    DownloadData *load, *next;
+    DownloadStart *start, *nextStart;
+    const IndexSound *base;
+    IndexSound entry;
+    SoundShort snd;
+    eventfd_t cnt;
+
+    eventfd_read (eventFd, &cnt);
+
+    pthread_mutex_lock (&mutexLoader);
+    start = started;
+    started = NULL;
+    load = finished;
+    finished = NULL;
+    pthread_mutex_unlock (&mutexLoader);
+
+    for (; start; start = nextStart) {
+        nextStart = start->next;
+        if (start->seq == latest[start->type]) {
+            memset (&snd, 0, sizeof (SoundShort));
+            snd.id = start->id;
+            snd.type = start->type;
+            strcpy (snd.url, start->url);
+            sound_progress (&snd, start->grow);
+        }
+        growbuf_unref (start->grow);
+        free (start);
+    }
+
+    for (; load; load = next) {
+        next = load->next;
+
+        // Failed downloads left nothing behind
+        if (load->state == DL_Failed) {
+            selfLogWrn ("Download %lu [%s] failed", load->id, load->url);
+        } else if (load->seq != latest[load->type]) {
+            // Another sound was picked for this type meanwhile
+            selfLogDbg ("Drop superseded download %lu", load->id);
+            if (load->state == DL_Finished)
+                unlink (load->filename);
+        } else {
+            base = load->baseId ? index_find (load->baseId) : NULL;
+            if (load->state == DL_Finished && base && base->md5 && !strcasecmp (base->md5, load->md5)) {
+                // Server ignored the validators but sent the same bytes
+                selfLogInf ("Download %lu is unchanged", load->id);
+                unlink (load->filename);
+                load->state = DL_NotModified;
+            } else if (load->state == DL_Finished) {
+                memset (&entry, 0, sizeof (IndexSound));
+                entry.id = load->id;
+                entry.url = load->url;
+                entry.etag = load->etag;
+                entry.last_modified = load->lastModified;
+                entry.size = load->size;
+                entry.md5 = load->md5;
+                index_set (&entry);
+            }
+
+            memset (&snd, 0, sizeof (SoundShort));
+            snd.id = load->id;
+            snd.type = load->type;
+            strcpy (snd.url, load->url);
+            if (load->state == DL_NotModified)
+                sound_not_modified (&snd);
+            else
+                sound_downloaded (&snd);
+        }
+
+        download_free (load);
+        download_decrement ();
+    }
+}
+
 static void download_decrement () {
     pthread_mutex_lock (&mutexLoader);
     if (loaderCount)
@@ -41,46 +289,86 @@ static void download_decrement () {
     pthread_mutex_unlock (&mutexLoader);
 }
 
-static DownloadData * download_new (SoundData *data) {
-    DownloadData *load = (DownloadData *) calloc (1, sizeof (DownloadData));
-    if (!load) {
-        selfLogErr ("Not enough memory: %m");
-        return NULL;
-    }
+static DownloadData * download_new (SoundData *data, const IndexSound *base) {
+    DownloadData *load;
+    const char *frag;
+
     if (!strlen (data->url)) {
         selfLogWrn ("Empty URL!");
         return NULL;
     }
+    load = (DownloadData *) calloc (1, sizeof (DownloadData));
+    if (!load) {
+        selfLogErr ("Not enough memory: %m");
+        return NULL;
+    }
     load->id = data->id;
     load->type = data->type;
     strcpy (load->url, data->url);
     strcpy (load->filename, data->filename);
+    snprintf (load->part, sizeof (load->part), "%s" DOWNLOAD_PART_EXT, load->filename);
     load->state = DL_Init;
 
+    // Validators of the content we have, sent as If-None-Match/If-Modified-Since
+    if (base) {
+        load->baseId = base->id;
+        if (base->etag)
+            strncpy (load->etag, base->etag, DOWNLOAD_VALIDATOR_SIZE);
+        if (base->last_modified)
+            strncpy (load->lastModified, base->last_modified, DOWNLOAD_VALIDATOR_SIZE);
+    }
+
+    // Optional digest of the file: <url>#md5=<hex>
+    frag = strstr (load->url, DOWNLOAD_MD5_FRAGMENT);
+    if (frag && strlen (frag + strlen (DOWNLOAD_MD5_FRAGMENT)) == 2 * MD5_SIZE)
+        strcpy (load->md5, frag + strlen (DOWNLOAD_MD5_FRAGMENT));
+
     return load;
 }
 
-static int download_start (DownloadData *load) {
-    pthread_t tid;
-    int r;
-
-    r = pthread_create (&tid, NULL, download_process, load);
-    if (r) {
-        selfLogErr ("Start thread error(%d): %s", r, strerror (r));
-        return FALSE;
+static void download_free (DownloadData *load) {
+    if (load->curl) {
+        curl_multi_remove_handle (multi, load->curl);
+        curl_easy_cleanup (load->curl);
     }
-
-    pthread_mutex_lock (&mutexLoader);
-    loaderCount++;
-    pthread_mutex_unlock (&mutexLoader);
-
-    selfLogTrc ("Started load thread: %ld", tid);
-    return TRUE;
+    if (load->cd.fd)
+        fclose (load->cd.fd);
+    curl_slist_free_all (load->headers);
+    download_progress_end (load, FALSE);
+    free (load);
 }
 
 static size_t download_write_chunk (uint8_t *ptr, size_t size, size_t nmemb, void *data) {
-    ChunkData *cd = (ChunkData *) (data);
-    size_t ret = fwrite (ptr, size, nmemb, cd->fd);
+    DownloadData *load = (DownloadData *) (data);
+    ChunkData *cd = &load->cd;
+    curl_off_t length = -1;
+    long code = 0;
+    size_t ret;
+
+    // The server sends the whole file when it ignored the range or the file changed
+    if (!load->checked) {
+        load->checked = TRUE;
+        curl_easy_getinfo (load->curl, CURLINFO_RESPONSE_CODE, &code);
+        if (load->offset && code != 206) {
+            selfLogWrn ("Download %lu can't resume (HTTP %ld), start over", load->id, code);
+            fflush (cd->fd);
+            if (ftruncate (fileno (cd->fd), 0) || fseek (cd->fd, 0, SEEK_SET))
+                return 0;
+            load->offset = 0;
+        }
+
+        // A new sound is kept in memory as well, to be played before it is complete
+        if (load->progressive && !load->grow && !load->offset && code == 200) {
+            curl_easy_getinfo (load->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+            if (length > 0 && length <= DOWNLOAD_PROGRESS_MAX)
+                load->grow = growbuf_new (length);
+        }
+    }
+
+    if (load->grow)
+        download_progress (load, ptr, size * nmemb);
+
+    ret = fwrite (ptr, size, nmemb, cd->fd);
     if(!ret) {
         selfLogErr ("Write chunk error(%d): %m", errno);
     } else {
@@ -90,50 +378,441 @@ static size_t download_write_chunk (uint8_t *ptr, size_t size, size_t nmemb, voi
     return ret;
 }
 
+static size_t download_header (char *buf, size_t size, size_t nitems, void *data) {
+    DownloadData *load = (DownloadData *) (data);
+    size_t len = size * nitems, n;
+    char *dst = NULL;
+    const char *val;
+
+    if (len > 5 && !strncasecmp (buf, "ETag:", 5)) {
+        dst = load->etag;
+        val = buf + 5;
+    } else if (len > 14 && !strncasecmp (buf, "Last-Modified:", 14)) {
+        dst = load->lastModified;
+        val = buf + 14;
+    }
+
+    if (dst) {
+        while (val < buf + len && (*val == ' ' || *val == '\t'))
+            val++;
+        n = buf + len - val;
+        while (n && (val[n - 1] == '\r' || val[n - 1] == '\n' || val[n - 1] == ' '))
+            n--;
+        if (n > DOWNLOAD_VALIDATOR_SIZE)
+            n = 0;
+        memcpy (dst, val, n);
+        dst[n] = 0;
+    }
+
+    return len;
+}
+
 static void * download_process (void *ptr) {
+    DownloadData *load, *start, **p;
+    CURLMsg *msg;
+    uint64_t now;
+    long timeout;
+    int running, left, active = 0;
+    UNUSED_ARG (ptr);
+
+    for (;;) {
+        // Take the newest requests while there is a free slot
+        start = NULL;
+        pthread_mutex_lock (&mutexLoader);
+        if (stopping) {
+            pthread_mutex_unlock (&mutexLoader);
+            break;
+        }
+        while (pending && active < DOWNLOAD_CONCURRENCY) {
+            load = pending;
+            pending = load->next;
+            load->next = start;
+            start = load;
+            active++;
+        }
+        pthread_mutex_unlock (&mutexLoader);
+
+        // A new request makes a failed one for the same sound type obsolete
+        for (load = start; load; load = load->next)
+            download_drop_retries (load->type);
+
+        // Retries that are due, behind the new requests
+        now = download_now ();
+        timeout = DOWNLOAD_IDLE_MS;
+        for (p = &retries; *p; ) {
+            load = *p;
+            if (load->retryAt <= now && active < DOWNLOAD_CONCURRENCY) {
+                *p = load->next;
+                load->next = start;
+                start = load;
+                active++;
+                continue;
+            }
+            if (load->retryAt > now && (long) (load->retryAt - now) < timeout)
+                timeout = (long) (load->retryAt - now);
+            p = &load->next;
+        }
+
+        for (load = start; load; load = start) {
+            start = load->next;
+            if (download_begin (load)) {
+                load->next = transfers;
+                transfers = load;
+            } else {
+                download_end (load, CURLE_FAILED_INIT);
+                active--;
+            }
+        }
+
+        curl_multi_perform (multi, &running);
+
+        while ((msg = curl_multi_info_read (multi, &left))) {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+            curl_easy_getinfo (msg->easy_handle, CURLINFO_PRIVATE, (char **) &load);
+            download_end (load, msg->data.result);
+            active--;
+        }
+
+        // Sleeps until socket activity, a curl timeout, the next retry or curl_multi_wakeup ()
+        curl_multi_poll (multi, NULL, 0, timeout, NULL);
+    }
+
+    // Abort transfers in flight, their files are incomplete
+    while ((load = transfers)) {
+        transfers = load->next;
+        download_free (load);
+    }
+    while ((load = retries)) {
+        retries = load->next;
+        download_free (load);
+    }
+
+    return NULL;
+}
+
+static int download_begin (DownloadData *load) {
+    char header[DOWNLOAD_VALIDATOR_SIZE + 32];
+    const char *validator;
     CURL *curl;
-    CURLcode ret;
-    FILE *fd;
-    SoundShort snd = {0};
-    DownloadData *data = (DownloadData *) (ptr);
-    ChunkData cd = { 0, 0, 0 };
-
-    fd = fopen (data->filename, "wb");
-    if (!fd) {
+
+    // Resume only when the server can tell whether the file changed meanwhile
+    validator = load->etag[0] && strncmp (load->etag, "W/", 2) ? load->etag : load->lastModified;
+    if (load->offset && validator[0]) {
+        load->cd.fd = fopen (load->part, "ab");
+        snprintf (header, sizeof (header), "If-Range: %s", validator);
+        load->headers = curl_slist_append (NULL, header);
+    } else {
+        load->offset = 0;
+        load->cd.fd = fopen (load->part, "wb");
+        // Only the first attempt holds the validators of the base
+        if (load->baseId && !load->attempt && load->etag[0]) {
+            snprintf (header, sizeof (header), "If-None-Match: %s", load->etag);
+            load->headers = curl_slist_append (load->headers, header);
+        }
+        if (load->baseId && !load->attempt && load->lastModified[0]) {
+            snprintf (header, sizeof (header), "If-Modified-Since: %s", load->lastModified);
+            load->headers = curl_slist_append (load->headers, header);
+        }
+    }
+    if (!load->cd.fd) {
         selfLogErr ("Cannot open file for write(%d): %m", errno);
-        download_decrement ();
-        return NULL;
+        return FALSE;
     }
+    load->etag[0] = 0;
+    load->lastModified[0] = 0;
+    load->checked = FALSE;
+    load->cd.cnt = 0;
+    load->cd.size = 0;
 
-    selfLogInf ("Download to %s", data->filename);
-    cd.fd = fd;
+    curl = curl_easy_init ();
+    returnValIfFailErr (curl, FALSE, "Create curl handle error");
+    load->curl = curl;
 
-    curl = curl_easy_init();
-    if(curl) {
+    curl_easy_setopt (curl, CURLOPT_URL, load->url);
+    // curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+    curl_easy_setopt (curl, CURLOPT_WRITEDATA, load);
+    curl_easy_setopt (curl, CURLOPT_WRITEFUNCTION, download_write_chunk);
+    curl_easy_setopt (curl, CURLOPT_HEADERDATA, load);
+    curl_easy_setopt (curl, CURLOPT_HEADERFUNCTION, download_header);
+    curl_easy_setopt (curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt (curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt (curl, CURLOPT_CONNECTTIMEOUT, DOWNLOAD_CONNECT_TIME);
+    curl_easy_setopt (curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+    curl_easy_setopt (curl, CURLOPT_LOW_SPEED_TIME, DOWNLOAD_STALL_TIME);
+    curl_easy_setopt (curl, CURLOPT_SHARE, share);
+    curl_easy_setopt (curl, CURLOPT_PRIVATE, load);
+    if (load->headers)
+        curl_easy_setopt (curl, CURLOPT_HTTPHEADER, load->headers);
+    if (load->offset)
+        curl_easy_setopt (curl, CURLOPT_RESUME_FROM_LARGE, load->offset);
 
-        curl_easy_setopt(curl, CURLOPT_URL, data->url);
-        // curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &cd);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, download_write_chunk);
+    if (curl_multi_add_handle (multi, curl) != CURLM_OK) {
+        selfLogErr ("Add download %lu error", load->id);
+        return FALSE;
+    }
 
-        ret = curl_easy_perform(curl);
-        (void)ret;
-        selfLogTrc ("CURL ret = %d [chunks=%d, size=%ld]", ret, cd.cnt, cd.size);
+    load->state = DL_Process;
+    if (load->offset)
+        selfLogInf ("Resume download to %s from %ld", load->part, (long) load->offset);
+    else
+        selfLogInf ("Download to %s", load->part);
+    return TRUE;
+}
+
+/**
+ * @brief Closes a transfer, then retries it, or publishes the verified
+ * file under its final name and hands it over to the main thread
+ */
+static void download_end (DownloadData *load, CURLcode res) {
+    DownloadData **p;
+    curl_off_t length = -1;
+    const char *err = NULL;
+    struct stat st;
+    long code = 0;
+    int retry = FALSE;
+
+    selfLogTrc ("CURL ret = %d [chunks=%d, size=%ld]", res, load->cd.cnt, load->cd.size);
+
+    for (p = &transfers; *p; p = &(*p)->next) {
+        if (*p == load) {
+            *p = load->next;
+            break;
+        }
+    }
 
-        /* always cleanup */
-        curl_easy_cleanup(curl);
+    if (load->curl) {
+        curl_easy_getinfo (load->curl, CURLINFO_RESPONSE_CODE, &code);
+        curl_easy_getinfo (load->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+        curl_multi_remove_handle (multi, load->curl);
+        curl_easy_cleanup (load->curl);
+        load->curl = NULL;
+    }
+    curl_slist_free_all (load->headers);
+    load->headers = NULL;
+    if (load->cd.fd) {
+        if (fclose (load->cd.fd) && res == CURLE_OK)
+            res = CURLE_WRITE_ERROR;
+        load->cd.fd = NULL;
+    }
 
-        data->state = DL_Finished;
+    if (res == CURLE_OK && code == 304) {
+        selfLogInf ("Download %lu is not modified", load->id);
+        unlink (load->part);
+        download_done (load, DL_NotModified);
+        return;
+    }
 
-        fclose (fd);
+    if (res == CURLE_OK) {
+        err = download_verify (load, length);
+        // A corrupted file is fetched again from scratch
+        retry = err != NULL;
+        if (err)
+            load->offset = 0;
+        else if (rename (load->part, load->filename))
+            err = strerror (errno);
+    } else if (code == 416) {
+        // Kept part doesn't fit the file anymore
+        err = "range not satisfiable";
+        retry = TRUE;
+        load->offset = 0;
+    } else {
+        err = curl_easy_strerror (res);
+        retry = download_retryable (res, code);
+        // Keep what arrived for a range request
+        load->offset = !stat (load->part, &st) ? st.st_size : 0;
+    }
 
-        snd.id = data->id;
-        snd.type = data->type;
-        strcpy (snd.url, data->url);
+    if (!err) {
+        selfLogInf ("Downloaded %lu to %s", load->id, load->filename);
+        download_progress_end (load, TRUE);
+        download_done (load, DL_Finished);
+        return;
+    }
 
-        sound_update (&snd, 1);
+    if (retry && ++load->attempt < DOWNLOAD_RETRIES) {
+        selfLogWrn ("Download %lu [%s] error (HTTP %ld): %s", load->id, load->url, code, err);
+        download_retry (load);
+        return;
     }
-    download_decrement ();
 
+    selfLogErr ("Download %lu [%s] error (HTTP %ld): %s, give up after %u attempt(s)", load->id, load->url, code, err, load->attempt);
+    unlink (load->part);
+    download_progress_end (load, FALSE);
+    download_done (load, DL_Failed);
+}
+
+/**
+ * @brief Checks a complete transfer against the reported length and digest
+ *
+ * @return const char* reason the file is bad, NULL if it is good
+ */
+static const char * download_verify (DownloadData *load, curl_off_t length) {
+    uint8_t digest[MD5_SIZE];
+    char expected[2 * MD5_SIZE + 1], hex[2 * MD5_SIZE + 1];
+    struct stat st;
+    int i;
+
+    if (stat (load->part, &st) || !st.st_size)
+        return "empty file";
+    if (length >= 0 && st.st_size != load->offset + length)
+        return "length mismatch";
+
+    // Digest from the request, else a plain MD5 ETag (S3 and alike)
+    if (load->md5[0])
+        strcpy (expected, load->md5);
+    else if (!download_etag_md5 (load->etag, expected))
+        expected[0] = 0;
+
+    if (!md5_file (load->part, digest))
+        return "can't read file";
+    for (i = 0; i < MD5_SIZE; i++)
+        sprintf (hex + 2 * i, "%02x", digest[i]);
+
+    if (expected[0] && strcasecmp (hex, expected))
+        return "MD5 mismatch";
+
+    // Kept in the index to tell a changed sound from the same bytes
+    strcpy (load->md5, hex);
+    load->size = st.st_size;
     return NULL;
 }
+
+static int download_retryable (CURLcode res, long code) {
+    switch (res) {
+        case CURLE_COULDNT_RESOLVE_PROXY:
+        case CURLE_COULDNT_RESOLVE_HOST:
+        case CURLE_COULDNT_CONNECT:
+        case CURLE_PARTIAL_FILE:
+        case CURLE_OPERATION_TIMEDOUT:
+        case CURLE_SSL_CONNECT_ERROR:
+        case CURLE_GOT_NOTHING:
+        case CURLE_SEND_ERROR:
+        case CURLE_RECV_ERROR:
+        case CURLE_HTTP2:
+        case CURLE_HTTP2_STREAM:
+            return TRUE;
+
+        // Server side trouble is worth another try, a wrong url is not
+        case CURLE_HTTP_RETURNED_ERROR:
+            return code >= 500 || code == 408 || code == 429;
+
+        default:
+            return FALSE;
+    }
+}
+
+static void download_retry (DownloadData *load) {
+    uint64_t delay = (uint64_t) DOWNLOAD_RETRY_MS << (load->attempt - 1);
+
+    if (delay > DOWNLOAD_RETRY_MAX_MS)
+        delay = DOWNLOAD_RETRY_MAX_MS;
+    // Up to a quarter of jitter so sounds failed together don't retry together
+    delay += (uint64_t) rand_r (&jitterSeed) % (delay / 4 + 1);
+
+    load->retryAt = download_now () + delay;
+    load->next = retries;
+    retries = load;
+
+    selfLogInf ("Retry download %lu in %lu ms (attempt %u)", load->id, delay, load->attempt + 1);
+}
+
+static void download_done (DownloadData *load, DownloadState state) {
+    load->state = state;
+
+    pthread_mutex_lock (&mutexLoader);
+    load->next = finished;
+    finished = load;
+    pthread_mutex_unlock (&mutexLoader);
+    eventfd_write (eventFd, 1);
+}
+
+static void download_drop_retries (SoundType type) {
+    DownloadData *load, **p;
+
+    for (p = &retries; *p; ) {
+        load = *p;
+        if (load->type != type) {
+            p = &load->next;
+            continue;
+        }
+        *p = load->next;
+        selfLogDbg ("Drop retry of download %lu", load->id);
+        unlink (load->part);
+        download_done (load, DL_Failed);
+    }
+}
+
+/**
+ * @brief Copies a received chunk to the progressive play buffer
+ *
+ * The main thread is told about the sound once its header and first
+ * samples are in. The buffer is dropped if it stops matching the file.
+ */
+static void download_progress (DownloadData *load, const void *ptr, size_t len) {
+    DownloadStart *start;
+    size_t avail;
+
+    if (growbuf_available (load->grow) != (size_t) load->offset + load->cd.size || !growbuf_append (load->grow, ptr, len)) {
+        selfLogWrn ("Download %lu can't be played progressively", load->id);
+        download_progress_end (load, FALSE);
+        return;
+    }
+
+    avail = growbuf_available (load->grow);
+    if (load->announced || (avail < DOWNLOAD_PROGRESS_BYTES && avail < growbuf_size (load->grow)))
+        return;
+
+    start = (DownloadStart *) calloc (1, sizeof (DownloadStart));
+    returnIfFailErr (start, "Not enough memory: %m");
+    start->id = load->id;
+    start->type = load->type;
+    strcpy (start->url, load->url);
+    start->seq = load->seq;
+    start->grow = growbuf_ref (load->grow);
+    load->announced = TRUE;
+
+    pthread_mutex_lock (&mutexLoader);
+    start->next = started;
+    started = start;
+    pthread_mutex_unlock (&mutexLoader);
+    eventfd_write (eventFd, 1);
+}
+
+static void download_progress_end (DownloadData *load, int complete) {
+    if (!load->grow)
+        return;
+
+    growbuf_finish (load->grow, complete);
+    growbuf_unref (load->grow);
+    load->grow = NULL;
+}
+
+/**
+ * @brief Takes the MD5 out of a strong, single part ETag
+ *
+ * @param etag ETag header value
+ * @param md5 set to the hex digest
+ * @return int TRUE if the ETag is an MD5
+ */
+static int download_etag_md5 (const char *etag, char *md5) {
+    size_t i, len = strlen (etag);
+
+    if (len != 2 * MD5_SIZE + 2 || etag[0] != '"' || etag[len - 1] != '"')
+        return FALSE;
+
+    for (i = 1; i < len - 1; i++)
+        if (!strchr ("0123456789abcdefABCDEF", etag[i]))
+            return FALSE;
+
+    memcpy (md5, etag + 1, 2 * MD5_SIZE);
+    md5[2 * MD5_SIZE] = 0;
+    return TRUE;
+}
+
+static uint64_t download_now () {
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
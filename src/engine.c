@@ -0,0 +1,1282 @@
+/**
+ * @file engine.c
+ * @author Denys Stovbun (denis.stovbun@lanars.com)
+ * @brief Persistent PCM output engine
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * The PCM device is opened and configured once on service start and
+ * is served by a single audio thread. A card missing or busy at start
+ * doesn't stop the service, the next play opens it again. Starting a sound only points
+ * the thread to an already loaded SoundData buffer, so a trigger costs
+ * at most one period instead of a full open + hw_params negotiation.
+ *
+ * Every sound type owns a voice. Active voices are summed into one
+ * period buffer with per-voice gain and saturation, so Open, Call and
+ * Test sounds share the device without dmix. Sounds are converted to
+ * the engine format on load, a single voice at unity gain is a copy.
+ *
+ * The gain of a voice is its own gain times the master gain, which is
+ * the volume on cards without a mixer control, times the ducking gain.
+ * Any change is ramped sample by sample: exponentially between audible
+ * gains, linearly to and from silence. Sounds fade in when they start
+ * and fade out when stopped, a restart waits for the fade out. A stop
+ * takes back the queued frames of in-memory sounds but one period, so
+ * the fade is heard within a period, and the device is dropped once the
+ * last sound has faded. Constant gain parts of a period are mixed by the
+ * vector kernels. Where the device allows mmap access, periods are
+ * mixed straight into its ring instead of being copied by writei.
+ *
+ * Writes wait for room in the ring. A device error is recovered and a
+ * period of silence is queued before the next one, so the device comes
+ * back with a period of margin. Underruns, recovery time and short
+ * writes are counted for every sound heard when they happened.
+ *
+ * In realtime mode the audio thread runs with SCHED_FIFO on a stack
+ * touched before it starts, and the mix buffers and the loaded sounds
+ * are locked in RAM, so neither CPU load nor page faults delay periods.
+ *
+ * The voices belong to the audio thread alone. The service main thread
+ * drives them through a lock-free command ring and learns about started
+ * and finished sounds from an event ring, each ring has an eventfd to
+ * wake its consumer. Nothing on the audio path takes a lock shared with
+ * the main thread.
+ *
+ */
+#include <math.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+
+#include "app.h"
+#include "sound.h"
+#include "engine.h"
+#include "convert.h"
+#include "stream.h"
+#include "sample.h"
+#include "ring.h"
+
+_Static_assert (ENGINE_GAIN_SHIFT == SAMPLE_GAIN_SHIFT, "Engine and mix kernel gains differ");
+
+// Ramped gains carry extra precision, exponential steps are factors in it
+#define ENGINE_RAMP_SHIFT       30
+#define ENGINE_RAMP_EXTRA       (ENGINE_RAMP_SHIFT - ENGINE_GAIN_SHIFT)
+// Exponential ramps start and end above -60 dB, silence is reached linearly
+#define ENGINE_RAMP_FLOOR       (1LL << (ENGINE_RAMP_SHIFT - 10))
+// Ring slots, a few commands or events per period at most
+#define ENGINE_RING_SIZE        64
+
+typedef enum EngineCmdEnum {
+      EngineCmdPlay
+    , EngineCmdStop
+    , EngineCmdGain
+    , EngineCmdMaster
+    , EngineCmdRelease
+    , EngineCmdQuit
+} EngineCmd;
+
+typedef enum EngineEvtEnum {
+      EngineEvtStarted
+    , EngineEvtFinished
+} EngineEvt;
+
+// Main thread to audio thread
+typedef struct EngineCommandStruct {
+    EngineCmd           cmd;
+    SoundType           type;
+    SoundData          *sound;
+    uint32_t            seq;
+    uint32_t            gain;
+    struct timespec     trigger;
+} EngineCommand;
+
+// Audio thread to main thread
+typedef struct EngineEventStruct {
+    EngineEvt           evt;
+    SoundType           type;
+    SoundData          *sound;
+    uint32_t            seq;
+    uint32_t            latency;
+} EngineEvent;
+
+typedef struct EngineRampStruct {
+    int64_t             gain;       // Gain of the next frame (ENGINE_RAMP_SHIFT fixed point)
+    int64_t             step;       // Added every frame, or the factor of exponential ramps
+    uint32_t            target;     // Gain at the end (ENGINE_GAIN_SHIFT fixed point)
+    uint32_t            left;       // Frames to the end
+    int                 expo;       // Exponential, else linear
+} EngineRamp;
+
+// Written by the audio thread only, read by the main thread
+typedef struct EngineCountersStruct {
+    _Atomic uint64_t    xruns;
+    _Atomic uint64_t    recoveryUs;
+    _Atomic uint64_t    recoveryMaxUs;
+    _Atomic uint64_t    shortWrites;
+} EngineCounters;
+
+typedef struct EngineVoiceStruct {
+    SoundData          *sound;      // Sound being played (NULL when idle)
+    snd_pcm_uframes_t   pos;        // Next frame to mix
+    struct timespec     trigger;    // Time of the play request
+    uint32_t            seq;        // Play request number
+    uint32_t            gain;       // Voice gain (ENGINE_GAIN_SHIFT fixed point)
+    EngineRamp          ramp;       // Gain applied, master and ducking included
+    int                 started;    // First period is queued
+    int                 stopping;   // Fades out, then ends without a finished event
+    SoundData          *release;    // Released when the fade out ends
+    EngineCommand       next;       // Play request waiting for the fade out
+    int                 pending;
+} EngineVoice;
+
+static void * engine_process (void *ptr);
+static int engine_spawn ();
+static int engine_lock (const void *addr, size_t len);
+static int engine_commands (snd_pcm_uframes_t *tail);
+static int engine_send (EngineCommand *c);
+static void engine_post (EngineEvt evt, SoundType type, SoundData *sound, uint32_t seq, uint32_t us);
+static void engine_released (SoundData *sound);
+static void engine_begin (EngineVoice *v, const EngineCommand *c);
+static void engine_end (EngineVoice *v, int finished);
+static int engine_active ();
+static int engine_open ();
+static void engine_close ();
+static int engine_configure ();
+static int engine_prepare ();
+static void engine_rewind ();
+static int engine_set_params (snd_pcm_access_t access);
+static int engine_mix (EngineVoice *mix, int16_t *out, snd_pcm_uframes_t frames);
+static void engine_mix_voice (EngineVoice *v, snd_pcm_uframes_t frames);
+static void engine_ramp (EngineRamp *r, uint32_t target, uint32_t frames);
+static inline int32_t engine_ramp_next (EngineRamp *r);
+static void engine_copy_voice (EngineVoice *v, int16_t *out, snd_pcm_uframes_t frames);
+static snd_pcm_uframes_t engine_fetch (EngineVoice *v, snd_pcm_uframes_t frames, const int16_t **src);
+static snd_pcm_uframes_t engine_length (const SoundData *data);
+static int engine_ducked (const EngineVoice *mix, SoundType type);
+static snd_pcm_sframes_t engine_write (const int16_t *buf, snd_pcm_uframes_t frames);
+static snd_pcm_sframes_t engine_write_mmap (snd_pcm_uframes_t frames, int *ramped);
+static int engine_recover (int err);
+static int engine_pad ();
+static void engine_count (uint64_t xruns, uint64_t us, uint64_t shortWrites);
+static inline int16_t * engine_area (const snd_pcm_channel_area_t *areas, snd_pcm_uframes_t offset);
+static uint32_t engine_measure (EngineVoice *v);
+
+// Mixing priority, a voice is ducked while a higher priority one plays
+static const uint8_t priority[SoundMAX] = {
+    [SoundNone] = 0,
+    [SoundTest] = 1,
+    [SoundOpen] = 1,
+    [SoundCall] = 2,
+};
+
+static snd_pcm_t           *pcm         = NULL;
+static pthread_t            thread      = 0UL;
+static Ring                *commands    = NULL;
+static Ring                *events      = NULL;
+static int                  cmdFd       = -1; // Wakes the idle audio thread
+static int                  evtFd       = -1; // Wakes the main thread
+static snd_pcm_uframes_t    periodSize  = 0;
+static snd_pcm_uframes_t    bufferSize  = 0;
+static int32_t             *mixBuf      = NULL;
+static int16_t             *outBuf      = NULL;
+static int16_t             *silence     = NULL; // Period queued after a recovery
+static int16_t             *fetchBuf[SoundMAX] = { 0 }; // Stream frames of each voice
+static _Atomic uint32_t     dropped     = 0; // Events lost on a full ring
+static SoundData * _Atomic  released    = NULL; // Last sound let go, never lost as events may be
+
+// Audio thread only
+static EngineVoice          voices[SoundMAX] = { 0 };
+static uint32_t             master      = ENGINE_UNITY;
+static snd_pcm_uframes_t    redo        = 0; // Queued frames that mixing again gives unchanged
+static int                  recovered   = FALSE; // Device recovered while writing the period
+
+// Audio thread, set up before it starts or read through atomics
+static int                  mmapped     = FALSE; // Periods are mixed into the device ring
+static EngineCounters       counters[SoundMAX] = { 0 };
+
+// Main thread only
+static uint32_t             seqs[SoundMAX] = { 0 }; // Last play request of each voice
+static int                  playing[SoundMAX] = { 0 };
+static uint32_t             latency     = 0;
+static void                *stack       = NULL; // Audio thread stack
+static int                  realtime    = FALSE; // Audio thread got SCHED_FIFO
+static int                  lockFailed  = FALSE; // Warned about mlock once
+
+int engine_start () {
+    int i;
+
+    for (i = 0; i < SoundMAX; i++)
+        voices[i].gain = ENGINE_UNITY;
+    master = ENGINE_UNITY;
+
+    commands = ring_new (ENGINE_RING_SIZE, sizeof (EngineCommand));
+    events = ring_new (ENGINE_RING_SIZE, sizeof (EngineEvent));
+    cmdFd = eventfd (0, EFD_CLOEXEC);
+    evtFd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (!commands || !events || cmdFd < 0 || evtFd < 0) {
+        selfLogErr ("Create audio queues error: %m");
+        engine_shutdown ();
+        return -ENOMEM;
+    }
+
+    // Without the device plays fail until it can be opened
+    engine_open ();
+    return 0;
+}
+
+void engine_shutdown () {
+    engine_close ();
+
+    ring_free (commands);
+    ring_free (events);
+    commands = NULL;
+    events = NULL;
+    if (cmdFd >= 0)
+        close (cmdFd);
+    if (evtFd >= 0)
+        close (evtFd);
+    cmdFd = -1;
+    evtFd = -1;
+}
+
+/**
+ * @brief Opens and configures the device and starts the audio thread
+ *
+ * @return int 0 or error code
+ */
+static int engine_open () {
+    int err;
+
+    err = snd_pcm_open (&pcm, &card[0], SND_PCM_STREAM_PLAYBACK, 0);
+    if (err < 0) {
+        selfLogErr ("Can't open audio %s: %s", &card[0], snd_strerror (err));
+        pcm = NULL;
+        return err;
+    }
+
+    err = engine_configure ();
+    if (err < 0)
+        goto fail;
+
+    err = engine_spawn ();
+    if (err) {
+        selfLogErr ("Create audio thread error(%d): %s", err, strerror (err));
+        thread = 0UL;
+        err = -err;
+        goto fail;
+    }
+
+    selfLogInf ("Audio engine started on %s: %s %uHz %uch, period=%lu, buffer=%lu"
+        , &card[0], snd_pcm_format_name (ENGINE_FORMAT), ENGINE_RATE, ENGINE_CHANNELS, periodSize, bufferSize);
+    if (realtime)
+        selfLogInf ("Audio thread runs SCHED_FIFO priority %d", RT_PRIORITY);
+    return 0;
+
+fail:
+    engine_close ();
+    return err;
+}
+
+/**
+ * @brief Stops the audio thread and closes the device, the queues stay
+ */
+static void engine_close () {
+    EngineCommand c = { .cmd = EngineCmdQuit };
+    int i;
+
+    if (thread) {
+        while (!engine_send (&c))
+            usleep (1000);
+        pthread_join (thread, NULL);
+        thread = 0UL;
+    }
+    if (stack) {
+        munmap (stack, ENGINE_STACK_SIZE);
+        stack = NULL;
+    }
+    realtime = FALSE;
+
+    if (pcm) {
+        snd_pcm_drop (pcm);
+        snd_pcm_close (pcm);
+        pcm = NULL;
+    }
+
+    free (mixBuf);
+    free (outBuf);
+    free (silence);
+    mixBuf = NULL;
+    outBuf = NULL;
+    silence = NULL;
+    for (i = 0; i < SoundMAX; i++) {
+        free (fetchBuf[i]);
+        fetchBuf[i] = NULL;
+    }
+}
+
+/**
+ * @brief Starts a sound from the beginning, main thread only
+ *
+ * @param data loaded sound
+ * @return int TRUE if the request is queued
+ */
+int engine_play (SoundData *data) {
+    EngineCommand c = { .cmd = EngineCmdPlay };
+
+    returnValIfFailWrn (data && data->data && data->format && data->channels && data->rate, FALSE, "No sound data");
+    returnValIfFailErr (data->stream || convert_is_native (data), FALSE, "Sound [%s] is not converted to the device format", data->filename);
+    returnValIfFailWrn (data->type > SoundNone && data->type < SoundMAX, FALSE, "Wrong sound type: %d", data->type);
+    // The device couldn't be opened before, try it again
+    if (!thread && engine_open () < 0)
+        return FALSE;
+
+    c.type = data->type;
+    c.sound = data;
+    c.seq = seqs[data->type] + 1;
+    clock_gettime (CLOCK_MONOTONIC, &c.trigger);
+    if (!engine_send (&c))
+        return FALSE;
+
+    seqs[data->type] = c.seq;
+    playing[data->type] = TRUE;
+    sound_set_playing (data->type, TRUE);
+
+    return TRUE;
+}
+
+/**
+ * @brief Stops a sound, main thread only
+ *
+ * @param type sound type
+ * @return int TRUE if the sound was playing
+ */
+int engine_cancel (SoundType type) {
+    EngineCommand c = { .cmd = EngineCmdStop };
+    int was;
+
+    returnValIfFailWrn (type > SoundNone && type < SoundMAX, FALSE, "Wrong sound type: %d", type);
+    // Nothing plays without the audio thread
+    if (!thread)
+        return FALSE;
+
+    c.type = type;
+    if (!engine_send (&c))
+        return FALSE;
+
+    // A finished event still in flight belongs to the cancelled request
+    was = playing[type];
+    seqs[type]++;
+    playing[type] = FALSE;
+    if (was)
+        sound_set_playing (type, FALSE);
+
+    return was;
+}
+
+/**
+ * @brief Stops the sound and waits until the audio thread
+ * doesn't reference its buffer anymore, main thread only
+ *
+ * @param data sound to be freed by the caller
+ */
+void engine_release (SoundData *data) {
+    EngineCommand c = { .cmd = EngineCmdRelease };
+    struct pollfd pfd = { .events = POLLIN };
+
+    if (data->type <= SoundNone || data->type >= SoundMAX || !thread)
+        return;
+
+    engine_cancel (data->type);
+
+    c.type = data->type;
+    c.sound = data;
+    atomic_store_explicit (&released, NULL, memory_order_relaxed);
+    while (!engine_send (&c))
+        usleep (1000);
+
+    // The audio thread answers between two periods
+    pfd.fd = evtFd;
+    while (atomic_load_explicit (&released, memory_order_acquire) != data) {
+        poll (&pfd, 1, 100);
+        engine_dispatch ();
+    }
+}
+
+/**
+ * @brief Sets voice gain, main thread only
+ *
+ * @param type sound type
+ * @param gain gain in ENGINE_GAIN_SHIFT fixed point, up to ENGINE_UNITY (0 dB)
+ */
+void engine_set_gain (SoundType type, uint32_t gain) {
+    EngineCommand c = { .cmd = EngineCmdGain };
+
+    returnIfFailWrn (type > SoundNone && type < SoundMAX, "Wrong sound type: %d", type);
+
+    c.type = type;
+    c.gain = gain > ENGINE_UNITY ? ENGINE_UNITY : gain;
+    // Without the audio thread the voice is set for it to start with
+    if (!thread)
+        voices[type].gain = c.gain;
+    else
+        engine_send (&c);
+}
+
+/**
+ * @brief Sets the gain of the whole mix, main thread only
+ *
+ * @param gain gain in ENGINE_GAIN_SHIFT fixed point, up to ENGINE_UNITY (0 dB)
+ */
+void engine_set_master (uint32_t gain) {
+    EngineCommand c = { .cmd = EngineCmdMaster };
+
+    c.gain = gain > ENGINE_UNITY ? ENGINE_UNITY : gain;
+    // Without the audio thread the volume is kept for it to start with
+    if (!thread)
+        master = c.gain;
+    else
+        engine_send (&c);
+}
+
+/**
+ * @brief Tells whether the audio thread got real-time priority
+ */
+int engine_realtime () {
+    return realtime;
+}
+
+/**
+ * @brief Output glitches counted while a sound type was heard
+ *
+ * @param type sound type, SoundNone for output after the sounds
+ * @param st counters since the service start
+ */
+void engine_stats (SoundType type, EngineStats *st) {
+    EngineCounters *c = &counters[type];
+
+    st->xruns = atomic_load_explicit (&c->xruns, memory_order_relaxed);
+    st->recoveryUs = atomic_load_explicit (&c->recoveryUs, memory_order_relaxed);
+    st->recoveryMaxUs = atomic_load_explicit (&c->recoveryMaxUs, memory_order_relaxed);
+    st->shortWrites = atomic_load_explicit (&c->shortWrites, memory_order_relaxed);
+}
+
+/**
+ * @brief Locks the samples of a loaded sound in RAM, realtime mode only
+ *
+ * Locking faults every page in, so the audio thread never touches a
+ * page not yet read. Streams and downloads in progress keep growing
+ * and are not locked.
+ *
+ * @param data sound in the engine format
+ */
+void engine_lock_data (SoundData *data) {
+    if (!gRealtime || data->locked || !data->data || data->stream || data->progress)
+        return;
+
+    data->locked = engine_lock (data->data, data->size * ENGINE_FRAME_BYTES);
+}
+
+/**
+ * @brief Unlocks the samples before the sound is freed
+ *
+ * @param data sound locked by engine_lock_data
+ */
+void engine_unlock_data (SoundData *data) {
+    if (!data->locked)
+        return;
+
+    munlock (data->data, data->size * ENGINE_FRAME_BYTES);
+    data->locked = FALSE;
+}
+
+/**
+ * @brief Trigger-to-first-period latency of the last started sound
+ *
+ * @return uint32_t microseconds
+ */
+uint32_t engine_latency () {
+    return latency;
+}
+
+/**
+ * @brief Descriptor readable when the audio thread has posted events
+ */
+int engine_event_fd () {
+    return evtFd;
+}
+
+/**
+ * @brief Handles events posted by the audio thread, main thread only
+ */
+void engine_dispatch () {
+    EngineEvent e;
+    eventfd_t cnt;
+    uint32_t lost;
+
+    if (evtFd < 0)
+        return;
+
+    // Reset the counter first, events posted from now on wake us again
+    eventfd_read (evtFd, &cnt);
+
+    while (ring_pop (events, &e)) {
+        switch (e.evt) {
+            case EngineEvtStarted:
+                latency = e.latency;
+                selfLogDbg ("Sound %lu trigger latency %u us", e.sound->id, latency);
+                break;
+
+            case EngineEvtFinished:
+                // Ignore the end of a request that was cancelled or restarted
+                if (e.seq == seqs[e.type] && playing[e.type]) {
+                    playing[e.type] = FALSE;
+                    sound_set_playing (e.type, FALSE);
+                }
+                break;
+        }
+    }
+
+    lost = atomic_exchange_explicit (&dropped, 0, memory_order_relaxed);
+    if (lost)
+        selfLogWrn ("Audio thread dropped %u event(s)", lost);
+}
+
+static void * engine_process (void *ptr) {
+    snd_pcm_uframes_t   tail = 0; // Silence to queue behind the last finished sound
+    snd_pcm_sframes_t   r;
+    eventfd_t           cnt;
+    EngineVoice        *v;
+    int                 i, active, first, ramped = FALSE;
+    UNUSED_ARG (ptr);
+
+    while (engine_commands (&tail)) {
+        active = FALSE;
+        first = FALSE;
+        for (i = 0; i < SoundMAX; i++) {
+            if (voices[i].sound) {
+                active = TRUE;
+                first |= !voices[i].started;
+            }
+        }
+
+        if (!active && !tail) {
+            // Sleep until the next command
+            eventfd_read (cmdFd, &cnt);
+            continue;
+        }
+
+        r = first ? engine_prepare () : 0;
+        recovered = FALSE;
+        if (r >= 0 && mmapped) {
+            r = engine_write_mmap (periodSize, &ramped);
+        } else if (r >= 0) {
+            ramped = engine_mix (voices, outBuf, periodSize);
+            r = engine_write (outBuf, periodSize);
+        }
+
+        for (i = 0; i < SoundMAX; i++) {
+            v = &voices[i];
+            if (!v->sound)
+                continue;
+
+            if (r < 0) {
+                engine_end (v, !v->stopping);
+                continue;
+            }
+
+            if (!v->started) {
+                v->started = TRUE;
+                engine_post (EngineEvtStarted, (SoundType) i, v->sound, v->seq, engine_measure (v));
+            }
+            if (v->pos >= engine_length (v->sound) || (v->stopping && !v->ramp.left))
+                engine_end (v, !v->stopping);
+        }
+
+        if (r < 0) {
+            selfLogErr ("Error playing wave: %s", snd_strerror (r));
+            tail = 0;
+            redo = 0;
+            snd_pcm_drop (pcm);
+        } else if (active) {
+            tail = bufferSize;
+            // Gain ramps, ended voices and recoveries can't be mixed again the same way
+            redo = ramped || recovered ? 0 : redo + r;
+        } else if ((snd_pcm_uframes_t) r >= tail) {
+            // Real data has left the ring, nothing but silence is queued
+            tail = 0;
+            redo = 0;
+            snd_pcm_drop (pcm);
+        } else {
+            tail -= r;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Creates the audio thread, with SCHED_FIFO in realtime mode
+ *
+ * Without the permission for SCHED_FIFO the thread is created with the
+ * normal priority and the service goes on.
+ *
+ * @return int pthread error code
+ */
+static int engine_spawn () {
+    struct sched_param param = { .sched_priority = RT_PRIORITY };
+    pthread_attr_t attr;
+    int i, err;
+
+    // Touched now, the thread never faults on its stack
+    stack = mmap (NULL, ENGINE_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (stack == MAP_FAILED) {
+        stack = NULL;
+        return ENOMEM;
+    }
+    memset (stack, 0, ENGINE_STACK_SIZE);
+
+    if (gRealtime) {
+        engine_lock (stack, ENGINE_STACK_SIZE);
+        engine_lock (mixBuf, periodSize * ENGINE_CHANNELS * sizeof (int32_t));
+        engine_lock (outBuf, periodSize * ENGINE_CHANNELS * sizeof (int16_t));
+        engine_lock (silence, periodSize * ENGINE_CHANNELS * sizeof (int16_t));
+        for (i = 0; i < SoundMAX; i++)
+            engine_lock (fetchBuf[i], periodSize * ENGINE_CHANNELS * sizeof (int16_t));
+    }
+
+    pthread_attr_init (&attr);
+    pthread_attr_setstack (&attr, stack, ENGINE_STACK_SIZE);
+    if (gRealtime) {
+        pthread_attr_setinheritsched (&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy (&attr, SCHED_FIFO);
+        pthread_attr_setschedparam (&attr, &param);
+    }
+
+    err = pthread_create (&thread, &attr, engine_process, NULL);
+    if (err == EPERM && gRealtime) {
+        selfLogWrn ("No permission for SCHED_FIFO, audio thread runs with normal priority");
+        pthread_attr_setinheritsched (&attr, PTHREAD_INHERIT_SCHED);
+        err = pthread_create (&thread, &attr, engine_process, NULL);
+    } else if (!err) {
+        realtime = gRealtime;
+    }
+    pthread_attr_destroy (&attr);
+
+    return err;
+}
+
+/**
+ * @brief Locks memory in RAM, warns once when the limit is reached
+ *
+ * @return int TRUE if locked
+ */
+static int engine_lock (const void *addr, size_t len) {
+    if (!mlock (addr, len))
+        return TRUE;
+
+    if (!lockFailed)
+        selfLogWrn ("Can't lock audio memory in RAM: %m");
+    lockFailed = TRUE;
+    return FALSE;
+}
+
+/**
+ * @brief Applies queued commands, audio thread only
+ *
+ * @param tail silence still to queue, reset when queued frames are dropped
+ * @return int FALSE when asked to quit
+ */
+static int engine_commands (snd_pcm_uframes_t *tail) {
+    EngineCommand c;
+    EngineVoice *v;
+
+    while (ring_pop (commands, &c)) {
+        v = &voices[c.type];
+
+        switch (c.cmd) {
+            case EngineCmdPlay:
+                // A sound already heard fades out before the new one starts
+                if (v->sound && v->started) {
+                    v->next = c;
+                    v->pending = TRUE;
+                    v->stopping = TRUE;
+                    engine_rewind ();
+                } else {
+                    engine_begin (v, &c);
+                }
+                break;
+
+            case EngineCmdGain:
+                v->gain = c.gain;
+                break;
+
+            case EngineCmdMaster:
+                master = c.gain;
+                break;
+
+            case EngineCmdStop:
+            case EngineCmdRelease:
+                if (v->pending && (c.cmd == EngineCmdStop || v->next.sound == c.sound))
+                    v->pending = FALSE;
+
+                if (v->sound && (c.cmd == EngineCmdStop || v->sound == c.sound)) {
+                    if (v->started) {
+                        // Heard already, so it fades out and is released after that
+                        v->stopping = TRUE;
+                        if (c.cmd == EngineCmdRelease)
+                            v->release = c.sound;
+                        engine_rewind ();
+                        break;
+                    }
+                    v->sound = NULL;
+                    v->stopping = FALSE;
+                    // Discard queued frames only when nothing else is mixed in them
+                    if (!engine_active ()) {
+                        *tail = 0;
+                        redo = 0;
+                        snd_pcm_drop (pcm);
+                    }
+                }
+                // Voices are only read while mixing, the buffer is free right now
+                if (c.cmd == EngineCmdRelease)
+                    engine_released (c.sound);
+                break;
+
+            case EngineCmdQuit:
+                return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static int engine_send (EngineCommand *c) {
+    if (!ring_push (commands, c)) {
+        selfLogWrn ("Audio command queue is full");
+        return FALSE;
+    }
+
+    eventfd_write (cmdFd, 1);
+    return TRUE;
+}
+
+static void engine_post (EngineEvt evt, SoundType type, SoundData *sound, uint32_t seq, uint32_t us) {
+    EngineEvent e = { evt, type, sound, seq, us };
+
+    if (!ring_push (events, &e)) {
+        atomic_fetch_add_explicit (&dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    eventfd_write (evtFd, 1);
+}
+
+/**
+ * @brief Tells the main thread waiting in engine_release that the sound
+ * isn't referenced anymore
+ */
+static void engine_released (SoundData *sound) {
+    atomic_store_explicit (&released, sound, memory_order_release);
+    eventfd_write (evtFd, 1);
+}
+
+static void engine_begin (EngineVoice *v, const EngineCommand *c) {
+    v->sound = c->sound;
+    v->pos = 0;
+    v->seq = c->seq;
+    v->started = FALSE;
+    v->stopping = FALSE;
+    v->trigger = c->trigger;
+    // Fades in from silence
+    memset (&v->ramp, 0, sizeof (EngineRamp));
+}
+
+/**
+ * @brief Ends the sound of a voice, a play request waiting for it starts
+ *
+ * @param v voice
+ * @param finished the sound is played to its end, else it is stopped
+ */
+static void engine_end (EngineVoice *v, int finished) {
+    SoundType type = v->sound->type;
+
+    if (finished)
+        engine_post (EngineEvtFinished, type, v->sound, v->seq, 0);
+    if (v->release)
+        engine_released (v->release);
+
+    v->sound = NULL;
+    v->release = NULL;
+    v->stopping = FALSE;
+    // Its last frames are queued and can't be mixed again
+    redo = 0;
+
+    if (v->pending) {
+        v->pending = FALSE;
+        engine_begin (v, &v->next);
+    }
+}
+
+/**
+ * @brief Takes back queued frames so a fade out starts within a period
+ *
+ * Only frames mixed at constant gains of in-memory sounds are taken back,
+ * the voice positions move back by as much and the frames are mixed again
+ * with the fade. One period stays queued to keep the device fed. Streams
+ * can't seek back, their fade starts behind the queued frames.
+ */
+static void engine_rewind () {
+    snd_pcm_sframes_t n;
+    int i;
+
+    for (i = 0; i < SoundMAX; i++)
+        if (voices[i].sound && voices[i].started && voices[i].sound->stream)
+            return;
+
+    n = snd_pcm_rewindable (pcm);
+    if (n <= (snd_pcm_sframes_t) periodSize)
+        return;
+    n -= periodSize;
+    if ((snd_pcm_uframes_t) n > redo)
+        n = redo;
+    if (!n)
+        return;
+
+    n = snd_pcm_rewind (pcm, n);
+    if (n <= 0)
+        return;
+
+    // Voices that started since the last ramp have pos of redo at least
+    for (i = 0; i < SoundMAX; i++)
+        if (voices[i].sound && voices[i].started)
+            voices[i].pos -= n;
+    redo -= n;
+    selfLogTrc ("Rewound %ld frames", n);
+}
+
+static int engine_active () {
+    int i;
+
+    for (i = 0; i < SoundMAX; i++)
+        if (voices[i].sound)
+            return TRUE;
+
+    return FALSE;
+}
+
+static int engine_configure () {
+    int i, err;
+    snd_pcm_sw_params_t *sw;
+
+    mmapped = FALSE;
+#ifdef USE_MMAP
+    // Plugins and devices without mmap access fall back to writei
+    err = engine_set_params (SND_PCM_ACCESS_MMAP_INTERLEAVED);
+    mmapped = err >= 0;
+    if (!mmapped)
+        selfLogInf ("No mmap access on %s: %s", &card[0], snd_strerror (err));
+#endif
+    if (!mmapped) {
+        err = engine_set_params (SND_PCM_ACCESS_RW_INTERLEAVED);
+        returnValIfFailErr (err >= 0, err, "Can't set sound parameters: %s", snd_strerror (err));
+    }
+
+    err = snd_pcm_get_params (pcm, &bufferSize, &periodSize);
+    returnValIfFailErr (err >= 0, err, "Can't get sound parameters: %s", snd_strerror (err));
+
+    // Start the device as soon as the first period is queued
+    snd_pcm_sw_params_alloca (&sw);
+    err = snd_pcm_sw_params_current (pcm, sw);
+    if (err >= 0)
+        err = snd_pcm_sw_params_set_start_threshold (pcm, sw, periodSize);
+    if (err >= 0)
+        err = snd_pcm_sw_params (pcm, sw);
+    returnValIfFailErr (err >= 0, err, "Can't set software parameters: %s", snd_strerror (err));
+
+    mixBuf = (int32_t *) malloc (periodSize * ENGINE_CHANNELS * sizeof (int32_t));
+    outBuf = (int16_t *) malloc (periodSize * ENGINE_CHANNELS * sizeof (int16_t));
+    silence = (int16_t *) calloc (periodSize * ENGINE_CHANNELS, sizeof (int16_t));
+    returnValIfFailErr (mixBuf && outBuf && silence, -ENOMEM, "Allocate mix buffers error: %m");
+    for (i = 0; i < SoundMAX; i++) {
+        fetchBuf[i] = (int16_t *) malloc (periodSize * ENGINE_CHANNELS * sizeof (int16_t));
+        returnValIfFailErr (fetchBuf[i], -ENOMEM, "Allocate stream buffers error: %m");
+    }
+
+    return 0;
+}
+
+static int engine_set_params (snd_pcm_access_t access) {
+    // Set the audio card's hardware parameters (sample rate, bit resolution, etc)
+    return snd_pcm_set_params (pcm
+        , ENGINE_FORMAT                 // Format
+        , access                        // Access
+        , ENGINE_CHANNELS               // Channels
+        , ENGINE_RATE                   // Rate
+        , 1                             // Soft resample, only if the card lacks ENGINE_RATE
+        , ENGINE_LATENCY);              // Latency
+}
+
+static int engine_prepare () {
+    int err;
+    snd_pcm_state_t st = snd_pcm_state (pcm);
+
+    // Voices joining a running stream are mixed into the next period
+    if (st == SND_PCM_STATE_PREPARED || st == SND_PCM_STATE_RUNNING)
+        return 0;
+
+    err = snd_pcm_prepare (pcm);
+    returnValIfFailErr (err >= 0, err, "Can't prepare audio: %s", snd_strerror (err));
+
+    return 0;
+}
+
+/**
+ * @brief Sums active voices into out with saturation
+ *
+ * @param mix voices snapshot, positions are advanced
+ * @param out interleaved frames, outBuf or the device ring
+ * @param frames a period or less
+ * @return int TRUE when a gain ramps in the frames
+ */
+static int engine_mix (EngineVoice *mix, int16_t *out, snd_pcm_uframes_t frames) {
+    int i, count = 0, last = 0, ramped = FALSE;
+    uint32_t target;
+    snd_pcm_uframes_t samples = frames * ENGINE_CHANNELS;
+
+    for (i = 0; i < SoundMAX; i++) {
+        if (!mix[i].sound)
+            continue;
+
+        target = mix[i].stopping ? 0 : (uint32_t) (((uint64_t) mix[i].gain * master) >> ENGINE_GAIN_SHIFT);
+        if (engine_ducked (mix, (SoundType) i))
+            target = (target * ENGINE_DUCK_GAIN) >> ENGINE_GAIN_SHIFT;
+        // A new voice starts from a silent ramp, so its fade in begins here once, even
+        // when the period is mixed in several pieces around the end of the device ring
+        if (target != mix[i].ramp.target)
+            engine_ramp (&mix[i].ramp, target, mix[i].stopping || !mix[i].started ? ENGINE_FADE_FRAMES : ENGINE_RAMP_FRAMES);
+
+        ramped |= mix[i].ramp.left != 0;
+        count++;
+        last = i;
+    }
+
+    // Single voice at unity gain goes to the ring untouched
+    if (count == 1 && !mix[last].ramp.left && mix[last].ramp.target == ENGINE_UNITY) {
+        engine_copy_voice (&mix[last], out, frames);
+        return FALSE;
+    }
+
+    memset (mixBuf, 0, samples * sizeof (int32_t));
+
+    for (i = 0; i < SoundMAX; i++)
+        if (mix[i].sound)
+            engine_mix_voice (&mix[i], frames);
+
+    sample_clip_s16 (mixBuf, out, samples);
+    return ramped;
+}
+
+/**
+ * @brief Adds one voice into mixBuf, ramping frames first
+ */
+static void engine_mix_voice (EngineVoice *v, snd_pcm_uframes_t frames) {
+    const int16_t *src;
+    int32_t *acc = mixBuf;
+    int32_t gain;
+    snd_pcm_uframes_t n;
+    uint16_t ch;
+
+    frames = engine_fetch (v, frames, &src);
+
+    for (n = 0; n < frames && v->ramp.left; n++) {
+        gain = engine_ramp_next (&v->ramp);
+        for (ch = 0; ch < ENGINE_CHANNELS; ch++)
+            *acc++ += (*src++ * gain) >> ENGINE_GAIN_SHIFT;
+    }
+
+    if (n < frames)
+        sample_mix_s16 (acc, src, v->ramp.target, (frames - n) * ENGINE_CHANNELS);
+
+    v->pos += frames;
+}
+
+/**
+ * @brief Starts a ramp from the current gain
+ *
+ * @param r ramp
+ * @param target gain to reach (ENGINE_GAIN_SHIFT fixed point)
+ * @param frames ramp length
+ */
+static void engine_ramp (EngineRamp *r, uint32_t target, uint32_t frames) {
+    int64_t to = (int64_t) target << ENGINE_RAMP_EXTRA;
+
+    r->target = target;
+    r->left = r->gain == to ? 0 : frames;
+    if (!r->left) {
+        r->gain = to;
+        return;
+    }
+
+    // Equal steps in dB between audible gains, a straight line to or from silence
+    r->expo = r->gain >= ENGINE_RAMP_FLOOR && to >= ENGINE_RAMP_FLOOR;
+    if (r->expo)
+        r->step = llround (pow ((double) to / (double) r->gain, 1.0 / frames) * (double) (1LL << ENGINE_RAMP_SHIFT));
+    else
+        r->step = (to - r->gain) / (int64_t) frames;
+}
+
+/**
+ * @brief Gain of the next frame, advances the ramp
+ */
+static inline int32_t engine_ramp_next (EngineRamp *r) {
+    int32_t gain = (int32_t) (r->gain >> ENGINE_RAMP_EXTRA);
+
+    if (r->expo)
+        r->gain = (r->gain * r->step) >> ENGINE_RAMP_SHIFT;
+    else
+        r->gain += r->step;
+
+    // Land exactly on the target whatever the rounding was
+    if (!--r->left)
+        r->gain = (int64_t) r->target << ENGINE_RAMP_EXTRA;
+
+    return gain;
+}
+
+static void engine_copy_voice (EngineVoice *v, int16_t *out, snd_pcm_uframes_t frames) {
+    const int16_t *src;
+    snd_pcm_uframes_t n = engine_fetch (v, frames, &src);
+
+    memcpy (out, src, n * ENGINE_FRAME_BYTES);
+    if (n < frames)
+        memset (out + n * ENGINE_CHANNELS, 0, (frames - n) * ENGINE_FRAME_BYTES);
+
+    v->pos += n;
+}
+
+/**
+ * @brief Points at the next frames of a voice
+ *
+ * @param v voice
+ * @param frames frames wanted
+ * @param src set to the frames in engine format
+ * @return snd_pcm_uframes_t frames available, less than wanted at the end
+ * of the sound or when a stream reader is late
+ */
+static snd_pcm_uframes_t engine_fetch (EngineVoice *v, snd_pcm_uframes_t frames, const int16_t **src) {
+    SoundData *data = v->sound;
+    snd_pcm_uframes_t n;
+
+    if (data->stream) {
+        *src = fetchBuf[data->type];
+        return stream_read (data->stream, v->pos, fetchBuf[data->type], frames);
+    }
+
+    n = data->size - v->pos;
+    *src = (const int16_t *) data->data + v->pos * ENGINE_CHANNELS;
+    return n < frames ? n : frames;
+}
+
+static snd_pcm_uframes_t engine_length (const SoundData *data) {
+    return data->stream ? stream_frames (data->stream) : data->size;
+}
+
+static int engine_ducked (const EngineVoice *mix, SoundType type) {
+    int i;
+
+    for (i = 0; i < SoundMAX; i++)
+        if (mix[i].sound && priority[i] > priority[type])
+            return TRUE;
+
+    return FALSE;
+}
+
+static snd_pcm_sframes_t engine_write (const int16_t *buf, snd_pcm_uframes_t frames) {
+    snd_pcm_sframes_t r;
+    snd_pcm_uframes_t count = 0;
+
+    // Output the whole period
+    while (count < frames) {
+        // Sleep until the rest fits, so writei doesn't return short
+        r = snd_pcm_avail_update (pcm);
+        if (r >= 0 && (snd_pcm_uframes_t) r < frames - count)
+            r = snd_pcm_wait (pcm, -1);
+        if (r >= 0) {
+            r = snd_pcm_writei (pcm, buf + count * ENGINE_CHANNELS, frames - count);
+            selfLogTrc ("written %ld frames of %lu left", r, frames - count);
+        }
+        if (r >= 0 && (snd_pcm_uframes_t) r < frames - count)
+            engine_count (0, 0, 1);
+
+        // If an error, try to recover from it
+        if (r < 0)
+            r = engine_recover (r);
+        if (r < 0)
+            return r;
+
+        count += r;
+    }
+
+    return count;
+}
+
+/**
+ * @brief Mixes a period straight into the device ring
+ *
+ * Waits for room like writei does. The free part of the ring may wrap
+ * around its end, then the period is mixed in two pieces.
+ *
+ * @param frames period size
+ * @param ramped set when a gain ramps in the period
+ * @return snd_pcm_sframes_t frames queued or error code
+ */
+static snd_pcm_sframes_t engine_write_mmap (snd_pcm_uframes_t frames, int *ramped) {
+    const snd_pcm_channel_area_t *areas;
+    snd_pcm_uframes_t count = 0, offset, n;
+    snd_pcm_sframes_t r;
+    int16_t *out;
+
+    *ramped = FALSE;
+
+    while (count < frames) {
+        r = snd_pcm_avail_update (pcm);
+        if (r >= 0 && (snd_pcm_uframes_t) r < frames - count)
+            r = snd_pcm_wait (pcm, -1);
+        if (r >= 0) {
+            n = frames - count;
+            r = snd_pcm_mmap_begin (pcm, &areas, &offset, &n);
+        }
+        if (r >= 0 && n) {
+            out = engine_area (areas, offset);
+            *ramped |= engine_mix (voices, out, n);
+            r = snd_pcm_mmap_commit (pcm, offset, n);
+            if (r >= 0 && (snd_pcm_uframes_t) r != n) {
+                engine_count (0, 0, 1);
+                r = -EPIPE;
+            }
+            if (r >= 0)
+                count += n;
+        }
+        selfLogTrc ("mixed %lu frames of %lu into the ring", count, frames);
+
+        // If an error, try to recover from it, frames not committed are lost as with writei
+        if (r < 0)
+            r = engine_recover (r);
+        if (r < 0)
+            return r;
+    }
+
+    // Unlike writei, committed frames don't start the device
+    if (snd_pcm_state (pcm) == SND_PCM_STATE_PREPARED) {
+        r = snd_pcm_start (pcm);
+        if (r < 0)
+            return r;
+    }
+
+    return count;
+}
+
+/**
+ * @brief Recovers the device from a write error and counts the glitch
+ *
+ * @param err error of the write
+ * @return int 0 or the error recovery failed with
+ */
+static int engine_recover (int err) {
+    struct timespec t0, t1;
+    uint64_t us;
+    int r;
+
+    clock_gettime (CLOCK_MONOTONIC, &t0);
+    r = snd_pcm_recover (pcm, err, 0);
+    if (r >= 0)
+        r = engine_pad ();
+    clock_gettime (CLOCK_MONOTONIC, &t1);
+
+    us = (t1.tv_sec - t0.tv_sec) * 1000000LL + (t1.tv_nsec - t0.tv_nsec) / 1000;
+    engine_count (1, us, 0);
+    recovered = TRUE;
+    // The queued frames are silence now
+    redo = 0;
+
+    if (r >= 0)
+        selfLogWrn ("Audio %s, recovered in %lu us", snd_strerror (err), us);
+    return r;
+}
+
+/**
+ * @brief Queues a period of silence on a recovered device
+ *
+ * The device starts again with a period of margin instead of running
+ * dry at once on the next late period.
+ *
+ * @return int 0 or error code
+ */
+static int engine_pad () {
+    const snd_pcm_channel_area_t *areas;
+    snd_pcm_uframes_t offset, n = periodSize;
+    snd_pcm_sframes_t r;
+
+    if (!mmapped) {
+        r = snd_pcm_writei (pcm, silence, periodSize);
+        return r < 0 ? r : 0;
+    }
+
+    // Less than a period when the ring wraps, still a margin
+    r = snd_pcm_mmap_begin (pcm, &areas, &offset, &n);
+    if (r >= 0) {
+        memset (engine_area (areas, offset), 0, n * ENGINE_FRAME_BYTES);
+        r = snd_pcm_mmap_commit (pcm, offset, n);
+    }
+
+    return r < 0 ? r : 0;
+}
+
+/**
+ * @brief Adds to the glitch counters of the sounds being heard
+ */
+static void engine_count (uint64_t xruns, uint64_t us, uint64_t shortWrites) {
+    EngineCounters *c;
+    int i, any = FALSE;
+
+    for (i = SoundMAX - 1; i >= SoundNone; i--) {
+        // Output without sounds counts as SoundNone
+        if (i != SoundNone ? !voices[i].sound : any)
+            continue;
+        any = TRUE;
+
+        c = &counters[i];
+        atomic_store_explicit (&c->xruns, atomic_load_explicit (&c->xruns, memory_order_relaxed) + xruns, memory_order_relaxed);
+        atomic_store_explicit (&c->recoveryUs, atomic_load_explicit (&c->recoveryUs, memory_order_relaxed) + us, memory_order_relaxed);
+        atomic_store_explicit (&c->shortWrites, atomic_load_explicit (&c->shortWrites, memory_order_relaxed) + shortWrites, memory_order_relaxed);
+        if (us > atomic_load_explicit (&c->recoveryMaxUs, memory_order_relaxed))
+            atomic_store_explicit (&c->recoveryMaxUs, us, memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Interleaved frames of the engine format at a ring offset
+ */
+static inline int16_t * engine_area (const snd_pcm_channel_area_t *areas, snd_pcm_uframes_t offset) {
+    return (int16_t *) ((uint8_t *) areas[0].addr + (areas[0].first + offset * areas[0].step) / 8);
+}
+
+static uint32_t engine_measure (EngineVoice *v) {
+    struct timespec now;
+    snd_pcm_sframes_t delay = 0;
+    uint64_t us;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    us = (now.tv_sec - v->trigger.tv_sec) * 1000000LL + (now.tv_nsec - v->trigger.tv_nsec) / 1000;
+
+    // Frames queued up to the end of the first period
+    if (snd_pcm_delay (pcm, &delay) >= 0 && delay > 0)
+        us += (uint64_t) delay * 1000000ULL / ENGINE_RATE;
+
+    return (uint32_t) us;
+}
@@ -0,0 +1,117 @@
+/**
+ * @file growbuf.c
+ * @author Denys Stovbun (denis.stovbun@lanars.com)
+ * @brief Buffer filled by one thread while others read it
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * The buffer is allocated at its final size up front and never moves.
+ * The writer appends and then publishes the new length, so a reader may
+ * use everything below the published length without any lock. Readers
+ * learn about the end from the done flag: the length is final once it
+ * is set, whether the writer got everything or gave up.
+ *
+ */
+#include <stdatomic.h>
+
+#include "app.h"
+#include "growbuf.h"
+
+struct GrowBufStruct {
+    uint8_t            *data;
+    size_t              size;
+    _Atomic size_t      avail;
+    _Atomic int         done;
+    _Atomic int         refs;
+};
+
+/**
+ * @brief Creates an empty buffer
+ *
+ * @param size final size
+ * @return GrowBuf* buffer with one reference, or NULL on error
+ */
+GrowBuf * growbuf_new (size_t size) {
+    GrowBuf *g;
+
+    returnValIfFailErr (size, NULL, "Wrong buffer size");
+
+    g = (GrowBuf *) calloc (1, sizeof (GrowBuf));
+    returnValIfFailErr (g, NULL, "Allocate buffer error: %m");
+
+    g->data = (uint8_t *) calloc (1, size);
+    if (!g->data) {
+        selfLogErr ("Allocate buffer data error: %m");
+        free (g);
+        return NULL;
+    }
+    g->size = size;
+    atomic_init (&g->avail, 0);
+    atomic_init (&g->done, FALSE);
+    atomic_init (&g->refs, 1);
+
+    return g;
+}
+
+GrowBuf * growbuf_ref (GrowBuf *g) {
+    if (g)
+        atomic_fetch_add_explicit (&g->refs, 1, memory_order_relaxed);
+    return g;
+}
+
+void growbuf_unref (GrowBuf *g) {
+    if (!g || atomic_fetch_sub_explicit (&g->refs, 1, memory_order_acq_rel) != 1)
+        return;
+
+    free (g->data);
+    free (g);
+}
+
+/**
+ * @brief Appends data, writer thread only
+ *
+ * @return int FALSE if the data does not fit or the buffer is finished
+ */
+int growbuf_append (GrowBuf *g, const void *buf, size_t len) {
+    size_t avail = atomic_load_explicit (&g->avail, memory_order_relaxed);
+
+    if (atomic_load_explicit (&g->done, memory_order_relaxed) || len > g->size - avail)
+        return FALSE;
+
+    memcpy (g->data + avail, buf, len);
+    atomic_store_explicit (&g->avail, avail + len, memory_order_release);
+    return TRUE;
+}
+
+/**
+ * @brief Marks the available length final, writer thread only
+ *
+ * @param complete TRUE if the whole size was written
+ */
+void growbuf_finish (GrowBuf *g, int complete) {
+    if (!complete)
+        selfLogDbg ("Buffer stopped at %lu of %lu bytes", atomic_load (&g->avail), g->size);
+    atomic_store_explicit (&g->done, TRUE, memory_order_release);
+}
+
+const uint8_t * growbuf_data (const GrowBuf *g) {
+    return g->data;
+}
+
+size_t growbuf_size (const GrowBuf *g) {
+    return g->size;
+}
+
+/**
+ * @brief Bytes that may be read
+ */
+size_t growbuf_available (const GrowBuf *g) {
+    return atomic_load_explicit (&g->avail, memory_order_acquire);
+}
+
+/**
+ * @brief Tells whether the available length is final
+ */
+int growbuf_done (const GrowBuf *g) {
+    return atomic_load_explicit (&g->done, memory_order_acquire);
+}
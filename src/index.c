@@ -0,0 +1,179 @@
+/**
+ * @file index.c
+ * @author Denys Stovbun (denis.stovbun@lanars.com)
+ * @brief Index of downloaded sounds
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * A small Yaml file next to the sounds remembers the url, the ETag and
+ * Last-Modified validators, the size and the MD5 of every downloaded
+ * sound. An update can then ask the server whether the content changed
+ * instead of fetching it again.
+ *
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "index.h"
+#include "index_schema.h"
+
+#define MAX_INDEX_FILE_SIZE     255
+
+static int index_save ();
+static void index_clear (IndexSound *sound);
+static char * index_strdup (const char *str);
+
+static IndexData        *idx = NULL;
+static char              path[MAX_INDEX_FILE_SIZE + 1] = {0};
+
+/**
+ * @brief Loads the index, a missing or broken file gives an empty one
+ *
+ * @param file index file
+ * @return int TRUE if the index is usable
+ */
+int index_init (const char *file) {
+    cyaml_err_t err;
+
+    strncpy (path, file, MAX_INDEX_FILE_SIZE);
+
+    err = cyaml_load_file (path, &ymlIndexConfig
+        , &schemaIndex, (cyaml_data_t **)&idx, NULL);
+    if (err != CYAML_OK) {
+        if (access (path, F_OK) == 0)
+            selfLogWrn ("CYaml load file error(%d): %s [%s]", err, cyaml_strerror (err), path);
+        idx = (IndexData *) calloc (1, sizeof (IndexData));
+        returnValIfFailErr (idx, FALSE, "Not enough memory: %m");
+    }
+
+    selfLogDbg ("Index [%s] has %u sound(s)", path, idx->sounds_count);
+    return TRUE;
+}
+
+void index_deinit () {
+    cyaml_err_t err;
+
+    if (!idx)
+        return;
+
+    err = cyaml_free (&ymlIndexConfig, &schemaIndex, idx, 0);
+    if (err != CYAML_OK)
+        selfLogWrn ("CYaml free error(%d): %s", err, cyaml_strerror (err));
+
+    idx = NULL;
+}
+
+const IndexSound * index_find (uint64_t id) {
+    uint32_t i;
+
+    if (!idx)
+        return NULL;
+
+    for (i = 0; i < idx->sounds_count; i++) {
+        if (idx->sounds[i].id == id)
+            return idx->sounds + i;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Adds or replaces a sound and saves the index
+ *
+ * @param sound sound description, strings are copied
+ * @return int TRUE if saved
+ */
+int index_set (const IndexSound *sound) {
+    IndexSound *s, *sounds;
+    IndexSound  tmp = {0};
+
+    returnValIfFailErr (idx, FALSE, "Index is not loaded");
+
+    // Copy first, the source may point into the index itself
+    tmp.id = sound->id;
+    tmp.url = index_strdup (sound->url);
+    tmp.etag = index_strdup (sound->etag);
+    tmp.last_modified = index_strdup (sound->last_modified);
+    tmp.size = sound->size;
+    tmp.md5 = index_strdup (sound->md5);
+
+    s = (IndexSound *) index_find (sound->id);
+    if (s) {
+        index_clear (s);
+    } else {
+        sounds = (IndexSound *) realloc (idx->sounds, sizeof (IndexSound) * (idx->sounds_count + 1));
+        if (!sounds) {
+            selfLogErr ("Index reallocate error(%d): %m", errno);
+            index_clear (&tmp);
+            return FALSE;
+        }
+        idx->sounds = sounds;
+        s = idx->sounds + idx->sounds_count++;
+    }
+    *s = tmp;
+
+    return index_save ();
+}
+
+/**
+ * @brief Drops sounds which are not worth remembering anymore
+ *
+ * @param keep tells whether a sound stays
+ */
+void index_retain (int (*keep) (const IndexSound *sound)) {
+    uint32_t i, n = 0;
+
+    if (!idx)
+        return;
+
+    for (i = 0; i < idx->sounds_count; i++) {
+        if (keep (idx->sounds + i))
+            idx->sounds[n++] = idx->sounds[i];
+        else
+            index_clear (idx->sounds + i);
+    }
+
+    if (n != idx->sounds_count) {
+        idx->sounds_count = n;
+        index_save ();
+    }
+}
+
+static int index_save () {
+    char tmp[MAX_INDEX_FILE_SIZE + 8];
+    cyaml_err_t err;
+
+    // Written aside and renamed, a crash never leaves a truncated index
+    snprintf (tmp, sizeof (tmp), "%s.tmp", path);
+    err = cyaml_save_file (tmp, &ymlIndexConfig
+        , &schemaIndex, (cyaml_data_t *)idx, 0);
+    if (err != CYAML_OK) {
+        selfLogWrn ("CYaml save file error(%d): %s", err, cyaml_strerror (err));
+        unlink (tmp);
+        return FALSE;
+    }
+
+    if (rename (tmp, path)) {
+        selfLogErr ("Rename index [%s] error: %m", tmp);
+        unlink (tmp);
+        return FALSE;
+    }
+
+    selfLogTrc ("Index updated successfully!");
+    return TRUE;
+}
+
+static void index_clear (IndexSound *sound) {
+    free ((void *) sound->url);
+    free ((void *) sound->etag);
+    free ((void *) sound->last_modified);
+    free ((void *) sound->md5);
+    memset (sound, 0, sizeof (IndexSound));
+}
+
+// Empty strings are not stored, the fields are optional
+static char * index_strdup (const char *str) {
+    return str && str[0] ? strdup (str) : NULL;
+}
@@ -0,0 +1,523 @@
+/**
+ * @file log.c
+ * @author Denys Stovbun (denis.stovbun@lanars.com)
+ * @brief Asynchronous log writer
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * Messages are formatted straight into preallocated slots of a lock-free
+ * multiple producer, single consumer ring, so logging takes no lock and
+ * allocates nothing on the caller side, the audio thread included. A
+ * full ring drops the message and counts it.
+ *
+ * A low priority writer thread drains the ring and writes the lines to
+ * stdout and the log file in batches with writev. It wakes on a timer,
+ * errors and a filling ring wake it at once. Before the writer is started
+ * and after it is stopped lines are written by the caller.
+ *
+ * Every source file has a runtime level, the global one unless set for
+ * it by name. A file joins the module list on its first log site check,
+ * levels set before that wait for it in the overrides table.
+ *
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/eventfd.h>
+
+#include "app.h"
+#include "log.h"
+
+#define LOG_SLOTS           256     // Power of two
+#define LOG_MSG_SIZE        512     // Longer messages are cut
+#define LOG_LINE_SIZE       (LOG_MSG_SIZE + 256)
+#define LOG_BATCH           32      // Messages per writev
+#define LOG_FLUSH_MS        100     // Lines wait this long for others to be written with
+#define LOG_KICK_NOW        0x10000 // Wake value asking the writer to write at once
+#define LOG_NICE            10      // Writer thread priority
+#define LOG_NAME_SIZE       32
+
+typedef struct LogSlotStruct {
+    _Atomic uint32_t    seq;        // Slot turn, see log_claim
+    int                 lvl;
+    int                 line;
+    const char         *file;
+    const char         *func;
+    struct timeval      tv;
+    char                msg[LOG_MSG_SIZE];
+} LogSlot;
+
+typedef struct LogOverrideStruct {
+    char                file[LOG_NAME_SIZE]; // Base name
+    int                 level;
+} LogOverride;
+
+static void * log_process (void *ptr);
+static LogSlot * log_claim ();
+static void log_drain ();
+static int log_pending ();
+static size_t log_format (const LogSlot *s, char *out, char *file);
+static void log_writev (int fd, struct iovec *iov, int cnt);
+static void log_open_file ();
+static const char * log_base_name (const char *file);
+
+static const char *logLevelHeaders[] = {
+    "\033[1;31mERR\033[0m",  // LOG_LEVEL_ERROR     // q = quiet
+    "\033[1;91mWRN\033[0m",  // LOG_LEVEL_WARNING   //   = default
+    "\033[1;37mINF\033[0m",  // LOG_LEVEL_INFO      // v = verbose
+    "\033[1;36mDBG\033[0m",  // LOG_LEVEL_DEBUG     // vvv = verbose++
+    "\033[1;33mTRC\033[0m"   // LOG_LEVEL_TRACE     // vv = verbose+
+};
+
+static const char *logLevelColor[] = {
+    "\033[0;31m",  // LOG_LEVEL_ERROR   #BC1B27
+    "\033[0;91m",  // LOG_LEVEL_WARNING #F15E42
+    "\033[0;37m",  // LOG_LEVEL_INFO    #D0CFCC
+    "\033[0;36m",  // LOG_LEVEL_DEBUG   #2AA1B3
+    "\033[0;33m"   // LOG_LEVEL_TRACE   #A2734C
+};
+
+static const int logLevelSystem[] = {
+    LOG_ERR,        // #define LOG_LEVEL_ERROR     0   /* error conditions */
+    LOG_WARNING,    // #define LOG_LEVEL_WARNING   1   /* warning conditions */
+    LOG_NOTICE,     // #define LOG_LEVEL_INFO      2   /* normal but significant condition */
+    LOG_INFO,       // #define LOG_LEVEL_DEBUG     3   /* informational */
+    LOG_DEBUG       // #define LOG_LEVEL_TRACE     4   /* debug-level messages */
+};
+
+static LogSlot              slots[LOG_SLOTS];
+static _Atomic uint32_t     head        = 0; // Next slot to claim, producers
+static _Atomic uint32_t     tail        = 0; // Next slot to write, writer only
+static _Atomic uint32_t     dropped     = 0;
+static _Atomic int          running     = FALSE;
+static pthread_t            thread      = 0UL;
+static pthread_mutex_t      directMutex = PTHREAD_MUTEX_INITIALIZER; // Lines written without the writer
+static int                  wakeFd      = -1;
+static int                  fileFd      = -1;
+static int                  logType     = LOG_TYPE_NORMAL;
+static LogModule           *modules     = NULL;
+static LogOverride          overrides[LOG_OVERRIDES];
+static int                  nOverrides  = 0;
+static pthread_mutex_t      moduleMutex = PTHREAD_MUTEX_INITIALIZER;
+// Writer buffers, a stdout and a file line for each message of a batch
+static char                 outLines[LOG_BATCH + 1][LOG_LINE_SIZE];
+static char                 fileLines[LOG_BATCH + 1][LOG_LINE_SIZE];
+
+/**
+ * @brief Starts the writer thread
+ *
+ * @param type LOG_TYPE_NORMAL or LOG_TYPE_EXTENDED
+ * @return int error code
+ */
+int log_start (int type) {
+    sigset_t all, old;
+    uint32_t i;
+    int r;
+
+    logType = type;
+    for (i = 0; i < LOG_SLOTS; i++)
+        atomic_init (&slots[i].seq, i);
+
+    wakeFd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+    returnValIfFailErr (wakeFd >= 0, -errno, "Create log eventfd error: %m");
+
+    // Started before loop_init blocks the signals, the writer must never take them
+    sigfillset (&all);
+    pthread_sigmask (SIG_BLOCK, &all, &old);
+    atomic_store (&running, TRUE);
+    r = pthread_create (&thread, NULL, log_process, NULL);
+    pthread_sigmask (SIG_SETMASK, &old, NULL);
+    if (r) {
+        atomic_store (&running, FALSE);
+        close (wakeFd);
+        wakeFd = -1;
+        selfLogErr ("Create log thread error: %s", strerror (r));
+        return -r;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Writes out everything queued and stops the writer thread
+ */
+void log_stop () {
+    if (!atomic_load (&running))
+        return;
+
+    atomic_store (&running, FALSE);
+    eventfd_write (wakeFd, 1);
+    pthread_join (thread, NULL);
+    thread = 0UL;
+
+    // wakeFd stays open, a late producer may still kick it
+    pthread_mutex_lock (&directMutex);
+    if (fileFd >= 0) {
+        close (fileFd);
+        fileFd = -1;
+    }
+    pthread_mutex_unlock (&directMutex);
+}
+
+/**
+ * @brief Adds a source file to the module list, on its first log site check
+ *
+ * @param m module of the file
+ * @return int level of the module
+ */
+int log_module_register (LogModule *m) {
+    int i, lvl;
+
+    pthread_mutex_lock (&moduleMutex);
+    lvl = atomic_load_explicit (&m->level, memory_order_relaxed);
+    if (lvl == LOG_MODULE_NEW) {
+        lvl = LOG_MODULE_GLOBAL;
+        for (i = 0; i < nOverrides; i++)
+            if (!strcmp (overrides[i].file, log_base_name (m->file)))
+                lvl = overrides[i].level;
+        m->next = modules;
+        modules = m;
+        atomic_store_explicit (&m->level, lvl, memory_order_relaxed);
+    }
+    pthread_mutex_unlock (&moduleMutex);
+
+    return lvl;
+}
+
+/**
+ * @brief Sets the level of a source file or the global level
+ *
+ * @param file base name of the file, empty for the global level
+ * @param level log level, LOG_MODULE_GLOBAL makes the file follow the global one
+ * @return int error code
+ */
+int log_set_level (const char *file, int level) {
+    LogModule *m;
+    int i;
+
+    if (level > LOG_LEVEL_MAX || level < (*file ? LOG_MODULE_GLOBAL : LOG_LEVEL_ERROR))
+        return -EINVAL;
+
+    if (!*file) {
+        gLogLevel = level;
+        return 0;
+    }
+    if (strlen (file) >= LOG_NAME_SIZE)
+        return -EINVAL;
+
+    pthread_mutex_lock (&moduleMutex);
+    for (i = 0; i < nOverrides; i++)
+        if (!strcmp (overrides[i].file, file))
+            break;
+
+    if (level == LOG_MODULE_GLOBAL) {
+        if (i < nOverrides)
+            overrides[i] = overrides[--nOverrides];
+    } else if (i < nOverrides) {
+        overrides[i].level = level;
+    } else if (nOverrides < LOG_OVERRIDES) {
+        strcpy (overrides[nOverrides].file, file);
+        overrides[nOverrides++].level = level;
+    } else {
+        pthread_mutex_unlock (&moduleMutex);
+        return -ENOSPC;
+    }
+
+    for (m = modules; m; m = m->next)
+        if (!strcmp (log_base_name (m->file), file))
+            atomic_store_explicit (&m->level, level, memory_order_relaxed);
+    pthread_mutex_unlock (&moduleMutex);
+
+    return 0;
+}
+
+/**
+ * @brief Lists the files having their own level
+ *
+ * @param files base names, valid until the next log_set_level
+ * @param levels their levels
+ * @param max size of the arrays
+ * @return int count
+ */
+int log_levels (const char **files, int *levels, int max) {
+    int i;
+
+    pthread_mutex_lock (&moduleMutex);
+    for (i = 0; i < nOverrides && i < max; i++) {
+        files[i] = overrides[i].file;
+        levels[i] = overrides[i].level;
+    }
+    pthread_mutex_unlock (&moduleMutex);
+
+    return i;
+}
+
+const char * log_level_header (int lvl) {
+    if (lvl < 0)
+        return "---";
+    return logLevelHeaders[lvl > LOG_LEVEL_MAX ? LOG_LEVEL_MAX : lvl];
+}
+
+/**
+ * @brief Logging main body
+ *
+ * @param file current file
+ * @param line current line
+ * @param func current function
+ * @param lvl debug (verbosity) level
+ * @param fmt log format
+ * @param argp log other arguments
+ */
+void selfLogFunction (const char *file, int line, const char *func, int lvl, const char* fmt, ...) {
+    LogSlot *s, local;
+    struct iovec iov[2];
+    va_list arglist;
+    uint32_t used, pos;
+
+    s = atomic_load_explicit (&running, memory_order_acquire) ? log_claim () : &local;
+    if (!s) {
+        atomic_fetch_add_explicit (&dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    s->lvl = lvl;
+    s->line = line;
+    s->file = file;
+    s->func = func;
+    gettimeofday (&s->tv, NULL);
+
+    va_start (arglist, fmt);
+    vsnprintf (s->msg, LOG_MSG_SIZE, fmt, arglist);
+    va_end (arglist);
+
+    if (s == &local) {
+        // No writer, the caller writes the line itself
+        pthread_mutex_lock (&directMutex);
+        log_open_file ();
+        iov[0].iov_base = outLines[LOG_BATCH];
+        iov[0].iov_len = log_format (s, outLines[LOG_BATCH], fileLines[LOG_BATCH]);
+        iov[1].iov_base = fileLines[LOG_BATCH];
+        iov[1].iov_len = strlen (fileLines[LOG_BATCH]);
+        log_writev (STDOUT_FILENO, &iov[0], 1);
+        if (fileFd >= 0)
+            log_writev (fileFd, &iov[1], 1);
+        pthread_mutex_unlock (&directMutex);
+        return;
+    }
+
+    // Tail can't pass the slot before it is published, and pairs with the fence in log_pending
+    pos = atomic_load_explicit (&s->seq, memory_order_relaxed);
+    atomic_thread_fence (memory_order_seq_cst);
+    used = atomic_load_explicit (&head, memory_order_relaxed) - atomic_load_explicit (&tail, memory_order_relaxed);
+    atomic_store_explicit (&s->seq, pos + 1, memory_order_release);
+
+    // Errors are written at once, so is a ring getting full. The first
+    // line of an empty ring wakes the idle writer to start the batch
+    if (lvl <= LOG_LEVEL_ERROR || used >= LOG_SLOTS / 2)
+        eventfd_write (wakeFd, LOG_KICK_NOW);
+    else if (pos == atomic_load_explicit (&tail, memory_order_relaxed))
+        eventfd_write (wakeFd, 1);
+}
+
+/**
+ * @brief Claims a free slot, any thread
+ *
+ * A slot is free for the producer of position pos when its seq is pos,
+ * it is written when seq is pos + 1 and it is free again for the next
+ * round when the writer sets seq to pos + LOG_SLOTS.
+ *
+ * @return LogSlot* slot or NULL if the ring is full
+ */
+static LogSlot * log_claim () {
+    uint32_t pos = atomic_load_explicit (&head, memory_order_relaxed);
+    LogSlot *s;
+    int32_t diff;
+
+    for (;;) {
+        s = &slots[pos & (LOG_SLOTS - 1)];
+        diff = (int32_t) (atomic_load_explicit (&s->seq, memory_order_acquire) - pos);
+        if (!diff) {
+            if (atomic_compare_exchange_weak_explicit (&head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+                return s;
+        } else if (diff < 0) {
+            return NULL;
+        } else {
+            pos = atomic_load_explicit (&head, memory_order_relaxed);
+        }
+    }
+}
+
+static void * log_process (void *ptr) {
+    struct pollfd pfd;
+    eventfd_t cnt;
+    int timeout = -1, r;
+    UNUSED_ARG (ptr);
+
+    // Writing the log must not take time from anything else
+    setpriority (PRIO_PROCESS, gettid (), LOG_NICE);
+
+    pfd.fd = wakeFd;
+    pfd.events = POLLIN;
+
+    // Sleeps until a line comes, then gives it LOG_FLUSH_MS to be joined by others
+    while (atomic_load (&running)) {
+        r = poll (&pfd, 1, timeout);
+        cnt = 0;
+        if (r > 0)
+            eventfd_read (wakeFd, &cnt);
+        if (r > 0 && cnt < LOG_KICK_NOW) {
+            timeout = LOG_FLUSH_MS;
+            continue;
+        }
+        log_drain ();
+        timeout = log_pending () ? LOG_FLUSH_MS : -1;
+    }
+
+    // Producers may still be filling slots claimed before the stop
+    log_drain ();
+    return NULL;
+}
+
+/**
+ * @brief Writes out the published slots, writer thread only
+ */
+static void log_drain () {
+    struct iovec out[LOG_BATCH + 1], file[LOG_BATCH + 1];
+    LogSlot *s, note;
+    uint32_t lost, pos = atomic_load_explicit (&tail, memory_order_relaxed);
+    int n;
+
+    pthread_mutex_lock (&directMutex);
+    log_open_file ();
+    pthread_mutex_unlock (&directMutex);
+
+    do {
+        n = 0;
+        lost = atomic_exchange_explicit (&dropped, 0, memory_order_relaxed);
+        if (lost) {
+            memset (&note, 0, sizeof (LogSlot));
+            note.lvl = LOG_LEVEL_WARNING;
+            note.func = __func__;
+            note.file = __FILE__;
+            gettimeofday (&note.tv, NULL);
+            snprintf (note.msg, LOG_MSG_SIZE, "%u log messages dropped", lost);
+            out[n].iov_base = outLines[n];
+            out[n].iov_len = log_format (&note, outLines[n], fileLines[n]);
+            file[n].iov_base = fileLines[n];
+            file[n].iov_len = strlen (fileLines[n]);
+            n++;
+        }
+
+        while (n < LOG_BATCH) {
+            s = &slots[pos & (LOG_SLOTS - 1)];
+            if (atomic_load_explicit (&s->seq, memory_order_acquire) != pos + 1)
+                break;
+
+            out[n].iov_base = outLines[n];
+            out[n].iov_len = log_format (s, outLines[n], fileLines[n]);
+            file[n].iov_base = fileLines[n];
+            file[n].iov_len = strlen (fileLines[n]);
+            n++;
+
+            // Hand the slot back for the next round
+            atomic_store_explicit (&s->seq, pos + LOG_SLOTS, memory_order_release);
+            atomic_store_explicit (&tail, ++pos, memory_order_relaxed);
+        }
+
+        if (n) {
+            log_writev (STDOUT_FILENO, out, n);
+            if (fileFd >= 0)
+                log_writev (fileFd, file, n);
+        }
+    } while (n == LOG_BATCH);
+}
+
+/**
+ * @brief Tells whether slots are claimed and not written yet, writer thread only
+ *
+ * A producer claiming after this saw an empty ring finds its slot at the
+ * tail and wakes the writer.
+ */
+static int log_pending () {
+    atomic_thread_fence (memory_order_seq_cst);
+    return atomic_load_explicit (&head, memory_order_relaxed) != atomic_load_explicit (&tail, memory_order_relaxed);
+}
+
+/**
+ * @brief Formats the stdout and the file line of a message
+ *
+ * @param s message
+ * @param out stdout line
+ * @param file log file line
+ * @return size_t stdout line length
+ */
+static size_t log_format (const LogSlot *s, char *out, char *file) {
+    char tms[40];
+    struct tm t;
+    size_t sz;
+    int lvl = s->lvl > LOG_LEVEL_MAX ? LOG_LEVEL_MAX : s->lvl;
+    int r;
+
+    localtime_r (&s->tv.tv_sec, &t);
+    sz = strftime (tms, sizeof (tms), "%F %T", &t); // %F => %Y-%m-%d,  %T => %H:%M:%S
+    snprintf (tms + sz, sizeof (tms) - sz, ".%03ld", (long) (s->tv.tv_usec / 1000));
+
+    if (s->lvl < 0) {
+        r = snprintf (out, LOG_LINE_SIZE, "<6> %s %s\n", s->func, s->msg);
+        snprintf (file, LOG_LINE_SIZE, "%s: [---] %s %s\n", tms, s->func, s->msg);
+    } else if (logType == LOG_TYPE_EXTENDED) {
+        r = snprintf (out, LOG_LINE_SIZE, "<%d>%s %s [%s:%d]\n", logLevelSystem[lvl], s->func, s->msg, s->file, s->line);
+        snprintf (file, LOG_LINE_SIZE, "%s: [%s] %s %s%s\033[0m [%s:%d]\n", tms, logLevelHeaders[lvl], s->func, logLevelColor[lvl], s->msg, s->file, s->line);
+    } else {
+        r = snprintf (out, LOG_LINE_SIZE, "<%d>%s %s\n", logLevelSystem[lvl], s->func, s->msg);
+        snprintf (file, LOG_LINE_SIZE, "%s: [%s] %s %s%s\033[0m\n", tms, logLevelHeaders[lvl], s->func, logLevelColor[lvl], s->msg);
+    }
+
+    return r < LOG_LINE_SIZE ? (size_t) r : LOG_LINE_SIZE - 1;
+}
+
+/**
+ * @brief Writes all the buffers, a log write error is not reported anywhere
+ */
+static void log_writev (int fd, struct iovec *iov, int cnt) {
+    ssize_t r;
+
+    while (cnt) {
+        r = writev (fd, iov, cnt);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        // Skip what was written, a short write continues mid buffer
+        while (cnt && (size_t) r >= iov->iov_len) {
+            r -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt) {
+            iov->iov_base = (char *) iov->iov_base + r;
+            iov->iov_len -= r;
+        }
+    }
+}
+
+static const char * log_base_name (const char *file) {
+    const char *slash = strrchr (file, '/');
+    return slash ? slash + 1 : file;
+}
+
+static void log_open_file () {
+    if (fileFd < 0)
+        fileFd = open (LOG_FILE_PATH, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+}
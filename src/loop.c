@@ -0,0 +1,86 @@
+/**
+ * @file loop.c
+ * @author Denys Stovbun (denis.stovbun@lanars.com)
+ * @brief Service main event loop
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * The main thread sleeps in one sd-event loop. The bus connection,
+ * the audio engine events and the download completions are all file
+ * descriptors attached to it, so the service wakes up only when there
+ * is something to do and handles it right away.
+ *
+ */
+#include <signal.h>
+#include <pthread.h>
+
+#include "app.h"
+#include "loop.h"
+
+static int loop_signal_cb (sd_event_source *s, const struct signalfd_siginfo *si, void *userdata);
+
+static sd_event        *event = NULL;
+
+/**
+ * @brief Creates the loop, call before any thread is started
+ *
+ * @return int 0 or negative error code
+ */
+int loop_init () {
+    sigset_t ss;
+    int r;
+
+    r = sd_event_default (&event);
+    returnValIfFailErr (r >= 0, r, "Create event loop error(%d): %s", r, strerror (-r));
+
+    // Signals are taken by the loop, threads inherit the blocked mask
+    sigemptyset (&ss);
+    sigaddset (&ss, SIGTERM);
+    sigaddset (&ss, SIGINT);
+    pthread_sigmask (SIG_BLOCK, &ss, NULL);
+
+    r = sd_event_add_signal (event, NULL, SIGTERM, loop_signal_cb, NULL);
+    if (r >= 0)
+        r = sd_event_add_signal (event, NULL, SIGINT, loop_signal_cb, NULL);
+    returnValIfFailErr (r >= 0, r, "Add signal handlers error(%d): %s", r, strerror (-r));
+
+    return 0;
+}
+
+void loop_deinit () {
+    if (event)
+        sd_event_unref (event);
+    event = NULL;
+}
+
+sd_event * loop_event () {
+    return event;
+}
+
+/**
+ * @brief Runs the loop until loop_quit () or a stop signal
+ *
+ * @return int exit code or negative error code
+ */
+int loop_run () {
+    int r = sd_event_loop (event);
+
+    if (r < 0)
+        selfLogErr ("Event loop error(%d): %s", r, strerror (-r));
+
+    return r;
+}
+
+void loop_quit (int code) {
+    sd_event_exit (event, code);
+}
+
+static int loop_signal_cb (sd_event_source *s, const struct signalfd_siginfo *si, void *userdata) {
+    UNUSED_ARG (s);
+    UNUSED_ARG (userdata);
+
+    selfLogWrn ("Got signal %u, stop", si->ssi_signo);
+    loop_quit (EXIT_SUCCESS);
+
+    return 0;
+}
@@ -0,0 +1,158 @@
+/**
+ * @file md5.c
+ * @author Denys Stovbun (denis.stovbun@lanars.com)
+ * @brief MD5 digest (RFC 1321)
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * Used to check downloads against the MD5 their server reports, it is
+ * an integrity check and not a security one.
+ *
+ */
+#include <stdio.h>
+
+#include "app.h"
+#include "md5.h"
+
+#define MD5_ROTL(x, n)          (((x) << (n)) | ((x) >> (32 - (n))))
+// File read chunk
+#define MD5_FILE_CHUNK          65536
+
+static void md5_block (Md5 *c, const uint8_t *p);
+
+static const uint32_t md5K[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const uint8_t md5R[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+void md5_init (Md5 *c) {
+    c->state[0] = 0x67452301;
+    c->state[1] = 0xefcdab89;
+    c->state[2] = 0x98badcfe;
+    c->state[3] = 0x10325476;
+    c->bytes = 0;
+}
+
+void md5_update (Md5 *c, const void *data, size_t len) {
+    const uint8_t *p = (const uint8_t *) data;
+    size_t used = c->bytes % 64, n;
+
+    c->bytes += len;
+
+    if (used) {
+        n = 64 - used < len ? 64 - used : len;
+        memcpy (c->block + used, p, n);
+        p += n;
+        len -= n;
+        if (used + n < 64)
+            return;
+        md5_block (c, c->block);
+    }
+
+    for (; len >= 64; p += 64, len -= 64)
+        md5_block (c, p);
+
+    memcpy (c->block, p, len);
+}
+
+void md5_final (Md5 *c, uint8_t digest[MD5_SIZE]) {
+    uint64_t bits = c->bytes * 8;
+    uint8_t pad[72] = { 0x80 };
+    size_t used = c->bytes % 64;
+    size_t n = used < 56 ? 56 - used : 120 - used;
+    int i;
+
+    // Length goes little endian behind the padding
+    for (i = 0; i < 8; i++)
+        pad[n + i] = (uint8_t) (bits >> (8 * i));
+    md5_update (c, pad, n + 8);
+
+    for (i = 0; i < MD5_SIZE; i++)
+        digest[i] = (uint8_t) (c->state[i / 4] >> (8 * (i % 4)));
+}
+
+/**
+ * @brief Digest of a whole file
+ *
+ * @return int TRUE on success
+ */
+int md5_file (const char *filename, uint8_t digest[MD5_SIZE]) {
+    Md5 c;
+    uint8_t *buf;
+    size_t n;
+    FILE *fd;
+    int ok;
+
+    fd = fopen (filename, "rb");
+    returnValIfFailErr (fd, FALSE, "Open [%s] error: %m", filename);
+
+    buf = (uint8_t *) malloc (MD5_FILE_CHUNK);
+    if (!buf) {
+        fclose (fd);
+        selfLogErr ("Allocate digest buffer error: %m");
+        return FALSE;
+    }
+
+    md5_init (&c);
+    while ((n = fread (buf, 1, MD5_FILE_CHUNK, fd)) > 0)
+        md5_update (&c, buf, n);
+    ok = !ferror (fd);
+    md5_final (&c, digest);
+
+    free (buf);
+    fclose (fd);
+    return ok;
+}
+
+static void md5_block (Md5 *c, const uint8_t *p) {
+    uint32_t w[16], a, b, d, cc, f, t;
+    int i, g;
+
+    for (i = 0; i < 16; i++)
+        w[i] = (uint32_t) p[i * 4] | (uint32_t) p[i * 4 + 1] << 8 | (uint32_t) p[i * 4 + 2] << 16 | (uint32_t) p[i * 4 + 3] << 24;
+
+    a = c->state[0];
+    b = c->state[1];
+    cc = c->state[2];
+    d = c->state[3];
+
+    for (i = 0; i < 64; i++) {
+        if (i < 16) {
+            f = (b & cc) | (~b & d);
+            g = i;
+        } else if (i < 32) {
+            f = (d & b) | (~d & cc);
+            g = (5 * i + 1) % 16;
+        } else if (i < 48) {
+            f = b ^ cc ^ d;
+            g = (3 * i + 5) % 16;
+        } else {
+            f = cc ^ (b | ~d);
+            g = (7 * i) % 16;
+        }
+
+        t = d;
+        d = cc;
+        cc = b;
+        b = b + MD5_ROTL (a + f + md5K[i] + w[g], md5R[i]);
+        a = t;
+    }
+
+    c->state[0] += a;
+    c->state[1] += b;
+    c->state[2] += cc;
+    c->state[3] += d;
+}
@@ -5,113 +5,235 @@
  * @version 0.1
  * @date 2023-11-27
  *
+ * The mixer is opened once. Its descriptors are watched by the main loop,
+ * so gVolume follows the element when anyone else changes it and reading
+ * the volume never touches the card. Setting it is one element write.
  *
+ * Cards without the control get the volume as the engine master gain.
  *
  */
 #include <math.h>
+#include <poll.h>
+#include <sys/epoll.h>
 
 #include "app.h"
+#include "loop.h"
 #include "mixer.h"
+#include "engine.h"
 
-static int mixer_process_volume (uint8_t *vol, int readValue);
-static void mixer_set_playback_volume (snd_mixer_elem_t *elem, long val);
-static long mixer_get_playback_volume (snd_mixer_elem_t *elem);
-static long convert_to_raw (snd_mixer_elem_t *elem, uint8_t vol);
-static uint8_t convert_to_percent (snd_mixer_elem_t *elem, long val);
+#define MIXER_ELEM      "Headphone"
+#define MIXER_FDS       4
+// Software volume range, 1% is this much below 100%
+#define MIXER_SOFT_DB   50.0
 
+static int mixer_open ();
+static void mixer_close ();
+static int mixer_event_cb (sd_event_source *s, int fd, uint32_t revents, void *userdata);
+static int mixer_elem_cb (snd_mixer_elem_t *e, unsigned int mask);
+static long mixer_get_playback_volume (snd_mixer_elem_t *e);
+static long convert_to_raw (uint8_t vol);
+static uint8_t convert_to_percent (long val);
+static uint32_t convert_to_gain (uint8_t vol);
+
+static snd_mixer_t         *handle  = NULL;
+static snd_mixer_elem_t    *elem    = NULL;
+static long                 volMin  = 0;
+static long                 volMax  = 0;
+static long                 volRaw  = -1;   // Value on the element, as set or reported
+static sd_event_source     *sources[MIXER_FDS] = { NULL };
+static int                  nSources = 0;
+static int                  software = FALSE; // Card has no volume control
+
+int mixer_init () {
+    return mixer_open ();
+}
+
+void mixer_deinit () {
+    mixer_close ();
+}
 
 int mixer_set_volume () {
-    return mixer_process_volume (&gVolume, FALSE);
+    int err;
+    long val;
+
+    if (!elem && !software) {
+        err = mixer_open ();
+        if (err < 0 && !software)
+            return err;
+    }
+
+    if (software) {
+        engine_set_master (convert_to_gain (gVolume));
+        return 0;
+    }
+
+    val = convert_to_raw (gVolume);
+    if (val == volRaw)
+        return 0;
+
+    err = snd_mixer_selem_set_playback_volume_all (elem, val);
+    returnValIfFailErr (err >= 0, err, "Set volume error(%d): %s", err, snd_strerror (err));
+
+    volRaw = val;
+    return 0;
 }
 
 int mixer_get_volume () {
-    return mixer_process_volume (&gVolume, TRUE);
+    int err;
+
+    // Otherwise gVolume is kept current by mixer events, or it is the software volume
+    if (!elem && !software) {
+        err = mixer_open ();
+        if (err < 0)
+            return err;
+        gVolume = convert_to_percent (volRaw);
+    }
+
+    return 0;
 }
 
-static int mixer_process_volume (uint8_t *vol, int readValue) {
-    int err = 0;
-    snd_mixer_t *handle = NULL;
-    snd_mixer_elem_t *elem;
+static int mixer_open () {
+    int err, i, n;
     snd_mixer_selem_id_t *sid;
-    long val = 0;
+    struct pollfd pfds[MIXER_FDS];
 
+    mixer_close ();
 
     snd_mixer_selem_id_alloca (&sid);
     snd_mixer_selem_id_set_index (sid, 0);
-    snd_mixer_selem_id_set_name (sid, "Headphone");
+    snd_mixer_selem_id_set_name (sid, MIXER_ELEM);
 
     err =  snd_mixer_open (&handle, 0);
     returnValIfFailErr (DBUS_OK (err), err, "Mixer %s open error: %s", card, snd_strerror (err));
 
     err = snd_mixer_attach (handle, card);
-    returnValIfFailErr (DBUS_OK (err), err, "Mixer attach %s error: %s", card, snd_strerror (err));
+    if (err < 0) {
+        selfLogErr ("Mixer attach %s error: %s", card, snd_strerror (err));
+        mixer_close ();
+        return err;
+    }
 
     err = snd_mixer_selem_register (handle, NULL, NULL);
     if (err < 0) {
         selfLogErr ("Mixer register error: %s", snd_strerror (err));
-        snd_mixer_close (handle);
+        mixer_close ();
         return err;
     }
 
     err = snd_mixer_load (handle);
     if (err < 0) {
         selfLogErr ("Mixer %s load error: %s", card, snd_strerror (err));
-        snd_mixer_close (handle);
+        mixer_close ();
         return err;
     }
 
     elem = snd_mixer_find_selem (handle, sid);
     if (!elem) {
-        selfLogErr ("Unable to find simple control '%s',%i", snd_mixer_selem_id_get_name (sid), snd_mixer_selem_id_get_index (sid));
-        snd_mixer_close(handle);
+        selfLogWrn ("Unable to find simple control '%s',%i, volume is set in software", snd_mixer_selem_id_get_name (sid), snd_mixer_selem_id_get_index (sid));
+        software = TRUE;
+        mixer_close ();
         return -ENOENT;
     }
 
     err = snd_mixer_selem_has_playback_volume (elem);
     if (err <= 0) {
-        selfLogWrn ("Simple control doesn't have Playback volume");
-        snd_mixer_close(handle);
+        selfLogWrn ("Simple control doesn't have Playback volume, volume is set in software");
+        software = TRUE;
+        mixer_close ();
         return -EINVAL;
     }
 
-    if (readValue) {
-        val = mixer_get_playback_volume (elem);
-        *vol = convert_to_percent (elem, val);
-    } else {
-        val = convert_to_raw (elem, *vol);
-        if (val < 0)
-            return -EPERM;
-        mixer_set_playback_volume (elem, val);
+    err = snd_mixer_selem_get_playback_volume_range (elem, &volMin, &volMax);
+    if (err < 0) {
+        selfLogErr ("Get volume range error(%d): %s", err, snd_strerror (err));
+        mixer_close ();
+        return err;
+    }
+    volRaw = mixer_get_playback_volume (elem);
+    snd_mixer_elem_set_callback (elem, mixer_elem_cb);
+
+    // Control events wake the main loop
+    n = snd_mixer_poll_descriptors_count (handle);
+    if (n > MIXER_FDS)
+        n = MIXER_FDS;
+    n = snd_mixer_poll_descriptors (handle, pfds, n);
+    for (i = 0; i < n; i++) {
+        err = sd_event_add_io (loop_event (), &sources[nSources], pfds[i].fd, pfds[i].events, mixer_event_cb, NULL);
+        if (err < 0) {
+            selfLogWrn ("Watch mixer events error(%d): %s", err, strerror (-err));
+            continue;
+        }
+        nSources++;
     }
 
-    snd_mixer_close (handle);
+    selfLogDbg ("Mixer %s '%s' range %ld..%ld, value %ld", card, MIXER_ELEM, volMin, volMax, volRaw);
     return 0;
 }
 
-static void mixer_set_playback_volume (snd_mixer_elem_t *elem, long val) {
+static void mixer_close () {
+    int i;
+
+    for (i = 0; i < nSources; i++)
+        sd_event_source_disable_unref (sources[i]);
+    nSources = 0;
+
+    if (handle)
+        snd_mixer_close (handle);
+    handle = NULL;
+    elem = NULL;
+    volRaw = -1;
+}
+
+static int mixer_event_cb (sd_event_source *s, int fd, uint32_t revents, void *userdata) {
     int err;
-    snd_mixer_selem_channel_id_t chn;
 
-    for (chn = 0; chn <= SND_MIXER_SCHN_REAR_CENTER; chn++) {
-        if (snd_mixer_selem_has_playback_channel (elem, chn)) {
-            err = snd_mixer_selem_set_playback_volume (elem, chn, val);
-            if (err < 0) {
-                selfLogWrn ("Set channel:%d volume error(%d): %s", chn, err, snd_strerror (err));
-                continue;
-            } else
-                selfLogTrc ("Channel:%d volume=%d", chn, val);
+    if (revents & (EPOLLERR | EPOLLHUP)) {
+        selfLogWrn ("Mixer %s is gone", card);
+        mixer_close ();
+        return 0;
+    }
+
+    err = snd_mixer_handle_events (handle);
+    if (err < 0) {
+        selfLogErr ("Mixer %s events error(%d): %s", card, err, snd_strerror (err));
+        mixer_close ();
+    } else if (!elem) {
+        // Element is removed, the next volume change opens the mixer again
+        mixer_close ();
+    }
+
+    return 0;
+}
+
+static int mixer_elem_cb (snd_mixer_elem_t *e, unsigned int mask) {
+    long val;
+
+    if (mask == SND_CTL_EVENT_MASK_REMOVE) {
+        elem = NULL;
+        return 0;
+    }
+
+    if (mask & SND_CTL_EVENT_MASK_VALUE) {
+        val = mixer_get_playback_volume (e);
+        // Own writes come back here too, they keep the percent as it was set
+        if (val != volRaw) {
+            volRaw = val;
+            gVolume = convert_to_percent (val);
+            selfLogDbg ("Volume changed to %d%%", gVolume);
         }
     }
+
+    return 0;
 }
 
-static long mixer_get_playback_volume (snd_mixer_elem_t *elem) {
+static long mixer_get_playback_volume (snd_mixer_elem_t *e) {
     int err;
     long val = 0;
     snd_mixer_selem_channel_id_t chn;
 
     for (chn = 0; chn <= SND_MIXER_SCHN_REAR_CENTER; chn++) {
-        if (snd_mixer_selem_has_playback_channel (elem, chn)) {
-            err = snd_mixer_selem_get_playback_volume (elem, chn, &val);
+        if (snd_mixer_selem_has_playback_channel (e, chn)) {
+            err = snd_mixer_selem_get_playback_volume (e, chn, &val);
             if (err < 0) {
                 selfLogWrn ("Get channel:%d volume error(%d): %s", chn, err, snd_strerror (err));
                 continue;
@@ -125,45 +247,46 @@ static long mixer_get_playback_volume (snd_mixer_elem_t *elem) {
     return val;
 }
 
-static long convert_to_raw (snd_mixer_elem_t *elem, uint8_t vol) {
-    int err;
-    long val, pMin, pMax, tmp;
-
-    err = snd_mixer_selem_get_playback_volume_range (elem, &pMin, &pMax);
-    if (err < 0) {
-        selfLogErr ("Get volume range error(%d): %s", err, snd_strerror (err));
-        return -EPERM;
-    }
+static long convert_to_raw (uint8_t vol) {
+    long val, tmp;
 
     // Convert percent to value within range
-    tmp = rint ((double)vol * (double)(pMax - pMin) * 0.01);
+    tmp = rint ((double)vol * (double)(volMax - volMin) * 0.01);
     if (tmp == 0 && vol > 0)
         tmp++;
-    val = tmp + pMin;
+    val = tmp + volMin;
     // Check over range
-    val = val < pMin ? pMin : (val > pMax ? pMax : val);
+    val = val < volMin ? volMin : (val > volMax ? volMax : val);
     selfLogDbg ("Percent [%d] to val=%d", vol, val);
 
     return val;
 }
 
-static uint8_t convert_to_percent (snd_mixer_elem_t *elem, long val) {
-    int err;
+static uint8_t convert_to_percent (long val) {
     uint8_t vol = 0;
-    long pMin, pMax, dVal;
-
-    err = snd_mixer_selem_get_playback_volume_range (elem, &pMin, &pMax);
-    if (err < 0) {
-        selfLogErr ("Get volume range error(%d): %s", err, snd_strerror (err));
-        return -EPERM;
-    }
+    long dVal;
 
     // Convert percent to value within range
-    dVal = pMax - pMin;
+    dVal = volMax - volMin;
     if (dVal) {
-        vol = rint (100.0 * ((double)val - (double)pMin) / (double)dVal);
+        vol = rint (100.0 * ((double)val - (double)volMin) / (double)dVal);
     }
     selfLogDbg ("Val [%d] to percent %d%%", val, vol);
 
     return vol;
+}
+
+static uint32_t convert_to_gain (uint8_t vol) {
+    uint32_t gain;
+
+    // Decibel scale like the mixer controls have, 0% is silence
+    if (!vol)
+        gain = 0;
+    else if (vol >= 100)
+        gain = ENGINE_UNITY;
+    else
+        gain = rint (ENGINE_UNITY * pow (10.0, ((double)vol - 100.0) * MIXER_SOFT_DB / 2000.0));
+    selfLogDbg ("Percent [%d] to gain=%u", vol, gain);
+
+    return gain;
 }
\ No newline at end of file
@@ -0,0 +1,390 @@
+/**
+ * @file resample.c
+ * @author Denys Stovbun (denis.stovbun@lanars.com)
+ * @brief Polyphase sample rate converter
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * Rational L/M converter with a Kaiser windowed sinc filter. Each of the
+ * L phases holds its own set of Q15 taps, so one output sample is a
+ * single fixed point dot product over the input history. Taps count and
+ * window shape are picked by the quality level. History is kept per
+ * channel, so the converter can be fed in chunks of any size.
+ *
+ */
+#include <math.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "resample.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#define RESAMPLE_DOT_VECTOR     resample_dot_sse2
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define RESAMPLE_DOT_VECTOR     resample_dot_neon
+#else
+#define RESAMPLE_DOT_VECTOR     resample_dot_scalar
+#endif
+
+#define RESAMPLE_COEF_SHIFT     15
+#define RESAMPLE_COEF_ONE       (1 << RESAMPLE_COEF_SHIFT)
+// Upper limit of stored phases, odd rate pairs round to the nearest one
+#define RESAMPLE_MAX_PHASES     1024
+#define RESAMPLE_MAX_TAPS       256
+// Input frames appended to the history per step
+#define RESAMPLE_CHUNK          1024
+// Taps are processed in blocks of 8 by the vector kernels
+#define RESAMPLE_TAPS_ALIGN     8
+
+typedef int32_t (*ResampleDot) (const int16_t *x, const int16_t *c, uint32_t taps);
+
+typedef struct ResampleProfileStruct {
+    const char     *name;
+    uint32_t        taps;       // Taps per phase when upsampling
+    double          rolloff;    // Passband edge relative to Nyquist
+    double          beta;       // Kaiser window shape
+} ResampleProfile;
+
+struct ResamplerStruct {
+    uint32_t        up;         // Interpolation factor (L)
+    uint32_t        down;       // Decimation factor (M)
+    uint32_t        phases;     // Stored coefficient phases
+    uint32_t        taps;
+    uint16_t        channels;
+    uint32_t        phase;      // Current phase, 0 .. up - 1
+    size_t          pos;        // Filter window start in the history
+    size_t          fill;       // Frames in the history
+    size_t          cap;        // History size per channel
+    int16_t        *coefs;      // (phases + 1) * taps
+    int16_t        *hist;       // channels * cap, planar
+};
+
+static int32_t resample_dot_scalar (const int16_t *x, const int16_t *c, uint32_t taps);
+static void resample_design (Resampler *r, const ResampleProfile *profile, double cutoff);
+static size_t resample_run (Resampler *r, int16_t *out);
+static double resample_bessel_i0 (double x);
+
+static const ResampleProfile profiles[ResampleQualityMAX] = {
+    [ResampleFast]      = { "fast",    8, 0.80, 5.0 },
+    [ResampleMedium]    = { "medium", 16, 0.90, 7.0 },
+    [ResampleBest]      = { "best",   32, 0.95, 9.0 },
+};
+
+/***********************
+ *  DOT PRODUCT KERNELS
+ ***********************/
+static int32_t resample_dot_scalar (const int16_t *x, const int16_t *c, uint32_t taps) {
+    int32_t acc = 0;
+    uint32_t k;
+
+    for (k = 0; k < taps; k++)
+        acc += (int32_t) x[k] * c[k];
+    return acc;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static int32_t resample_dot_sse2 (const int16_t *x, const int16_t *c, uint32_t taps) {
+    __m128i acc = _mm_setzero_si128 ();
+    uint32_t k;
+
+    for (k = 0; k < taps; k += RESAMPLE_TAPS_ALIGN)
+        acc = _mm_add_epi32 (acc, _mm_madd_epi16 (_mm_loadu_si128 ((const __m128i *) (x + k))
+                                                , _mm_loadu_si128 ((const __m128i *) (c + k))));
+
+    acc = _mm_add_epi32 (acc, _mm_shuffle_epi32 (acc, 0x4E));
+    acc = _mm_add_epi32 (acc, _mm_shuffle_epi32 (acc, 0xB1));
+    return _mm_cvtsi128_si32 (acc);
+}
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+static int32_t resample_dot_neon (const int16_t *x, const int16_t *c, uint32_t taps) {
+    int32x4_t acc = vdupq_n_s32 (0);
+    int16x8_t vx, vc;
+    uint32_t k;
+
+    for (k = 0; k < taps; k += RESAMPLE_TAPS_ALIGN) {
+        vx = vld1q_s16 (x + k);
+        vc = vld1q_s16 (c + k);
+        acc = vmlal_s16 (acc, vget_low_s16 (vx), vget_low_s16 (vc));
+        acc = vmlal_high_s16 (acc, vx, vc);
+    }
+    return vaddvq_s32 (acc);
+}
+#endif
+
+static ResampleDot dot = RESAMPLE_DOT_VECTOR;
+
+/**
+ * @brief Creates a converter
+ *
+ * @param inRate source rate
+ * @param outRate destination rate
+ * @param channels interleaved channels count
+ * @param quality filter quality level
+ * @return Resampler* converter or NULL on error
+ */
+Resampler * resample_new (uint32_t inRate, uint32_t outRate, uint16_t channels, ResampleQuality quality) {
+    const ResampleProfile *profile;
+    uint32_t a, b, t, factor;
+    Resampler *r;
+
+    if (!inRate || !outRate || !channels || quality >= ResampleQualityMAX)
+        return NULL;
+
+    r = (Resampler *) calloc (1, sizeof (Resampler));
+    if (!r)
+        return NULL;
+
+    // Reduce the rate ratio to L/M
+    for (a = inRate, b = outRate; b; t = a % b, a = b, b = t);
+    r->up = outRate / a;
+    r->down = inRate / a;
+    r->channels = channels;
+    r->phases = r->up < RESAMPLE_MAX_PHASES ? r->up : RESAMPLE_MAX_PHASES;
+
+    // Downsampling narrows the cutoff, so the filter gets proportionally longer
+    profile = &profiles[quality];
+    factor = (r->down + r->up - 1) / r->up;
+    r->taps = profile->taps * factor;
+    r->taps = (r->taps + RESAMPLE_TAPS_ALIGN - 1) / RESAMPLE_TAPS_ALIGN * RESAMPLE_TAPS_ALIGN;
+    if (r->taps > RESAMPLE_MAX_TAPS)
+        r->taps = RESAMPLE_MAX_TAPS;
+
+    r->cap = r->taps + RESAMPLE_CHUNK;
+    r->coefs = (int16_t *) malloc ((r->phases + 1) * r->taps * sizeof (int16_t));
+    r->hist = (int16_t *) calloc ((size_t) channels * r->cap, sizeof (int16_t));
+    if (!r->coefs || !r->hist) {
+        resample_free (r);
+        return NULL;
+    }
+
+    resample_design (r, profile, r->up < r->down ? (double) r->up / r->down : 1.0);
+
+    // Leading silence centres the first window on the first input frame
+    r->fill = r->taps / 2 - 1;
+
+    return r;
+}
+
+void resample_free (Resampler *r) {
+    if (!r)
+        return;
+    free (r->coefs);
+    free (r->hist);
+    free (r);
+}
+
+/**
+ * @brief Restores a converter to the state of another one
+ *
+ * Both converters must be created with the same parameters.
+ *
+ * @return int 0 or -EINVAL
+ */
+int resample_copy (Resampler *dst, const Resampler *src) {
+    if (dst->up != src->up || dst->down != src->down || dst->taps != src->taps || dst->channels != src->channels)
+        return -EINVAL;
+
+    dst->phase = src->phase;
+    dst->pos = src->pos;
+    dst->fill = src->fill;
+    memcpy (dst->hist, src->hist, (size_t) src->channels * src->cap * sizeof (int16_t));
+    return 0;
+}
+
+/**
+ * @brief Output frames upper bound for the given input
+ */
+size_t resample_max_out (const Resampler *r, size_t inFrames) {
+    return (size_t) (((uint64_t) (inFrames + r->taps) * r->up) / r->down) + 1;
+}
+
+/**
+ * @brief Converts a chunk of interleaved input
+ *
+ * @param r converter
+ * @param in interleaved frames
+ * @param inFrames frames count, all of them are consumed
+ * @param out output buffer for at least resample_max_out(inFrames) frames
+ * @return size_t frames written
+ */
+size_t resample_process (Resampler *r, const int16_t *in, size_t inFrames, int16_t *out) {
+    size_t n, f, shift, produced = 0;
+    uint16_t ch;
+
+    while (inFrames) {
+        n = r->cap - r->fill;
+        if (n > inFrames)
+            n = inFrames;
+
+        for (ch = 0; ch < r->channels; ch++) {
+            int16_t *h = r->hist + (size_t) ch * r->cap + r->fill;
+            for (f = 0; f < n; f++)
+                h[f] = in[f * r->channels + ch];
+        }
+        r->fill += n;
+        in += n * r->channels;
+        inFrames -= n;
+
+        produced += resample_run (r, out + produced * r->channels);
+
+        // Drop history the window has passed
+        shift = r->pos < r->fill ? r->pos : r->fill;
+        if (shift) {
+            for (ch = 0; ch < r->channels; ch++) {
+                int16_t *h = r->hist + (size_t) ch * r->cap;
+                memmove (h, h + shift, (r->fill - shift) * sizeof (int16_t));
+            }
+            r->pos -= shift;
+            r->fill -= shift;
+        }
+    }
+
+    return produced;
+}
+
+/**
+ * @brief Pushes the filter delay out with trailing silence
+ *
+ * @param r converter
+ * @param out output buffer for at least resample_max_out(0) frames
+ * @return size_t frames written
+ */
+size_t resample_flush (Resampler *r, int16_t *out) {
+    size_t n, frames = r->taps / 2;
+    int16_t *zero = (int16_t *) calloc (frames * r->channels, sizeof (int16_t));
+
+    if (!zero)
+        return 0;
+
+    n = resample_process (r, zero, frames, out);
+    free (zero);
+    return n;
+}
+
+/**
+ * @brief Converts a whole buffer at once
+ *
+ * @return int16_t* newly allocated interleaved frames or NULL on error
+ */
+int16_t * resample_buffer (const int16_t *in, size_t frames, uint32_t inRate, uint32_t outRate
+    , uint16_t channels, ResampleQuality quality, size_t *outFrames) {
+    Resampler *r = resample_new (inRate, outRate, channels, quality);
+    size_t n, expect;
+    int16_t *out;
+
+    if (!r)
+        return NULL;
+
+    out = (int16_t *) malloc (resample_max_out (r, frames + r->taps) * channels * sizeof (int16_t));
+    if (!out) {
+        resample_free (r);
+        return NULL;
+    }
+
+    n = resample_process (r, in, frames, out);
+    n += resample_flush (r, out + n * channels);
+    resample_free (r);
+
+    // Flush may run a few frames past the end of the source
+    expect = (size_t) (((uint64_t) frames * outRate + inRate - 1) / inRate);
+    *outFrames = n < expect ? n : expect;
+    return out;
+}
+
+/**
+ * @brief Selects vector or scalar dot product
+ *
+ * @param enable FALSE forces the scalar path
+ * @return int previous state
+ */
+int resample_set_simd (int enable) {
+    int prev = dot != resample_dot_scalar;
+    dot = enable ? RESAMPLE_DOT_VECTOR : resample_dot_scalar;
+    return prev;
+}
+
+const char * resample_quality_name (ResampleQuality quality) {
+    return quality < ResampleQualityMAX ? profiles[quality].name : "unknown";
+}
+
+static size_t resample_run (Resampler *r, int16_t *out) {
+    const int16_t *c;
+    size_t n = 0;
+    uint32_t row;
+    int32_t acc;
+    uint16_t ch;
+
+    while (r->pos + r->taps <= r->fill) {
+        row = (uint32_t) (((uint64_t) r->phase * r->phases + r->up / 2) / r->up);
+        c = r->coefs + (size_t) row * r->taps;
+
+        for (ch = 0; ch < r->channels; ch++) {
+            acc = dot (r->hist + (size_t) ch * r->cap + r->pos, c, r->taps);
+            acc = (acc + (1 << (RESAMPLE_COEF_SHIFT - 1))) >> RESAMPLE_COEF_SHIFT;
+            *out++ = acc > INT16_MAX ? INT16_MAX : (acc < INT16_MIN ? INT16_MIN : (int16_t) acc);
+        }
+        n++;
+
+        r->phase += r->down;
+        r->pos += r->phase / r->up;
+        r->phase %= r->up;
+    }
+
+    return n;
+}
+
+/**
+ * @brief Fills the phase table
+ *
+ * Row p holds the taps for the fractional position p / phases. Each row
+ * is normalized to unity DC gain after quantization.
+ */
+static void resample_design (Resampler *r, const ResampleProfile *profile, double cutoff) {
+    double h[RESAMPLE_MAX_TAPS], half = r->taps / 2, norm = resample_bessel_i0 (profile->beta);
+    double d, x, sum;
+    int32_t total, peak;
+    uint32_t p, k, center;
+
+    cutoff *= profile->rolloff;
+
+    for (p = 0; p <= r->phases; p++) {
+        int16_t *c = r->coefs + (size_t) p * r->taps;
+
+        sum = 0;
+        for (k = 0; k < r->taps; k++) {
+            d = (double) k - (half - 1) - (double) p / r->phases;
+            x = d / half;
+            h[k] = fabs (x) < 1.0 ? resample_bessel_i0 (profile->beta * sqrt (1.0 - x * x)) / norm : 0.0;
+            h[k] *= d == 0.0 ? cutoff : sin (M_PI * cutoff * d) / (M_PI * d);
+            sum += h[k];
+        }
+
+        // Rounding error goes to the largest tap
+        total = 0;
+        center = 0;
+        peak = 0;
+        for (k = 0; k < r->taps; k++) {
+            c[k] = (int16_t) lrint (h[k] / sum * RESAMPLE_COEF_ONE);
+            total += c[k];
+            if (abs (c[k]) > peak) {
+                peak = abs (c[k]);
+                center = k;
+            }
+        }
+        c[center] += RESAMPLE_COEF_ONE - total;
+    }
+}
+
+static double resample_bessel_i0 (double x) {
+    double sum = 1.0, term = 1.0, q = x * x / 4.0;
+    int k;
+
+    for (k = 1; k < 64 && term > sum * 1e-12; k++) {
+        term *= q / ((double) k * k);
+        sum += term;
+    }
+    return sum;
+}
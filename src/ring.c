@@ -0,0 +1,112 @@
+/**
+ * @file ring.c
+ * @author Denys Stovbun (denis.stovbun@lanars.com)
+ * @brief Lock-free single producer, single consumer ring
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * Fixed-size items are copied in and out of a power of two slot array.
+ * The producer only writes head and the consumer only writes tail, so
+ * neither side ever waits for the other: a push to a full ring or a pop
+ * from an empty one just fails. Exactly one thread may push and exactly
+ * one thread may pop.
+ *
+ */
+#include <stdatomic.h>
+
+#include "app.h"
+#include "ring.h"
+
+#define RING_CACHE_LINE         64
+
+struct RingStruct {
+    // Producer side
+    _Atomic uint32_t    head;
+    uint8_t             padHead[RING_CACHE_LINE - sizeof (uint32_t)];
+    // Consumer side
+    _Atomic uint32_t    tail;
+    uint8_t             padTail[RING_CACHE_LINE - sizeof (uint32_t)];
+    // Read only
+    uint32_t            mask;
+    size_t              size;
+    uint8_t            *slots;
+};
+
+/**
+ * @brief Creates a ring
+ *
+ * @param count slots, rounded up to a power of two
+ * @param size item size
+ * @return Ring* ring or NULL on error
+ */
+Ring * ring_new (uint32_t count, size_t size) {
+    Ring *r;
+    uint32_t n = 1;
+
+    returnValIfFailErr (count && size, NULL, "Wrong ring size %u x %lu", count, size);
+    while (n < count)
+        n <<= 1;
+
+    r = (Ring *) aligned_alloc (RING_CACHE_LINE, sizeof (Ring));
+    returnValIfFailErr (r, NULL, "Allocate ring error: %m");
+
+    memset (r, 0, sizeof (Ring));
+    r->slots = (uint8_t *) malloc (n * size);
+    if (!r->slots) {
+        selfLogErr ("Allocate ring slots error: %m");
+        free (r);
+        return NULL;
+    }
+    r->mask = n - 1;
+    r->size = size;
+    atomic_init (&r->head, 0);
+    atomic_init (&r->tail, 0);
+
+    return r;
+}
+
+void ring_free (Ring *r) {
+    if (!r)
+        return;
+
+    free (r->slots);
+    free (r);
+}
+
+/**
+ * @brief Copies an item in, producer thread only
+ *
+ * @return int FALSE if the ring is full
+ */
+int ring_push (Ring *r, const void *item) {
+    uint32_t head = atomic_load_explicit (&r->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit (&r->tail, memory_order_acquire);
+
+    if (head - tail > r->mask)
+        return FALSE;
+
+    memcpy (r->slots + (head & r->mask) * r->size, item, r->size);
+    // Publish the slot contents together with the new head
+    atomic_store_explicit (&r->head, head + 1, memory_order_release);
+
+    return TRUE;
+}
+
+/**
+ * @brief Copies the oldest item out, consumer thread only
+ *
+ * @return int FALSE if the ring is empty
+ */
+int ring_pop (Ring *r, void *item) {
+    uint32_t tail = atomic_load_explicit (&r->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit (&r->head, memory_order_acquire);
+
+    if (head == tail)
+        return FALSE;
+
+    memcpy (item, r->slots + (tail & r->mask) * r->size, r->size);
+    // Hand the slot back only after it was copied out
+    atomic_store_explicit (&r->tail, tail + 1, memory_order_release);
+
+    return TRUE;
+}
@@ -0,0 +1,927 @@
+/**
+ * @file sample.c
+ * @author Denys Stovbun (denis.stovbun@lanars.com)
+ * @brief Sample format conversion kernels
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * Every format the WAVE loader produces is decoded into left-justified
+ * signed 32 bit (Q31) and encoded back from it, so each kernel is a
+ * load + store pair. Vector paths are NEON on aarch64, SSE2 and AVX2
+ * (runtime detected) on x86; tails and missing kernels fall back to the
+ * scalar code, which produces bit-exact identical results.
+ *
+ * The mixer's gain and saturation kernels live here too, for the same
+ * dispatch: gain is Q16 fixed point up to unity, so a gained sample is
+ * the high half of a 16 x 16 bit product.
+ *
+ */
+#include <math.h>
+#include <errno.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "sample.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SAMPLE_X86          1
+#define SAMPLE_AVX2         __attribute__ ((target ("avx2")))
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SAMPLE_NEON         1
+#endif
+
+// Q31 <-> float scale and the largest float below 1.0
+#define SAMPLE_Q31_SCALE    2147483648.0f
+#define SAMPLE_F32_MAX      0x1.fffffep-1f
+// Not every generated kernel ends up in a dispatch table
+#define SAMPLE_UNUSED       __attribute__ ((unused))
+
+typedef enum SampleFormatEnum {
+      SampleU8
+    , SampleS16LE
+    , SampleS16BE
+    , SampleS24LE
+    , SampleS24BE
+    , SampleS24_3LE
+    , SampleS24_3BE
+    , SampleS32LE
+    , SampleS32BE
+    , SampleFloatLE
+    , SampleFloatBE
+    , SampleMAX
+} SampleFormat;
+
+typedef void (*SampleToS16) (const uint8_t *src, int16_t *dst, size_t samples);
+typedef void (*SampleFromS16) (const int16_t *src, uint8_t *dst, size_t samples);
+typedef void (*SampleToFloat) (const uint8_t *src, float *dst, size_t samples);
+typedef void (*SampleFromFloat) (const float *src, uint8_t *dst, size_t samples);
+typedef void (*SampleMix) (int32_t *acc, const int16_t *src, uint32_t gain, size_t samples);
+typedef void (*SampleClip) (const int32_t *src, int16_t *dst, size_t samples);
+
+typedef struct SampleKernelsStruct {
+    const char         *name;
+    SampleToS16         toS16[SampleMAX];
+    SampleFromS16       fromS16[SampleMAX];
+    SampleToFloat       toFloat[SampleMAX];
+    SampleFromFloat     fromFloat[SampleMAX];
+    SampleMix           mix;
+    SampleClip          clip;
+} SampleKernels;
+
+static void sample_init ();
+static int sample_index (snd_pcm_format_t format);
+
+static pthread_once_t       initOnce    = PTHREAD_ONCE_INIT;
+static SampleKernels        scalar      = { .name = "scalar" };
+static SampleKernels        vector      = { .name = "scalar" };
+static const SampleKernels *kernels     = &scalar;
+
+static const uint8_t widths[SampleMAX] = {
+    [SampleU8]      = 1,
+    [SampleS16LE]   = 2,
+    [SampleS16BE]   = 2,
+    [SampleS24LE]   = 4,
+    [SampleS24BE]   = 4,
+    [SampleS24_3LE] = 3,
+    [SampleS24_3BE] = 3,
+    [SampleS32LE]   = 4,
+    [SampleS32BE]   = 4,
+    [SampleFloatLE] = 4,
+    [SampleFloatBE] = 4,
+};
+
+/***********************
+ *  SCALAR PRIMITIVES
+ ***********************/
+static inline uint32_t rd16le (const uint8_t *p) { return (uint32_t) p[0] | (uint32_t) p[1] << 8; }
+static inline uint32_t rd16be (const uint8_t *p) { return (uint32_t) p[1] | (uint32_t) p[0] << 8; }
+static inline uint32_t rd32le (const uint8_t *p) { return rd16le (p) | rd16le (p + 2) << 16; }
+static inline uint32_t rd32be (const uint8_t *p) { return rd16be (p + 2) | rd16be (p) << 16; }
+
+static inline void wr16le (uint8_t *p, uint32_t v) { p[0] = v; p[1] = v >> 8; }
+static inline void wr16be (uint8_t *p, uint32_t v) { p[1] = v; p[0] = v >> 8; }
+static inline void wr32le (uint8_t *p, uint32_t v) { wr16le (p, v); wr16le (p + 2, v >> 16); }
+static inline void wr32be (uint8_t *p, uint32_t v) { wr16be (p + 2, v); wr16be (p, v >> 16); }
+
+static inline int32_t q31_from_float (float f) {
+    // NaN clamps to -1.0 as the vector max instructions do
+    f = f > -1.0f ? f : -1.0f;
+    f = f < SAMPLE_F32_MAX ? f : SAMPLE_F32_MAX;
+    return (int32_t) lrintf (f * SAMPLE_Q31_SCALE);
+}
+
+static inline float q31_to_float (int32_t v) {
+    return (float) v * (1.0f / SAMPLE_Q31_SCALE);
+}
+
+static inline float f32_from_bits (uint32_t u) {
+    float f;
+    memcpy (&f, &u, sizeof (f));
+    return f;
+}
+
+static inline uint32_t f32_to_bits (float f) {
+    uint32_t u;
+    memcpy (&u, &f, sizeof (u));
+    return u;
+}
+
+// Decoders into Q31
+static inline int32_t ld_U8      (const uint8_t *p) { return (int32_t) ((uint32_t) (p[0] ^ 0x80) << 24); }
+static inline int32_t ld_S16LE   (const uint8_t *p) { return (int32_t) (rd16le (p) << 16); }
+static inline int32_t ld_S16BE   (const uint8_t *p) { return (int32_t) (rd16be (p) << 16); }
+static inline int32_t ld_S24LE   (const uint8_t *p) { return (int32_t) (rd32le (p) << 8); }
+static inline int32_t ld_S24BE   (const uint8_t *p) { return (int32_t) (rd32be (p) << 8); }
+static inline int32_t ld_S24_3LE (const uint8_t *p) { return (int32_t) ((uint32_t) p[0] << 8 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 24); }
+static inline int32_t ld_S24_3BE (const uint8_t *p) { return (int32_t) ((uint32_t) p[2] << 8 | (uint32_t) p[1] << 16 | (uint32_t) p[0] << 24); }
+static inline int32_t ld_S32LE   (const uint8_t *p) { return (int32_t) rd32le (p); }
+static inline int32_t ld_S32BE   (const uint8_t *p) { return (int32_t) rd32be (p); }
+static inline int32_t ld_FloatLE (const uint8_t *p) { return q31_from_float (f32_from_bits (rd32le (p))); }
+static inline int32_t ld_FloatBE (const uint8_t *p) { return q31_from_float (f32_from_bits (rd32be (p))); }
+
+// Encoders from Q31
+static inline void st_U8      (uint8_t *p, int32_t v) { p[0] = (uint8_t) ((v >> 24) + 0x80); }
+static inline void st_S16LE   (uint8_t *p, int32_t v) { wr16le (p, (uint32_t) (v >> 16)); }
+static inline void st_S16BE   (uint8_t *p, int32_t v) { wr16be (p, (uint32_t) (v >> 16)); }
+static inline void st_S24LE   (uint8_t *p, int32_t v) { wr32le (p, (uint32_t) (v >> 8)); }
+static inline void st_S24BE   (uint8_t *p, int32_t v) { wr32be (p, (uint32_t) (v >> 8)); }
+static inline void st_S24_3LE (uint8_t *p, int32_t v) { p[0] = v >> 8; p[1] = v >> 16; p[2] = v >> 24; }
+static inline void st_S24_3BE (uint8_t *p, int32_t v) { p[2] = v >> 8; p[1] = v >> 16; p[0] = v >> 24; }
+static inline void st_S32LE   (uint8_t *p, int32_t v) { wr32le (p, (uint32_t) v); }
+static inline void st_S32BE   (uint8_t *p, int32_t v) { wr32be (p, (uint32_t) v); }
+static inline void st_FloatLE (uint8_t *p, int32_t v) { wr32le (p, f32_to_bits (q31_to_float (v))); }
+static inline void st_FloatBE (uint8_t *p, int32_t v) { wr32be (p, f32_to_bits (q31_to_float (v))); }
+
+#define SAMPLE_SCALAR_KERNELS(FMT, W) \
+    SAMPLE_UNUSED static void scalar_to_s16_##FMT (const uint8_t *src, int16_t *dst, size_t n) { \
+        for (; n; n--, src += W) *dst++ = (int16_t) (ld_##FMT (src) >> 16); \
+    } \
+    SAMPLE_UNUSED static void scalar_from_s16_##FMT (const int16_t *src, uint8_t *dst, size_t n) { \
+        for (; n; n--, dst += W) st_##FMT (dst, (int32_t) ((uint32_t) (uint16_t) *src++ << 16)); \
+    } \
+    SAMPLE_UNUSED static void scalar_to_float_##FMT (const uint8_t *src, float *dst, size_t n) { \
+        for (; n; n--, src += W) *dst++ = q31_to_float (ld_##FMT (src)); \
+    } \
+    SAMPLE_UNUSED static void scalar_from_float_##FMT (const float *src, uint8_t *dst, size_t n) { \
+        for (; n; n--, dst += W) st_##FMT (dst, q31_from_float (*src++)); \
+    }
+
+SAMPLE_SCALAR_KERNELS (U8,      1)
+SAMPLE_SCALAR_KERNELS (S16LE,   2)
+SAMPLE_SCALAR_KERNELS (S16BE,   2)
+SAMPLE_SCALAR_KERNELS (S24LE,   4)
+SAMPLE_SCALAR_KERNELS (S24BE,   4)
+SAMPLE_SCALAR_KERNELS (S24_3LE, 3)
+SAMPLE_SCALAR_KERNELS (S24_3BE, 3)
+SAMPLE_SCALAR_KERNELS (S32LE,   4)
+SAMPLE_SCALAR_KERNELS (S32BE,   4)
+SAMPLE_SCALAR_KERNELS (FloatLE, 4)
+SAMPLE_SCALAR_KERNELS (FloatBE, 4)
+
+// Same format on both sides is a copy or a byte swap, not a Q31 round trip
+static void scalar_copy_s16 (const uint8_t *src, int16_t *dst, size_t n) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy (dst, src, n * sizeof (int16_t));
+#else
+    for (; n; n--, src += 2) *dst++ = (int16_t) rd16le (src);
+#endif
+}
+
+static void scalar_store_s16 (const int16_t *src, uint8_t *dst, size_t n) {
+    for (; n; n--, dst += 2) wr16le (dst, (uint16_t) *src++);
+}
+
+static void scalar_copy_float (const uint8_t *src, float *dst, size_t n) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy (dst, src, n * sizeof (float));
+#else
+    for (; n; n--, src += 4) *dst++ = f32_from_bits (rd32le (src));
+#endif
+}
+
+static void scalar_store_float (const float *src, uint8_t *dst, size_t n) {
+    for (; n; n--, dst += 4) wr32le (dst, f32_to_bits (*src++));
+}
+
+static void scalar_swap_float (const uint8_t *src, float *dst, size_t n) {
+    for (; n; n--, src += 4) *dst++ = f32_from_bits (rd32be (src));
+}
+
+static void scalar_store_swap_float (const float *src, uint8_t *dst, size_t n) {
+    for (; n; n--, dst += 4) wr32be (dst, f32_to_bits (*src++));
+}
+
+static void scalar_mix_s16 (int32_t *acc, const int16_t *src, uint32_t gain, size_t n) {
+    if (gain >= SAMPLE_GAIN_UNITY)
+        for (; n; n--) *acc++ += *src++;
+    else
+        for (; n; n--) *acc++ += (*src++ * (int32_t) gain) >> SAMPLE_GAIN_SHIFT;
+}
+
+static void scalar_clip_s16 (const int32_t *src, int16_t *dst, size_t n) {
+    for (; n; n--, src++) *dst++ = *src > INT16_MAX ? INT16_MAX : (*src < INT16_MIN ? INT16_MIN : (int16_t) *src);
+}
+
+#define SAMPLE_TABLE(T, PREFIX) \
+    (T)->toS16[SampleU8]          = PREFIX##_to_s16_U8; \
+    (T)->toS16[SampleS16BE]       = PREFIX##_to_s16_S16BE; \
+    (T)->toS16[SampleS24LE]       = PREFIX##_to_s16_S24LE; \
+    (T)->toS16[SampleS24BE]       = PREFIX##_to_s16_S24BE; \
+    (T)->toS16[SampleS24_3LE]     = PREFIX##_to_s16_S24_3LE; \
+    (T)->toS16[SampleS24_3BE]     = PREFIX##_to_s16_S24_3BE; \
+    (T)->toS16[SampleS32LE]       = PREFIX##_to_s16_S32LE; \
+    (T)->toS16[SampleS32BE]       = PREFIX##_to_s16_S32BE; \
+    (T)->toS16[SampleFloatLE]     = PREFIX##_to_s16_FloatLE; \
+    (T)->toS16[SampleFloatBE]     = PREFIX##_to_s16_FloatBE; \
+    (T)->fromS16[SampleU8]        = PREFIX##_from_s16_U8; \
+    (T)->fromS16[SampleS16BE]     = PREFIX##_from_s16_S16BE; \
+    (T)->fromS16[SampleS24LE]     = PREFIX##_from_s16_S24LE; \
+    (T)->fromS16[SampleS24BE]     = PREFIX##_from_s16_S24BE; \
+    (T)->fromS16[SampleS24_3LE]   = PREFIX##_from_s16_S24_3LE; \
+    (T)->fromS16[SampleS24_3BE]   = PREFIX##_from_s16_S24_3BE; \
+    (T)->fromS16[SampleS32LE]     = PREFIX##_from_s16_S32LE; \
+    (T)->fromS16[SampleS32BE]     = PREFIX##_from_s16_S32BE; \
+    (T)->fromS16[SampleFloatLE]   = PREFIX##_from_s16_FloatLE; \
+    (T)->fromS16[SampleFloatBE]   = PREFIX##_from_s16_FloatBE; \
+    (T)->toFloat[SampleU8]        = PREFIX##_to_float_U8; \
+    (T)->toFloat[SampleS16LE]     = PREFIX##_to_float_S16LE; \
+    (T)->toFloat[SampleS16BE]     = PREFIX##_to_float_S16BE; \
+    (T)->toFloat[SampleS24LE]     = PREFIX##_to_float_S24LE; \
+    (T)->toFloat[SampleS24BE]     = PREFIX##_to_float_S24BE; \
+    (T)->toFloat[SampleS24_3LE]   = PREFIX##_to_float_S24_3LE; \
+    (T)->toFloat[SampleS24_3BE]   = PREFIX##_to_float_S24_3BE; \
+    (T)->toFloat[SampleS32LE]     = PREFIX##_to_float_S32LE; \
+    (T)->toFloat[SampleS32BE]     = PREFIX##_to_float_S32BE; \
+    (T)->fromFloat[SampleU8]      = PREFIX##_from_float_U8; \
+    (T)->fromFloat[SampleS16LE]   = PREFIX##_from_float_S16LE; \
+    (T)->fromFloat[SampleS16BE]   = PREFIX##_from_float_S16BE; \
+    (T)->fromFloat[SampleS24LE]   = PREFIX##_from_float_S24LE; \
+    (T)->fromFloat[SampleS24BE]   = PREFIX##_from_float_S24BE; \
+    (T)->fromFloat[SampleS24_3LE] = PREFIX##_from_float_S24_3LE; \
+    (T)->fromFloat[SampleS24_3BE] = PREFIX##_from_float_S24_3BE; \
+    (T)->fromFloat[SampleS32LE]   = PREFIX##_from_float_S32LE; \
+    (T)->fromFloat[SampleS32BE]   = PREFIX##_from_float_S32BE;
+
+/*
+ * Vector kernels: LD_<fmt> loads LANES samples as Q31 lanes, ST_<fmt>
+ * stores them. Packed 24 bit loads read 4 bytes past the last sample,
+ * so they stop SAMPLE_SLACK samples early and leave the rest to scalar.
+ */
+#define SAMPLE_SLACK        2
+
+#define SAMPLE_VECTOR_KERNELS(ISA, ATTR, LANES, FMT, W, SLACK) \
+    SAMPLE_UNUSED ATTR static void ISA##_to_s16_##FMT (const uint8_t *src, int16_t *dst, size_t n) { \
+        for (; n >= LANES + SLACK; n -= LANES, src += LANES * W, dst += LANES) \
+            ISA##_st_S16LE ((uint8_t *) dst, ISA##_ld_##FMT (src)); \
+        scalar_to_s16_##FMT (src, dst, n); \
+    } \
+    SAMPLE_UNUSED ATTR static void ISA##_from_s16_##FMT (const int16_t *src, uint8_t *dst, size_t n) { \
+        for (; n >= LANES + SLACK; n -= LANES, src += LANES, dst += LANES * W) \
+            ISA##_st_##FMT (dst, ISA##_ld_S16LE ((const uint8_t *) src)); \
+        scalar_from_s16_##FMT (src, dst, n); \
+    } \
+    SAMPLE_UNUSED ATTR static void ISA##_to_float_##FMT (const uint8_t *src, float *dst, size_t n) { \
+        for (; n >= LANES + SLACK; n -= LANES, src += LANES * W, dst += LANES) \
+            ISA##_st_FloatLE ((uint8_t *) dst, ISA##_ld_##FMT (src)); \
+        scalar_to_float_##FMT (src, dst, n); \
+    } \
+    SAMPLE_UNUSED ATTR static void ISA##_from_float_##FMT (const float *src, uint8_t *dst, size_t n) { \
+        for (; n >= LANES + SLACK; n -= LANES, src += LANES, dst += LANES * W) \
+            ISA##_st_##FMT (dst, ISA##_ld_FloatLE ((const uint8_t *) src)); \
+        scalar_from_float_##FMT (src, dst, n); \
+    }
+
+#define SAMPLE_VECTOR_ALL(ISA, ATTR, LANES) \
+    SAMPLE_VECTOR_KERNELS (ISA, ATTR, LANES, U8,      1, 0) \
+    SAMPLE_VECTOR_KERNELS (ISA, ATTR, LANES, S16LE,   2, 0) \
+    SAMPLE_VECTOR_KERNELS (ISA, ATTR, LANES, S16BE,   2, 0) \
+    SAMPLE_VECTOR_KERNELS (ISA, ATTR, LANES, S24LE,   4, 0) \
+    SAMPLE_VECTOR_KERNELS (ISA, ATTR, LANES, S24BE,   4, 0) \
+    SAMPLE_VECTOR_KERNELS (ISA, ATTR, LANES, S24_3LE, 3, SAMPLE_SLACK) \
+    SAMPLE_VECTOR_KERNELS (ISA, ATTR, LANES, S24_3BE, 3, SAMPLE_SLACK) \
+    SAMPLE_VECTOR_KERNELS (ISA, ATTR, LANES, S32LE,   4, 0) \
+    SAMPLE_VECTOR_KERNELS (ISA, ATTR, LANES, S32BE,   4, 0) \
+    SAMPLE_VECTOR_KERNELS (ISA, ATTR, LANES, FloatLE, 4, 0) \
+    SAMPLE_VECTOR_KERNELS (ISA, ATTR, LANES, FloatBE, 4, 0)
+
+#if defined(SAMPLE_X86)
+/***********************
+ *  SSE2 (4 lanes)
+ ***********************/
+#define SSE2_ATTR
+
+static inline __m128i sse2_swap16 (__m128i v) {
+    return _mm_or_si128 (_mm_slli_epi16 (v, 8), _mm_srli_epi16 (v, 8));
+}
+
+static inline __m128i sse2_swap32 (__m128i v) {
+    v = sse2_swap16 (v);
+    return _mm_shufflehi_epi16 (_mm_shufflelo_epi16 (v, 0xB1), 0xB1);
+}
+
+static inline __m128i sse2_from_float (__m128 f) {
+    f = _mm_min_ps (_mm_max_ps (f, _mm_set1_ps (-1.0f)), _mm_set1_ps (SAMPLE_F32_MAX));
+    return _mm_cvtps_epi32 (_mm_mul_ps (f, _mm_set1_ps (SAMPLE_Q31_SCALE)));
+}
+
+static inline __m128 sse2_to_float (__m128i v) {
+    return _mm_mul_ps (_mm_cvtepi32_ps (v), _mm_set1_ps (1.0f / SAMPLE_Q31_SCALE));
+}
+
+static inline __m128i sse2_ld_U8 (const uint8_t *p) {
+    int32_t w;
+    __m128i v, z = _mm_setzero_si128 ();
+    memcpy (&w, p, sizeof (w));
+    v = _mm_unpacklo_epi16 (_mm_unpacklo_epi8 (_mm_cvtsi32_si128 (w), z), z);
+    return _mm_slli_epi32 (_mm_xor_si128 (v, _mm_set1_epi32 (0x80)), 24);
+}
+
+static inline void sse2_st_U8 (uint8_t *p, __m128i v) {
+    int32_t w;
+    v = _mm_add_epi32 (_mm_srai_epi32 (v, 24), _mm_set1_epi32 (0x80));
+    v = _mm_packs_epi32 (v, v);
+    w = _mm_cvtsi128_si32 (_mm_packus_epi16 (v, v));
+    memcpy (p, &w, sizeof (w));
+}
+
+static inline __m128i sse2_ld_S16LE (const uint8_t *p) {
+    return _mm_unpacklo_epi16 (_mm_setzero_si128 (), _mm_loadl_epi64 ((const __m128i *) p));
+}
+
+static inline __m128i sse2_ld_S16BE (const uint8_t *p) {
+    return _mm_unpacklo_epi16 (_mm_setzero_si128 (), sse2_swap16 (_mm_loadl_epi64 ((const __m128i *) p)));
+}
+
+static inline void sse2_st_S16LE (uint8_t *p, __m128i v) {
+    v = _mm_srai_epi32 (v, 16);
+    _mm_storel_epi64 ((__m128i *) p, _mm_packs_epi32 (v, v));
+}
+
+static inline void sse2_st_S16BE (uint8_t *p, __m128i v) {
+    v = _mm_srai_epi32 (v, 16);
+    _mm_storel_epi64 ((__m128i *) p, sse2_swap16 (_mm_packs_epi32 (v, v)));
+}
+
+static inline __m128i sse2_ld_S24LE (const uint8_t *p) {
+    return _mm_slli_epi32 (_mm_loadu_si128 ((const __m128i *) p), 8);
+}
+
+static inline __m128i sse2_ld_S24BE (const uint8_t *p) {
+    return _mm_slli_epi32 (sse2_swap32 (_mm_loadu_si128 ((const __m128i *) p)), 8);
+}
+
+static inline void sse2_st_S24LE (uint8_t *p, __m128i v) {
+    _mm_storeu_si128 ((__m128i *) p, _mm_srai_epi32 (v, 8));
+}
+
+static inline void sse2_st_S24BE (uint8_t *p, __m128i v) {
+    _mm_storeu_si128 ((__m128i *) p, sse2_swap32 (_mm_srai_epi32 (v, 8)));
+}
+
+// No byte shuffle before SSSE3, packed 24 bit goes through general registers
+static inline __m128i sse2_ld_S24_3LE (const uint8_t *p) {
+    return _mm_set_epi32 (ld_S24_3LE (p + 9), ld_S24_3LE (p + 6), ld_S24_3LE (p + 3), ld_S24_3LE (p));
+}
+
+static inline __m128i sse2_ld_S24_3BE (const uint8_t *p) {
+    return _mm_set_epi32 (ld_S24_3BE (p + 9), ld_S24_3BE (p + 6), ld_S24_3BE (p + 3), ld_S24_3BE (p));
+}
+
+static inline void sse2_st_S24_3LE (uint8_t *p, __m128i v) {
+    int32_t q[4];
+    _mm_storeu_si128 ((__m128i *) q, v);
+    st_S24_3LE (p, q[0]); st_S24_3LE (p + 3, q[1]); st_S24_3LE (p + 6, q[2]); st_S24_3LE (p + 9, q[3]);
+}
+
+static inline void sse2_st_S24_3BE (uint8_t *p, __m128i v) {
+    int32_t q[4];
+    _mm_storeu_si128 ((__m128i *) q, v);
+    st_S24_3BE (p, q[0]); st_S24_3BE (p + 3, q[1]); st_S24_3BE (p + 6, q[2]); st_S24_3BE (p + 9, q[3]);
+}
+
+static inline __m128i sse2_ld_S32LE (const uint8_t *p) {
+    return _mm_loadu_si128 ((const __m128i *) p);
+}
+
+static inline __m128i sse2_ld_S32BE (const uint8_t *p) {
+    return sse2_swap32 (_mm_loadu_si128 ((const __m128i *) p));
+}
+
+static inline void sse2_st_S32LE (uint8_t *p, __m128i v) {
+    _mm_storeu_si128 ((__m128i *) p, v);
+}
+
+static inline void sse2_st_S32BE (uint8_t *p, __m128i v) {
+    _mm_storeu_si128 ((__m128i *) p, sse2_swap32 (v));
+}
+
+static inline __m128i sse2_ld_FloatLE (const uint8_t *p) {
+    return sse2_from_float (_mm_loadu_ps ((const float *) p));
+}
+
+static inline __m128i sse2_ld_FloatBE (const uint8_t *p) {
+    return sse2_from_float (_mm_castsi128_ps (sse2_swap32 (_mm_loadu_si128 ((const __m128i *) p))));
+}
+
+static inline void sse2_st_FloatLE (uint8_t *p, __m128i v) {
+    _mm_storeu_ps ((float *) p, sse2_to_float (v));
+}
+
+static inline void sse2_st_FloatBE (uint8_t *p, __m128i v) {
+    _mm_storeu_si128 ((__m128i *) p, sse2_swap32 (_mm_castps_si128 (sse2_to_float (v))));
+}
+
+// Signed x unsigned high half: the unsigned product overshoots by gain for negative samples
+static inline __m128i sse2_gain16 (__m128i s, __m128i g) {
+    return _mm_sub_epi16 (_mm_mulhi_epu16 (s, g), _mm_and_si128 (_mm_srai_epi16 (s, 15), g));
+}
+
+static void sse2_mix_s16 (int32_t *acc, const int16_t *src, uint32_t gain, size_t n) {
+    __m128i s, g = _mm_set1_epi16 ((int16_t) gain);
+    int unity = gain >= SAMPLE_GAIN_UNITY;
+
+    for (; n >= 8; n -= 8, src += 8, acc += 8) {
+        s = _mm_loadu_si128 ((const __m128i *) src);
+        if (!unity)
+            s = sse2_gain16 (s, g);
+        _mm_storeu_si128 ((__m128i *) acc, _mm_add_epi32 (_mm_loadu_si128 ((const __m128i *) acc), _mm_srai_epi32 (_mm_unpacklo_epi16 (s, s), 16)));
+        _mm_storeu_si128 ((__m128i *) (acc + 4), _mm_add_epi32 (_mm_loadu_si128 ((const __m128i *) (acc + 4)), _mm_srai_epi32 (_mm_unpackhi_epi16 (s, s), 16)));
+    }
+    scalar_mix_s16 (acc, src, gain, n);
+}
+
+static void sse2_clip_s16 (const int32_t *src, int16_t *dst, size_t n) {
+    for (; n >= 8; n -= 8, src += 8, dst += 8)
+        _mm_storeu_si128 ((__m128i *) dst, _mm_packs_epi32 (_mm_loadu_si128 ((const __m128i *) src), _mm_loadu_si128 ((const __m128i *) (src + 4))));
+    scalar_clip_s16 (src, dst, n);
+}
+
+SAMPLE_VECTOR_ALL (sse2, SSE2_ATTR, 4)
+
+/***********************
+ *  AVX2 (8 lanes)
+ ***********************/
+#define AVX2_SHUFFLE_SWAP16 \
+    _mm256_setr_epi8 (1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14, \
+                      1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14)
+#define AVX2_SHUFFLE_SWAP32 \
+    _mm256_setr_epi8 (3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12, \
+                      3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12)
+// 4 packed 24 bit samples of a 128 bit lane into Q31 and back
+#define AVX2_SHUFFLE_LD24LE \
+    _mm_setr_epi8 (-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11)
+#define AVX2_SHUFFLE_LD24BE \
+    _mm_setr_epi8 (-1, 2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9)
+#define AVX2_SHUFFLE_ST24LE \
+    _mm_setr_epi8 (1, 2, 3, 5, 6, 7, 9, 10, 11, 13, 14, 15, -1, -1, -1, -1)
+#define AVX2_SHUFFLE_ST24BE \
+    _mm_setr_epi8 (3, 2, 1, 7, 6, 5, 11, 10, 9, 15, 14, 13, -1, -1, -1, -1)
+
+SAMPLE_AVX2 static inline __m256i avx2_from_float (__m256 f) {
+    f = _mm256_min_ps (_mm256_max_ps (f, _mm256_set1_ps (-1.0f)), _mm256_set1_ps (SAMPLE_F32_MAX));
+    return _mm256_cvtps_epi32 (_mm256_mul_ps (f, _mm256_set1_ps (SAMPLE_Q31_SCALE)));
+}
+
+SAMPLE_AVX2 static inline __m256 avx2_to_float (__m256i v) {
+    return _mm256_mul_ps (_mm256_cvtepi32_ps (v), _mm256_set1_ps (1.0f / SAMPLE_Q31_SCALE));
+}
+
+SAMPLE_AVX2 static inline __m128i avx2_pack16 (__m256i v) {
+    v = _mm256_srai_epi32 (v, 16);
+    return _mm_packs_epi32 (_mm256_castsi256_si128 (v), _mm256_extracti128_si256 (v, 1));
+}
+
+SAMPLE_AVX2 static inline void avx2_store24 (uint8_t *p, __m128i v) {
+    _mm_storel_epi64 ((__m128i *) p, v);
+    int32_t w = _mm_cvtsi128_si32 (_mm_srli_si128 (v, 8));
+    memcpy (p + 8, &w, sizeof (w));
+}
+
+SAMPLE_AVX2 static inline __m256i avx2_ld_U8 (const uint8_t *p) {
+    __m256i v = _mm256_cvtepu8_epi32 (_mm_loadl_epi64 ((const __m128i *) p));
+    return _mm256_slli_epi32 (_mm256_xor_si256 (v, _mm256_set1_epi32 (0x80)), 24);
+}
+
+SAMPLE_AVX2 static inline void avx2_st_U8 (uint8_t *p, __m256i v) {
+    __m128i h;
+    v = _mm256_add_epi32 (_mm256_srai_epi32 (v, 24), _mm256_set1_epi32 (0x80));
+    h = _mm_packs_epi32 (_mm256_castsi256_si128 (v), _mm256_extracti128_si256 (v, 1));
+    _mm_storel_epi64 ((__m128i *) p, _mm_packus_epi16 (h, h));
+}
+
+SAMPLE_AVX2 static inline __m256i avx2_ld_S16LE (const uint8_t *p) {
+    return _mm256_slli_epi32 (_mm256_cvtepi16_epi32 (_mm_loadu_si128 ((const __m128i *) p)), 16);
+}
+
+SAMPLE_AVX2 static inline __m256i avx2_ld_S16BE (const uint8_t *p) {
+    __m128i v = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *) p), _mm256_castsi256_si128 (AVX2_SHUFFLE_SWAP16));
+    return _mm256_slli_epi32 (_mm256_cvtepi16_epi32 (v), 16);
+}
+
+SAMPLE_AVX2 static inline void avx2_st_S16LE (uint8_t *p, __m256i v) {
+    _mm_storeu_si128 ((__m128i *) p, avx2_pack16 (v));
+}
+
+SAMPLE_AVX2 static inline void avx2_st_S16BE (uint8_t *p, __m256i v) {
+    _mm_storeu_si128 ((__m128i *) p, _mm_shuffle_epi8 (avx2_pack16 (v), _mm256_castsi256_si128 (AVX2_SHUFFLE_SWAP16)));
+}
+
+SAMPLE_AVX2 static inline __m256i avx2_ld_S24LE (const uint8_t *p) {
+    return _mm256_slli_epi32 (_mm256_loadu_si256 ((const __m256i *) p), 8);
+}
+
+SAMPLE_AVX2 static inline __m256i avx2_ld_S24BE (const uint8_t *p) {
+    return _mm256_slli_epi32 (_mm256_shuffle_epi8 (_mm256_loadu_si256 ((const __m256i *) p), AVX2_SHUFFLE_SWAP32), 8);
+}
+
+SAMPLE_AVX2 static inline void avx2_st_S24LE (uint8_t *p, __m256i v) {
+    _mm256_storeu_si256 ((__m256i *) p, _mm256_srai_epi32 (v, 8));
+}
+
+SAMPLE_AVX2 static inline void avx2_st_S24BE (uint8_t *p, __m256i v) {
+    _mm256_storeu_si256 ((__m256i *) p, _mm256_shuffle_epi8 (_mm256_srai_epi32 (v, 8), AVX2_SHUFFLE_SWAP32));
+}
+
+SAMPLE_AVX2 static inline __m256i avx2_ld_S24_3LE (const uint8_t *p) {
+    __m128i lo = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *) p), AVX2_SHUFFLE_LD24LE);
+    __m128i hi = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *) (p + 12)), AVX2_SHUFFLE_LD24LE);
+    return _mm256_inserti128_si256 (_mm256_castsi128_si256 (lo), hi, 1);
+}
+
+SAMPLE_AVX2 static inline __m256i avx2_ld_S24_3BE (const uint8_t *p) {
+    __m128i lo = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *) p), AVX2_SHUFFLE_LD24BE);
+    __m128i hi = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *) (p + 12)), AVX2_SHUFFLE_LD24BE);
+    return _mm256_inserti128_si256 (_mm256_castsi128_si256 (lo), hi, 1);
+}
+
+SAMPLE_AVX2 static inline void avx2_st_S24_3LE (uint8_t *p, __m256i v) {
+    avx2_store24 (p, _mm_shuffle_epi8 (_mm256_castsi256_si128 (v), AVX2_SHUFFLE_ST24LE));
+    avx2_store24 (p + 12, _mm_shuffle_epi8 (_mm256_extracti128_si256 (v, 1), AVX2_SHUFFLE_ST24LE));
+}
+
+SAMPLE_AVX2 static inline void avx2_st_S24_3BE (uint8_t *p, __m256i v) {
+    avx2_store24 (p, _mm_shuffle_epi8 (_mm256_castsi256_si128 (v), AVX2_SHUFFLE_ST24BE));
+    avx2_store24 (p + 12, _mm_shuffle_epi8 (_mm256_extracti128_si256 (v, 1), AVX2_SHUFFLE_ST24BE));
+}
+
+SAMPLE_AVX2 static inline __m256i avx2_ld_S32LE (const uint8_t *p) {
+    return _mm256_loadu_si256 ((const __m256i *) p);
+}
+
+SAMPLE_AVX2 static inline __m256i avx2_ld_S32BE (const uint8_t *p) {
+    return _mm256_shuffle_epi8 (_mm256_loadu_si256 ((const __m256i *) p), AVX2_SHUFFLE_SWAP32);
+}
+
+SAMPLE_AVX2 static inline void avx2_st_S32LE (uint8_t *p, __m256i v) {
+    _mm256_storeu_si256 ((__m256i *) p, v);
+}
+
+SAMPLE_AVX2 static inline void avx2_st_S32BE (uint8_t *p, __m256i v) {
+    _mm256_storeu_si256 ((__m256i *) p, _mm256_shuffle_epi8 (v, AVX2_SHUFFLE_SWAP32));
+}
+
+SAMPLE_AVX2 static inline __m256i avx2_ld_FloatLE (const uint8_t *p) {
+    return avx2_from_float (_mm256_loadu_ps ((const float *) p));
+}
+
+SAMPLE_AVX2 static inline __m256i avx2_ld_FloatBE (const uint8_t *p) {
+    __m256i v = _mm256_shuffle_epi8 (_mm256_loadu_si256 ((const __m256i *) p), AVX2_SHUFFLE_SWAP32);
+    return avx2_from_float (_mm256_castsi256_ps (v));
+}
+
+SAMPLE_AVX2 static inline void avx2_st_FloatLE (uint8_t *p, __m256i v) {
+    _mm256_storeu_ps ((float *) p, avx2_to_float (v));
+}
+
+SAMPLE_AVX2 static inline void avx2_st_FloatBE (uint8_t *p, __m256i v) {
+    _mm256_storeu_si256 ((__m256i *) p, _mm256_shuffle_epi8 (_mm256_castps_si256 (avx2_to_float (v)), AVX2_SHUFFLE_SWAP32));
+}
+
+SAMPLE_AVX2 static void avx2_mix_s16 (int32_t *acc, const int16_t *src, uint32_t gain, size_t n) {
+    __m128i s, g = _mm_set1_epi16 ((int16_t) gain);
+    int unity = gain >= SAMPLE_GAIN_UNITY;
+
+    for (; n >= 8; n -= 8, src += 8, acc += 8) {
+        s = _mm_loadu_si128 ((const __m128i *) src);
+        if (!unity)
+            s = sse2_gain16 (s, g);
+        _mm256_storeu_si256 ((__m256i *) acc, _mm256_add_epi32 (_mm256_loadu_si256 ((const __m256i *) acc), _mm256_cvtepi16_epi32 (s)));
+    }
+    scalar_mix_s16 (acc, src, gain, n);
+}
+
+SAMPLE_AVX2 static void avx2_clip_s16 (const int32_t *src, int16_t *dst, size_t n) {
+    __m256i v;
+
+    for (; n >= 16; n -= 16, src += 16, dst += 16) {
+        v = _mm256_packs_epi32 (_mm256_loadu_si256 ((const __m256i *) src), _mm256_loadu_si256 ((const __m256i *) (src + 8)));
+        _mm256_storeu_si256 ((__m256i *) dst, _mm256_permute4x64_epi64 (v, 0xD8));
+    }
+    scalar_clip_s16 (src, dst, n);
+}
+
+SAMPLE_VECTOR_ALL (avx2, SAMPLE_AVX2, 8)
+
+#elif defined(SAMPLE_NEON)
+/***********************
+ *  NEON (4 lanes)
+ ***********************/
+#define NEON_ATTR
+
+static const uint8_t neonLd24LE[16] = { 0xFF, 0, 1, 2, 0xFF, 3, 4, 5, 0xFF, 6, 7, 8, 0xFF, 9, 10, 11 };
+static const uint8_t neonLd24BE[16] = { 0xFF, 2, 1, 0, 0xFF, 5, 4, 3, 0xFF, 8, 7, 6, 0xFF, 11, 10, 9 };
+static const uint8_t neonSt24LE[16] = { 1, 2, 3, 5, 6, 7, 9, 10, 11, 13, 14, 15, 0xFF, 0xFF, 0xFF, 0xFF };
+static const uint8_t neonSt24BE[16] = { 3, 2, 1, 7, 6, 5, 11, 10, 9, 15, 14, 13, 0xFF, 0xFF, 0xFF, 0xFF };
+
+static inline int32x4_t neon_from_float (float32x4_t f) {
+    f = vminnmq_f32 (vmaxnmq_f32 (f, vdupq_n_f32 (-1.0f)), vdupq_n_f32 (SAMPLE_F32_MAX));
+    return vcvtnq_s32_f32 (vmulq_n_f32 (f, SAMPLE_Q31_SCALE));
+}
+
+static inline float32x4_t neon_to_float (int32x4_t v) {
+    return vmulq_n_f32 (vcvtq_f32_s32 (v), 1.0f / SAMPLE_Q31_SCALE);
+}
+
+static inline int32x4_t neon_swap32 (int32x4_t v) {
+    return vreinterpretq_s32_u8 (vrev32q_u8 (vreinterpretq_u8_s32 (v)));
+}
+
+static inline void neon_store24 (uint8_t *p, uint8x16_t v) {
+    vst1_u8 (p, vget_low_u8 (v));
+    uint32_t w = vgetq_lane_u32 (vreinterpretq_u32_u8 (v), 2);
+    memcpy (p + 8, &w, sizeof (w));
+}
+
+static inline int32x4_t neon_ld_U8 (const uint8_t *p) {
+    uint32_t w;
+    memcpy (&w, p, sizeof (w));
+    uint16x8_t h = vmovl_u8 (vreinterpret_u8_u32 (vdup_n_u32 (w)));
+    int32x4_t v = vreinterpretq_s32_u32 (vmovl_u16 (vget_low_u16 (h)));
+    return vshlq_n_s32 (veorq_s32 (v, vdupq_n_s32 (0x80)), 24);
+}
+
+static inline void neon_st_U8 (uint8_t *p, int32x4_t v) {
+    int16x4_t h = vmovn_s32 (vaddq_s32 (vshrq_n_s32 (v, 24), vdupq_n_s32 (0x80)));
+    uint8x8_t b = vqmovun_s16 (vcombine_s16 (h, h));
+    uint32_t w = vget_lane_u32 (vreinterpret_u32_u8 (b), 0);
+    memcpy (p, &w, sizeof (w));
+}
+
+static inline int32x4_t neon_ld_S16LE (const uint8_t *p) {
+    return vshll_n_s16 (vreinterpret_s16_u8 (vld1_u8 (p)), 16);
+}
+
+static inline int32x4_t neon_ld_S16BE (const uint8_t *p) {
+    return vshll_n_s16 (vreinterpret_s16_u8 (vrev16_u8 (vld1_u8 (p))), 16);
+}
+
+static inline void neon_st_S16LE (uint8_t *p, int32x4_t v) {
+    vst1_u8 (p, vreinterpret_u8_s16 (vshrn_n_s32 (v, 16)));
+}
+
+static inline void neon_st_S16BE (uint8_t *p, int32x4_t v) {
+    vst1_u8 (p, vrev16_u8 (vreinterpret_u8_s16 (vshrn_n_s32 (v, 16))));
+}
+
+static inline int32x4_t neon_ld_S24LE (const uint8_t *p) {
+    return vshlq_n_s32 (vreinterpretq_s32_u8 (vld1q_u8 (p)), 8);
+}
+
+static inline int32x4_t neon_ld_S24BE (const uint8_t *p) {
+    return vshlq_n_s32 (vreinterpretq_s32_u8 (vrev32q_u8 (vld1q_u8 (p))), 8);
+}
+
+static inline void neon_st_S24LE (uint8_t *p, int32x4_t v) {
+    vst1q_u8 (p, vreinterpretq_u8_s32 (vshrq_n_s32 (v, 8)));
+}
+
+static inline void neon_st_S24BE (uint8_t *p, int32x4_t v) {
+    vst1q_u8 (p, vreinterpretq_u8_s32 (neon_swap32 (vshrq_n_s32 (v, 8))));
+}
+
+static inline int32x4_t neon_ld_S24_3LE (const uint8_t *p) {
+    return vreinterpretq_s32_u8 (vqtbl1q_u8 (vld1q_u8 (p), vld1q_u8 (neonLd24LE)));
+}
+
+static inline int32x4_t neon_ld_S24_3BE (const uint8_t *p) {
+    return vreinterpretq_s32_u8 (vqtbl1q_u8 (vld1q_u8 (p), vld1q_u8 (neonLd24BE)));
+}
+
+static inline void neon_st_S24_3LE (uint8_t *p, int32x4_t v) {
+    neon_store24 (p, vqtbl1q_u8 (vreinterpretq_u8_s32 (v), vld1q_u8 (neonSt24LE)));
+}
+
+static inline void neon_st_S24_3BE (uint8_t *p, int32x4_t v) {
+    neon_store24 (p, vqtbl1q_u8 (vreinterpretq_u8_s32 (v), vld1q_u8 (neonSt24BE)));
+}
+
+static inline int32x4_t neon_ld_S32LE (const uint8_t *p) {
+    return vreinterpretq_s32_u8 (vld1q_u8 (p));
+}
+
+static inline int32x4_t neon_ld_S32BE (const uint8_t *p) {
+    return vreinterpretq_s32_u8 (vrev32q_u8 (vld1q_u8 (p)));
+}
+
+static inline void neon_st_S32LE (uint8_t *p, int32x4_t v) {
+    vst1q_u8 (p, vreinterpretq_u8_s32 (v));
+}
+
+static inline void neon_st_S32BE (uint8_t *p, int32x4_t v) {
+    vst1q_u8 (p, vreinterpretq_u8_s32 (neon_swap32 (v)));
+}
+
+static inline int32x4_t neon_ld_FloatLE (const uint8_t *p) {
+    return neon_from_float (vreinterpretq_f32_u8 (vld1q_u8 (p)));
+}
+
+static inline int32x4_t neon_ld_FloatBE (const uint8_t *p) {
+    return neon_from_float (vreinterpretq_f32_u8 (vrev32q_u8 (vld1q_u8 (p))));
+}
+
+static inline void neon_st_FloatLE (uint8_t *p, int32x4_t v) {
+    vst1q_u8 (p, vreinterpretq_u8_f32 (neon_to_float (v)));
+}
+
+static inline void neon_st_FloatBE (uint8_t *p, int32x4_t v) {
+    vst1q_u8 (p, vrev32q_u8 (vreinterpretq_u8_f32 (neon_to_float (v))));
+}
+
+static void neon_mix_s16 (int32_t *acc, const int16_t *src, uint32_t gain, size_t n) {
+    int32x4_t s;
+    int unity = gain >= SAMPLE_GAIN_UNITY;
+
+    for (; n >= 4; n -= 4, src += 4, acc += 4) {
+        s = vmovl_s16 (vld1_s16 (src));
+        if (!unity)
+            s = vshrq_n_s32 (vmulq_n_s32 (s, (int32_t) gain), SAMPLE_GAIN_SHIFT);
+        vst1q_s32 (acc, vaddq_s32 (vld1q_s32 (acc), s));
+    }
+    scalar_mix_s16 (acc, src, gain, n);
+}
+
+static void neon_clip_s16 (const int32_t *src, int16_t *dst, size_t n) {
+    for (; n >= 4; n -= 4, src += 4, dst += 4)
+        vst1_s16 (dst, vqmovn_s32 (vld1q_s32 (src)));
+    scalar_clip_s16 (src, dst, n);
+}
+
+SAMPLE_VECTOR_ALL (neon, NEON_ATTR, 4)
+#endif
+
+/**
+ * @brief Converts samples of any supported format to native S16
+ *
+ * @param format source format
+ * @param src source samples
+ * @param dst destination buffer
+ * @param samples number of samples (frames * channels)
+ * @return int 0 or -EINVAL on unsupported format
+ */
+int sample_to_s16 (snd_pcm_format_t format, const void *src, int16_t *dst, size_t samples) {
+    int i = sample_index (format);
+    if (i < 0)
+        return -EINVAL;
+
+    pthread_once (&initOnce, sample_init);
+    kernels->toS16[i] ((const uint8_t *) src, dst, samples);
+    return 0;
+}
+
+int sample_from_s16 (snd_pcm_format_t format, const int16_t *src, void *dst, size_t samples) {
+    int i = sample_index (format);
+    if (i < 0)
+        return -EINVAL;
+
+    pthread_once (&initOnce, sample_init);
+    kernels->fromS16[i] (src, (uint8_t *) dst, samples);
+    return 0;
+}
+
+/**
+ * @brief Converts samples of any supported format to native float [-1.0, 1.0)
+ */
+int sample_to_float (snd_pcm_format_t format, const void *src, float *dst, size_t samples) {
+    int i = sample_index (format);
+    if (i < 0)
+        return -EINVAL;
+
+    pthread_once (&initOnce, sample_init);
+    kernels->toFloat[i] ((const uint8_t *) src, dst, samples);
+    return 0;
+}
+
+int sample_from_float (snd_pcm_format_t format, const float *src, void *dst, size_t samples) {
+    int i = sample_index (format);
+    if (i < 0)
+        return -EINVAL;
+
+    pthread_once (&initOnce, sample_init);
+    kernels->fromFloat[i] (src, (uint8_t *) dst, samples);
+    return 0;
+}
+
+/**
+ * @brief Adds samples scaled by a gain to a mix accumulator
+ *
+ * @param acc accumulator
+ * @param src native S16 samples
+ * @param gain SAMPLE_GAIN_SHIFT fixed point, SAMPLE_GAIN_UNITY at most
+ * @param samples number of samples (frames * channels)
+ */
+void sample_mix_s16 (int32_t *acc, const int16_t *src, uint32_t gain, size_t samples) {
+    pthread_once (&initOnce, sample_init);
+    kernels->mix (acc, src, gain, samples);
+}
+
+/**
+ * @brief Saturates a mix accumulator to native S16
+ */
+void sample_clip_s16 (const int32_t *src, int16_t *dst, size_t samples) {
+    pthread_once (&initOnce, sample_init);
+    kernels->clip (src, dst, samples);
+}
+
+/**
+ * @brief Bytes per sample or -EINVAL
+ */
+int sample_width (snd_pcm_format_t format) {
+    int i = sample_index (format);
+    return i < 0 ? -EINVAL : widths[i];
+}
+
+/**
+ * @brief Selects vector or scalar kernels
+ *
+ * @param enable FALSE forces the scalar path
+ * @return int previous state
+ */
+int sample_set_simd (int enable) {
+    int prev;
+
+    pthread_once (&initOnce, sample_init);
+    prev = kernels == &vector;
+    kernels = enable ? &vector : &scalar;
+    return prev;
+}
+
+const char * sample_simd_name () {
+    pthread_once (&initOnce, sample_init);
+    return kernels->name;
+}
+
+static void sample_init () {
+    SAMPLE_TABLE (&scalar, scalar)
+    scalar.toS16[SampleS16LE]       = scalar_copy_s16;
+    scalar.fromS16[SampleS16LE]     = scalar_store_s16;
+    scalar.toFloat[SampleFloatLE]   = scalar_copy_float;
+    scalar.toFloat[SampleFloatBE]   = scalar_swap_float;
+    scalar.fromFloat[SampleFloatLE] = scalar_store_float;
+    scalar.fromFloat[SampleFloatBE] = scalar_store_swap_float;
+    scalar.mix                      = scalar_mix_s16;
+    scalar.clip                     = scalar_clip_s16;
+
+    vector = scalar;
+
+#if defined(SAMPLE_X86)
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx2")) {
+        SAMPLE_TABLE (&vector, avx2)
+        vector.mix = avx2_mix_s16;
+        vector.clip = avx2_clip_s16;
+        vector.name = "avx2";
+    } else {
+        SAMPLE_TABLE (&vector, sse2)
+        vector.mix = sse2_mix_s16;
+        vector.clip = sse2_clip_s16;
+        vector.name = "sse2";
+    }
+#elif defined(SAMPLE_NEON)
+    SAMPLE_TABLE (&vector, neon)
+    vector.mix = neon_mix_s16;
+    vector.clip = neon_clip_s16;
+    vector.name = "neon";
+#endif
+
+    kernels = &vector;
+}
+
+static int sample_index (snd_pcm_format_t format) {
+    switch (format) {
+        case SND_PCM_FORMAT_U8:         return SampleU8;
+        case SND_PCM_FORMAT_S16_LE:     return SampleS16LE;
+        case SND_PCM_FORMAT_S16_BE:     return SampleS16BE;
+        case SND_PCM_FORMAT_S24_LE:     return SampleS24LE;
+        case SND_PCM_FORMAT_S24_BE:     return SampleS24BE;
+        case SND_PCM_FORMAT_S24_3LE:    return SampleS24_3LE;
+        case SND_PCM_FORMAT_S24_3BE:    return SampleS24_3BE;
+        case SND_PCM_FORMAT_S32_LE:     return SampleS32LE;
+        case SND_PCM_FORMAT_S32_BE:     return SampleS32BE;
+        case SND_PCM_FORMAT_FLOAT_LE:   return SampleFloatLE;
+        case SND_PCM_FORMAT_FLOAT_BE:   return SampleFloatBE;
+        default: break;
+    }
+    return -1;
+}
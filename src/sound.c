@@ -13,29 +13,49 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/queue.h>
+#include <sys/epoll.h>
 
 #include "bus.h"
+#include "loop.h"
 #include "sound.h"
 #include "mixer.h"
 #include "config.h"
+#include "engine.h"
+#include "convert.h"
+#include "stream.h"
+#include "cache.h"
+#include "index.h"
 #include "formats.h"
+#include "wave.h"
+#include "decoder.h"
 #include "download.h"
+#include "growbuf.h"
 #include "sound_test.h"
 
-#define SOUNDS_FOLDER           ""
-
-typedef struct PlayDataStruct {
-    SoundData *soundData;
-    snd_pcm_t *pcm;
-} PlayData;
+#define SOUNDS_FOLDER           "sounds"
+#define INDEX_FILE              "sound_index.yml"
 
 static void sound_check_and_update (SoundData *data, SoundShort *newData);
-static void play_audio(PlayData *play);
-static void *play_wave(void* ptr);
-static void parse_wave_file (FILE *file, WaveHeader *h, SoundData *data);
-static int load_wave_file (SoundData *data);
+static SoundData * sound_data (SoundType type);
+static void sound_file_name (SoundData *data);
+static const char * sound_index_source (SoundData *data);
+static void sound_trim_cache ();
+static int sound_index_keep (const IndexSound *sound);
+static int sound_cache_known (const char *name);
+static int sound_cache_in_use (const char *name);
+static int sound_uses_file (uint64_t id, const char *name);
+static void parse_wave_file (const uint8_t *file, size_t fileSize, SoundData *data);
+static int load_wave_data (SoundData *data);
+static uint64_t sound_converted_size (const SoundData *data);
+static int load_wave_file (SoundData *data, const char *hash);
 static int load_resource (SoundData *data);
+static int sound_engine_cb (sd_event_source *s, int fd, uint32_t revents, void *userdata);
+static int sound_download_cb (sd_event_source *s, int fd, uint32_t revents, void *userdata);
+static int sound_deferred_cb (sd_event_source *s, void *userdata);
 static void set_state (AppState newState);
 static void set_playing (SoundType type);
 static void reset_playing (SoundType type);
@@ -45,22 +65,50 @@ static const char * app_state (AppState state);
 static SoundData        soundTest   = { SoundTest };
 static SoundData        soundOpen   = { SoundOpen };
 static SoundData        soundCall   = { SoundCall };
-static pthread_t        threadTest  = 0UL;
-static pthread_t        threadOpen  = 0UL;
-static pthread_t        threadCall  = 0UL;
 static int              playingTest = FALSE;
 static int              playingOpen = FALSE;
 static int              playingCall = FALSE;
+static SoundShort       deferred[SoundMAX];     // Downloads loaded once the progressive play ends
+static sd_event_source *deferSource = NULL;     // Loads the deferred downloads, enabled once per need
 static AppState         state       = SND_Initializing;
 
 int sound_start_service () {
     int i, r, cnt;
     SoundShort *data = NULL;
+    char path[MAX_FILE_SIZE + 1];
+
+    // Everything on the main thread is driven by one event loop
+    r = loop_init ();
+    if (r < 0) return r;
 
     // Dbus init
     r = dbus_init ();
     if (r < 0) return r;
 
+    // Open output device once for the service lifetime, a missing card is retried on play
+    r = engine_start ();
+    if (r < 0) return r;
+
+    r = sd_event_add_io (loop_event (), NULL, engine_event_fd (), EPOLLIN, sound_engine_cb, NULL);
+    returnValIfFailErr (r >= 0, r, "Watch audio events error(%d): %s", r, strerror (-r));
+
+    // Volume control stays open, its events come through the loop
+    mixer_init ();
+
+    r = download_init ();
+    if (r < 0) return r;
+    r = sd_event_add_io (loop_event (), NULL, r, EPOLLIN, sound_download_cb, NULL);
+    returnValIfFailErr (r >= 0, r, "Watch downloads error(%d): %s", r, strerror (-r));
+
+    // Downloaded sounds and their transcoded copies, in a folder of their own
+    snprintf (path, MAX_FILE_SIZE, "%s/%s", getenv ("HOME"), SOUNDS_FOLDER);
+    cache_init (path);
+    snprintf (path, MAX_FILE_SIZE, "%s/%s/%s", getenv ("HOME"), SOUNDS_FOLDER, INDEX_FILE);
+    index_init (path);
+
+    // Nothing is downloaded yet, so parts and unindexed files are left from earlier runs
+    cache_sweep (sound_cache_known);
+
     // Read build-in sounds
     sound_check_and_update (&soundTest, NULL);
 
@@ -91,42 +139,39 @@ int sound_start_service () {
             free (data);
     }
 
+    sound_trim_cache ();
     mixer_set_volume ();
 
     if (state == SND_Initializing)
         set_state (SND_Idle);
 
-    r = 0;
-    while (!r) {
-        r = download_count ();
-        if (state == SND_Downloading && r == 0) {
-            // parse files
-            set_state (SND_Idle);
-        }
-        r = dbus_loop ();
-    }
+    r = loop_run ();
+
+    deferSource = sd_event_source_unref (deferSource);
+    engine_shutdown ();
+    download_deinit ();
+    index_deinit ();
+    cache_deinit ();
+    mixer_deinit ();
+    dbus_deinit ();
+    loop_deinit ();
 
     return r;
 }
 
 int sound_play (SoundType soundType) {
-    int r;
-    pthread_t *th = NULL;
     SoundData *data = NULL;
 
     switch (soundType) {
         case SoundTest:
-            th = &threadTest;
             data = &soundTest;
             break;
 
         case SoundOpen:
-            th = &threadOpen;
             data = &soundOpen;
             break;
 
         case SoundCall:
-            th = &threadCall;
             data = &soundCall;
             break;
 
@@ -135,42 +180,19 @@ int sound_play (SoundType soundType) {
             return FALSE;
     }
 
-    if (!data) {
+    if (!data->data) {
         selfLogWrn ("Sound type %d [%s] is not initialized!", soundType, sound_type (soundType));
         return FALSE;
     }
 
-    if (*th) {
-        pthread_cancel (*th);
-        *th = 0;
-    }
-    r = pthread_create (th, NULL, play_wave, data);
-    if (r) {
-        selfLogErr ("Create thread error(%d): %m", errno);
-        return FALSE;
-    }
-
-    return TRUE;
+    return engine_play (data);
 }
 
 int sound_stop (SoundType soundType) {
-    pthread_t *th = NULL;
-    int *playing = NULL;
-
     switch (soundType) {
         case SoundTest:
-            th = &threadTest;
-            playing = &playingTest;
-            break;
-
         case SoundOpen:
-            th = &threadOpen;
-            playing = &playingOpen;
-            break;
-
         case SoundCall:
-            th = &threadCall;
-            playing = &playingCall;
             break;
 
         default:
@@ -178,13 +200,8 @@ int sound_stop (SoundType soundType) {
             return FALSE;
     }
 
-    if (th && *th) {
-        pthread_cancel (*th);
-        *th = 0;
+    engine_cancel (soundType);
 
-        *playing = FALSE;
-        dbus_emit_playing ();
-    }
     if (state == SND_Playing && !playingCall && !playingOpen && !playingTest)
         set_state (SND_Idle);
 
@@ -232,17 +249,194 @@ void sound_playing (int *call, int *open) {
     *open = playingOpen;
 }
 
+void sound_set_playing (SoundType type, int playing) {
+    if (playing)
+        set_playing (type);
+    else
+        reset_playing (type);
+}
+
+/**
+ * @brief Loads a downloaded sound in place of the one played now
+ *
+ * @param snd downloaded sound
+ */
+void sound_downloaded (SoundShort *snd) {
+    SoundData *data = sound_data (snd->type);
+
+    if (!data)
+        return;
+
+    // Let the progressive play finish, the complete sound replaces it after
+    if (data->progress && ((snd->type == SoundOpen && playingOpen) || (snd->type == SoundCall && playingCall))) {
+        selfLogDbg ("Load %s sound id=%lu after it is played", sound_type (snd->type), snd->id);
+        deferred[snd->type] = *snd;
+        return;
+    }
+    deferred[snd->type].type = SoundNone;
+
+    if (data->data) {
+        engine_release (data);
+        sound_free_data (data);
+    }
+    sound_check_and_update (data, snd);
+    sound_trim_cache ();
+}
+
+/**
+ * @brief Makes a new sound playable while it is still being downloaded
+ *
+ * Only uncompressed WAVE is streamed from the partial download, other
+ * formats are decoded as a whole once they are complete.
+ *
+ * @param snd sound being downloaded
+ * @param grow download buffer
+ */
+void sound_progress (SoundShort *snd, GrowBuf *grow) {
+    SoundData *data = sound_data (snd->type);
+    const uint8_t *buf = growbuf_data (grow);
+    size_t avail = growbuf_available (grow);
+    WaveParser p;
+    WaveRegion r;
+    WaveEvent ev;
+    uint64_t len;
+
+    // Something is playable already
+    if (!data || data->data || data->id != snd->id || strcmp (data->url, snd->url))
+        return;
+
+    if (decoder_probe (buf, avail) != DecoderWave)
+        return;
+
+    // Headers are in, the samples only partly
+    wave_init (&p);
+    while ((ev = wave_parse (&p, &buf, &avail, &r)) != WaveData) {
+        if (ev != WaveFormat) {
+            selfLogDbg ("Sound id=%lu is not playable before it is complete", snd->id);
+            return;
+        }
+    }
+
+    // Whole data chunk, as its header says, within the whole file
+    len = p.dataLength;
+    if (len > growbuf_size (grow) - p.dataOffset)
+        len = growbuf_size (grow) - p.dataOffset;
+
+    data->format = p.format;
+    data->channels = p.channels;
+    data->rate = p.rate;
+    data->align = p.align;
+    data->bits = p.bits;
+    data->data = (uint8_t *) growbuf_data (grow) + p.dataOffset;
+    data->size = len / p.align;
+
+    data->progress = growbuf_ref (grow);
+    data->stream = stream_open (data);
+    if (!data->stream) {
+        sound_free_data (data);
+        return;
+    }
+
+    selfLogInf ("Play %s sound id=%lu while it is downloaded", sound_type (snd->type), snd->id);
+}
+
+/**
+ * @brief Keeps the sound played now, the server has the same content
+ *
+ * @param snd revalidated sound
+ */
+void sound_not_modified (SoundShort *snd) {
+    SoundData *data = sound_data (snd->type);
+    const IndexSound *base;
+    IndexSound entry;
+
+    if (!data)
+        return;
+
+    base = index_find (data->id);
+    if (!data->data || !base || strcmp (data->url, snd->url)) {
+        // Played sound changed meanwhile, fetch this one in full
+        selfLogWrn ("Not modified %s sound id=%lu is gone", sound_type (snd->type), snd->id);
+        if (data->data) {
+            engine_release (data);
+            sound_free_data (data);
+        }
+        sound_check_and_update (data, snd);
+        return;
+    }
+
+    selfLogInf ("%s sound id=%lu is up to date", sound_type (snd->type), snd->id);
+    if (data->id == snd->id)
+        return;
+
+    // Same content under a new id, it is cached by content already
+    entry = *base;
+    entry.id = snd->id;
+    index_set (&entry);
+
+    data->id = snd->id;
+    sound_trim_cache ();
+}
+
+/**
+ * @brief Releases sound samples whether they are on heap or mapped
+ *
+ * @param data sound
+ */
+void sound_free_data (SoundData *data) {
+    engine_unlock_data (data);
+
+    if (data->stream) {
+        stream_close (data->stream);
+        data->stream = NULL;
+    }
+
+    if (data->progress) {
+        // Samples are in the download buffer
+        growbuf_unref (data->progress);
+        data->progress = NULL;
+    } else if (data->map) {
+        // Zero size marks the built-in resource, nothing to unmap
+        if (data->mapSize)
+            munmap (data->map, data->mapSize);
+    } else {
+        free (data->data);
+    }
+    data->data = NULL;
+    data->map = NULL;
+    data->mapSize = 0;
+}
+
 static void sound_check_and_update (SoundData *data, SoundShort *newData) {
+    char source[MAX_FILE_SIZE + 1];
+    const IndexSound *base;
+    const char *hash;
+    SoundData next = {0};
     int r;
     selfLogInf ("Update %s sound [old=%d, new=%d] url's %s equal", sound_type (data->type), data->id, newData ? newData->id : 0, strcmp (data->url, newData ? newData->url : "") == 0 ? "are" : "aren't");
-    // If update is not required
-    if (newData && data->id == newData->id && strcmp (data->url, newData->url) == 0 && data->data)
-        return;
+
+    if (newData && data->data && strlen (newData->url) && strcmp (data->url, newData->url) == 0) {
+        // Ask the server whether the played content changed, keep playing it meanwhile
+        base = index_find (data->id);
+        if (base && (base->etag || base->last_modified)) {
+            next.type = newData->type;
+            next.id = newData->id;
+            strcpy (next.url, newData->url);
+            sound_file_name (&next);
+            selfLogTrc ("Revalidate [%s] %s", next.filename, next.url);
+            download_sound (&next, base);
+            return;
+        }
+
+        // If update is not required
+        if (data->id == newData->id)
+            return;
+    }
 
     // Clean old data
     if (data->data) {
-        free (data->data);
-        data->data = NULL;
+        engine_release (data);
+        sound_free_data (data);
     }
 
     if (newData) {
@@ -256,224 +450,211 @@ static void sound_check_and_update (SoundData *data, SoundShort *newData) {
             return;
 
         // Create sound file name
-        snprintf (data->filename, MAX_FILE_SIZE, "%s/%s%ld.wav", getenv ("HOME"), SOUNDS_FOLDER, data->id);
+        sound_file_name (data);
+        strcpy (source, data->filename);
+
+        // Transcoded copy is mapped with no parsing, whatever id the content came with
+        base = index_find (data->id);
+        hash = base && base->md5 && !strcmp (base->url, data->url) ? base->md5 : NULL;
+        if (cache_load (data, hash)) {
+            // Known content downloaded again under a new id
+            unlink (source);
+            engine_lock_data (data);
+            return;
+        }
 
         // Test if file not exists
         if (access (data->filename, F_OK)) {
             selfLogTrc ("Start download [%s] %s", data->filename, data->url);
-            r = download_sound (data);
+            r = download_sound (data, NULL);
             if (r)
                 set_state (SND_Downloading);
 
             return;
         }
 
-        // Parse file
-        load_wave_file (data);
+        // Parse file, a download left from an earlier run is indexed first
+        if (!hash)
+            hash = sound_index_source (data);
+        r = load_wave_file (data, hash);
     } else {
-        load_resource (data);
-    }
-}
-
-static void parse_wave_file (FILE *file, WaveHeader *h, SoundData *data) {
-    uint8_t         buf[64] = {0};
-    WaveChunkHeader c;
-    WaveFmtBody    *f = (WaveFmtBody *)buf;
-    int             r;
-    int             bigEndian;
-    uint8_t         vbps = 0;
-    uint16_t        format;
-    uint32_t        len;
-
-    if (h->magic == WAV_RIFF)
-        bigEndian = 0;
-    else if (h->magic == WAV_RIFX)
-        bigEndian = 1;
-    else {
-        selfLogErr ("Is not a RIFF/X file [%s]", data->filename);
-        return;
+        r = load_resource (data);
     }
 
-    returnIfFailErr (h->type == WAV_WAVE, "Is not a WAVE file [%s] type is [%c%c%c%c]", data->filename, DUMP_ID (h->type));
+    if (r)
+        engine_lock_data (data);
+}
 
-    selfLogInf ("Read '%s' magic:%c%c%c%c, type:%c%c%c%c", data->filename, DUMP_ID (h->magic), DUMP_ID (h->type));
+static SoundData * sound_data (SoundType type) {
+    switch (type) {
+        case SoundOpen: return &soundOpen;
+        case SoundCall: return &soundCall;
+        default: break;
+    }
+    selfLogWrn ("Wrong sound type: %d", type);
+    return NULL;
+}
 
-    // Read in next chunk header
-    while (fread (&c, 1, sizeof (WaveChunkHeader), file) == sizeof (WaveChunkHeader)) {
-        char *log = NULL;
+/**
+ * @brief Fills the download name of a sound
+ *
+ * @param data sound with id set
+ */
+static void sound_file_name (SoundData *data) {
+    snprintf (data->filename, MAX_FILE_SIZE, "%s/%s/%lu" CACHE_SOURCE_EXT, getenv ("HOME"), SOUNDS_FOLDER, data->id);
+}
 
-        len = TO_CPU_INT (c.length, bigEndian);
+/**
+ * @brief Adds a downloaded file to the index
+ *
+ * @param data sound with the downloaded file name set
+ * @return const char* MD5 of the file, hex, NULL on error
+ */
+static const char * sound_index_source (SoundData *data) {
+    uint8_t digest[MD5_SIZE];
+    char hex[2 * MD5_SIZE + 1];
+    IndexSound entry = {0};
+    struct stat st;
+    int i;
 
-        // ============================ Is it a fmt chunk? ===============================
-        if (WAV_FMT == c.type) {
-            char chan[12] = {0};
+    if (stat (data->filename, &st) || !md5_file (data->filename, digest))
+        return NULL;
+    for (i = 0; i < MD5_SIZE; i++)
+        sprintf (hex + 2 * i, "%02x", digest[i]);
 
+    entry.id = data->id;
+    entry.url = data->url;
+    entry.size = st.st_size;
+    entry.md5 = hex;
+    if (!index_set (&entry))
+        return NULL;
 
-            if (fread (&buf, 1, len, file) != len) {
-                selfLogErr ("Read format error(%d): %m", errno);
-                break;
-            }
+    return index_find (data->id)->md5;
+}
 
-            format = TO_CPU_SHORT (f->format, bigEndian);
+/**
+ * @brief Fits the cache in its budget keeping the sounds in use
+ *
+ * Sounds evicted from the cache are dropped from the index too.
+ */
+static void sound_trim_cache () {
+    cache_trim (sound_cache_in_use);
+    index_retain (sound_index_keep);
+}
 
-            if (WAV_FMT_EXTENSIBLE == format) {
-                WaveFmtExtensibleBody *fe = (WaveFmtExtensibleBody*) buf;
+static int sound_index_keep (const IndexSound *sound) {
+    char name[MAX_FILE_SIZE + 1];
 
-                returnIfFailErr (len >= sizeof(WaveFmtExtensibleBody)
-                    , "unknown length of extensible 'fmt ' chunk (read %u, should be %u at least)"
-                    , len
-                    , (unsigned int)sizeof(WaveFmtExtensibleBody));
+    if (sound->id == soundOpen.id || sound->id == soundCall.id)
+        return TRUE;
 
-                if (memcmp(fe->guid_tag, WAV_GUID_TAG, 14) != 0) {
-                    selfLogErr ("Wrong format tag in extensible 'fmt ' chunk");
-                    return;
-                }
-                vbps = TO_CPU_SHORT(fe->bit_p_spl, bigEndian);
-                format = TO_CPU_SHORT(fe->guid_format, bigEndian);
-            }
+    // Content is kept either converted or as it was downloaded
+    snprintf (name, sizeof (name), "%lu" CACHE_SOURCE_EXT, sound->id);
+    if (cache_contains (name))
+        return TRUE;
+    if (!sound->md5)
+        return FALSE;
+    snprintf (name, sizeof (name), "%s" CACHE_EXT, sound->md5);
+    return cache_contains (name);
+}
 
-            // Can't handle compressed WAVE files
-            returnIfFailErr ((format == WAV_FMT_PCM || format == WAV_FMT_IEEE_FLOAT)
-                , "Unsupported WAVE-file format 0x%04x which is not PCM or FLOAT encoded"
-                , format);
-
-            data->channels = TO_CPU_SHORT (f->channels, bigEndian);
-            returnIfFailErr (data->channels >= 1, "Can't play WAVE-files with %d tracks", data->channels);
-            if (data->channels == 1)
-                sprintf (chan, "Mono");
-            else if (data->channels == 2)
-                sprintf (chan, "Stereo");
-            else
-                sprintf (chan, "%dch.", data->channels);
-
-            data->rate = TO_CPU_INT(f->sample_fq, bigEndian);
-            data->align = TO_CPU_SHORT (f->byte_p_spl, bigEndian);
-
-            data->bits = TO_CPU_SHORT (f->bit_p_spl, bigEndian);
-            returnIfFailErr (vbps <= data->bits, "Valid bps greater than bps: %d > %d", vbps, data->bits);
-
-            switch (data->bits) {
-            case 8:
-                data->format = SND_PCM_FORMAT_U8;
-                r = asprintf (&log, "PCM Unsigned 8bit freq:%u %s", data->rate, chan);
-                break;
-            case 16:
-                if (bigEndian) {
-                    data->format = SND_PCM_FORMAT_S16_BE;
-                    r = asprintf (&log, "PCM Signed 16bit Big endian freq:%u %s", data->rate, chan);
-                } else {
-                    data->format = SND_PCM_FORMAT_S16_LE;
-                    r = asprintf (&log, "PCM Signed 16bit Little endian freq:%u %s", data->rate, chan);
-                }
-                break;
-            case 24:
-                switch (data->align / data->channels) {
-                case 3:
-                    if (bigEndian) {
-                        data->format = SND_PCM_FORMAT_S24_3BE;
-                        r = asprintf (&log, "PCM Signed 24bit Big endian in 3bytes freq:%u %s", data->rate, chan);
-                    } else {
-                        data->format = SND_PCM_FORMAT_S24_3LE;
-                        r = asprintf (&log, "PCM Signed 24bit Little endian in 3bytes freq:%u %s", data->rate, chan);
-                    }
-                    break;
-                case 4:
-                    if (bigEndian) {
-                        data->format = SND_PCM_FORMAT_S24_BE;
-                        r = asprintf (&log, "PCM Signed 24bit Big endian freq:%u %s", data->rate, chan);
-                    } else {
-                        data->format = SND_PCM_FORMAT_S24_LE;
-                        r = asprintf (&log, "PCM Signed 24bit Little endian freq:%u %s", data->rate, chan);
-                    }
-                    break;
-                default:
-                    selfLogErr("Can't play WAVE-files with sample %d bits in %d bytes wide (%d channels)",
-                        data->bits,
-                        data->align,
-                        data->channels);
-                    return;
-                }
-                break;
-            case 32:
-                if (format == WAV_FMT_PCM) {
-                    switch (vbps) {
-                    case 24:
-                        if (bigEndian) {
-                            data->format = SND_PCM_FORMAT_S24_BE;
-                            r = asprintf (&log, "PCM Signed 24bit Big endian freq:%u %s", data->rate, chan);
-                        } else {
-                            data->format = SND_PCM_FORMAT_S24_LE;
-                            r = asprintf (&log, "PCM Signed 24bit Little endian freq:%u %s", data->rate, chan);
-                        }
-                        break;
-                    default:
-                        if (bigEndian) {
-                            data->format = SND_PCM_FORMAT_S32_BE;
-                            r = asprintf (&log, "PCM Signed 32bit Big endian freq:%u %s", data->rate, chan);
-                        } else {
-                            data->format = SND_PCM_FORMAT_S32_LE;
-                            r = asprintf (&log, "PCM Signed 32bit Little endian freq:%u %s", data->rate, chan);
-                        }
-                        break;
-                    }
-                } else if (format == WAV_FMT_IEEE_FLOAT) {
-                    if (bigEndian) {
-                        data->format = SND_PCM_FORMAT_FLOAT_BE;
-                        r = asprintf (&log, "PCM Float Big endian freq:%u %s", data->rate, chan);
-                    } else {
-                        data->format = SND_PCM_FORMAT_FLOAT_LE;
-                        r = asprintf (&log, "PCM Float Little endian freq:%u %s", data->rate, chan);
-                    }
-                }
-                break;
-            default:
-                selfLogErr ("Can't play WAVE-files with sample %d bits wide",
-                    data->bits);
-                return;
-            }
-        }
+static int sound_cache_known (const char *name) {
+    uint64_t id;
+    char *end;
 
-        // ============================ Is it a data chunk? ===============================
-        else if (WAV_DATA == c.type) {
-            ssize_t sz;
+    if (!strcmp (name, INDEX_FILE))
+        return TRUE;
 
-            len += len % 2;
-            // Size of wave data is c.length. Allocate a buffer and read in the wave data
-            if (!(data->data = (uint8_t *) malloc (len))) {
-                selfLogErr ("Allocate memory error: %m");
-                break;
-            }
+    id = strtoull (name, &end, 10);
+    return end != name && !strcmp (end, CACHE_SOURCE_EXT) && index_find (id);
+}
 
-            sz = fread (data->data, 1, len, file);
-            if (sz != len) {
-                free (data->data);
-                data->data = NULL;
-                selfLogErr ("Data chunk sz=%ld not equal c.length=%u", sz, len);
-                break;
-            }
+static int sound_cache_in_use (const char *name) {
+    return sound_uses_file (soundOpen.id, name) || sound_uses_file (soundCall.id, name);
+}
 
-            // Store size (in frames)
-            data->size = (len * 8) / ((uint32_t) data->bits * (uint32_t) data->channels);
+/**
+ * @brief Tells whether a file in the cache folder holds a sound
+ *
+ * @param id sound id
+ * @param name file name, the download or the converted entry
+ */
+static int sound_uses_file (uint64_t id, const char *name) {
+    char file[MAX_FILE_SIZE + 1];
+    const IndexSound *s;
 
-            r = asprintf (&log, "data has %ld frames", data->size);
-        }
+    snprintf (file, sizeof (file), "%lu" CACHE_SOURCE_EXT, id);
+    if (!strcmp (file, name))
+        return TRUE;
 
-        // ============================ Skip this chunk ===============================
-        else {
-            len += len % 2;
-            r = asprintf (&log, "skip it [%d bytes]", len);
-            fseek (file, len, SEEK_CUR);
-            // lseek(file, len, SEEK_CUR);
-        }
+    s = index_find (id);
+    if (!s || !s->md5)
+        return FALSE;
+    snprintf (file, sizeof (file), "%s" CACHE_EXT, s->md5);
+    return !strcmp (file, name);
+}
 
-        selfLogTrc ("Chunk hdr: ID=%c%c%c%c, Len=%d : %s", DUMP_ID (c.type), len, log);
-        if (log && r) free (log);
+/**
+ * @brief Parses a WAVE file image
+ *
+ * On success data->data points at the data chunk inside the image.
+ *
+ * @param file whole file contents
+ * @param fileSize contents size
+ * @param data sound to fill
+ */
+static void parse_wave_file (const uint8_t *file, size_t fileSize, SoundData *data) {
+    WaveParser  p;
+    WaveRegion  r;
+    WaveEvent   ev;
+    uint64_t    len = 0;
+
+    wave_init (&p);
+    while ((ev = wave_parse (&p, &file, &fileSize, &r)) != WaveEnd) {
+        switch (ev) {
+        case WaveFormat:
+            selfLogInf ("Read '%s' %s freq:%u %uch.", data->filename
+                , snd_pcm_format_name (p.format), p.rate, p.channels);
+            break;
+        case WaveData:
+            selfLogTrc ("Data chunk at %lu, %lu bytes", p.dataOffset, p.dataLength);
+            break;
+        case WaveSamples:
+            // The image is contiguous, so the samples come in one region
+            data->data = (uint8_t *) r.data;
+            len = r.size;
+            break;
+        case WaveNeedMore:
+            if (p.state != WaveStateData) {
+                selfLogErr ("Read file [%s] error: no data chunk", data->filename);
+                return;
+            }
+            selfLogWrn ("Data chunk sz=%lu less than c.length=%lu", len, p.dataLength);
+            goto done;
+        case WaveError:
+        default:
+            selfLogErr ("Read file [%s] error: %s", data->filename, p.error);
+            return;
+        }
     }
+
+done:
+    data->format = p.format;
+    data->channels = p.channels;
+    data->rate = p.rate;
+    data->align = p.align;
+    data->bits = p.bits;
+    data->size = len / p.align;
+    if (!data->data)
+        data->data = (uint8_t *) file;
+    selfLogTrc ("data has %ld frames", data->size);
 }
 
-static int load_wave_file (SoundData *data) {
-    WaveHeader      h;
-    FILE           *file;
+static int load_wave_file (SoundData *data, const char *hash) {
+    struct stat     st;
+    void           *map;
+    int             fd;
+    DecoderType     type;
 
     if (!data) {
         selfLogErr ("Invalid pointer");
@@ -483,28 +664,65 @@ static int load_wave_file (SoundData *data) {
     data->data = NULL;
     data->channels = 0;
 
-    if (!(file = fopen (data->filename, "rb"))) {
-
+    if ((fd = open (data->filename, O_RDONLY | O_CLOEXEC)) < 0) {
         selfLogErr ("Can't open file [%s]: %m", data->filename);
         return FALSE;
+    }
 
-    } else {
+    if (fstat (fd, &st) || st.st_size < (off_t) sizeof (WaveHeader)) {
+        selfLogErr ("Read file [%s] header error(%d): %m", data->filename, errno);
+        close (fd);
+        return FALSE;
+    }
 
-        if (fread (&h, 1, sizeof (WaveHeader), file) == sizeof (WaveHeader))
-            parse_wave_file (file, &h, data);
-        else
-            selfLogErr ("Read file [%s] header error(%d): %m", data->filename, errno);
+    // Read-only mapping is backed by the page cache, so it is shared and reclaimable
+    map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // Last use time, a download kept as it is gets evicted in the same order as the entries
+    futimens (fd, NULL);
+    close (fd);
+    if (map == MAP_FAILED) {
+        selfLogErr ("Map file [%s] error: %m", data->filename);
+        return FALSE;
+    }
 
-        fclose (file);
+    data->map = map;
+    data->mapSize = st.st_size;
+
+    // Downloaded sounds keep the .wav name whatever they are encoded with
+    type = decoder_probe ((const uint8_t *) map, st.st_size);
+    if (type == DecoderWave) {
+        parse_wave_file ((const uint8_t *) map, st.st_size, data);
+    } else {
+        // Compressed sounds are decoded as a whole, the file stays compact on disk
+        selfLogDbg ("Decode [%s] as %s", data->filename, decoder_name (type));
+        data->map = NULL;
+        data->mapSize = 0;
+        if (!decoder_decode (type, (const uint8_t *) map, st.st_size, data))
+            data->data = NULL;
+        munmap (map, st.st_size);
+
+        // Decoded sounds can't be streamed, so their converted copy is held to the same threshold
+        if (data->data && sound_converted_size (data) > STREAM_THRESHOLD) {
+            selfLogErr ("Decoded [%s] converts to over %u bytes", data->filename, STREAM_THRESHOLD);
+            sound_free_data (data);
+            return FALSE;
+        }
+        return load_wave_data (data);
     }
 
-    return data->data && data->format && data->channels ? TRUE : FALSE;
+    // Store the download in the engine format once, next starts map it as is.
+    // Long mapped sounds are streamed instead, converting them would take it all in RAM
+    if (hash && data->data && sound_converted_size (data) <= STREAM_THRESHOLD
+            && convert_sound (data) && cache_store (data, hash)) {
+        sound_free_data (data);
+        unlink (data->filename);
+        return cache_load (data, hash);
+    }
+
+    return load_wave_data (data);
 }
 
 static int load_resource (SoundData *data) {
-    WaveHeader      h;
-    FILE           *file;
-
     if (!data || data->type != SoundTest) {
         selfLogErr ("Invalid pointer");
         return FALSE;
@@ -514,88 +732,100 @@ static int load_resource (SoundData *data) {
     data->channels = 0;
     strcpy (data->filename, "<resource>");
 
-    if (!(file = fmemopen (sound_test_wav, sound_test_wav_len, "rb"))) {
+    // Built-in image is referenced in place and never unmapped
+    data->map = sound_test_wav;
+    data->mapSize = 0;
+    parse_wave_file (sound_test_wav, sound_test_wav_len, data);
 
-        selfLogErr ("Can't open file [%s]: %m", data->filename);
-        return FALSE;
-
-    } else {
-
-        if (fread (&h, 1, sizeof (WaveHeader), file) == sizeof (WaveHeader))
-            parse_wave_file (file, &h, data);
-        else
-            selfLogErr ("Read file [%s] header error(%d): %m", data->filename, errno);
-
-        fclose (file);
-    }
-
-    return data->data && data->format && data->channels ? TRUE : FALSE;
+    return load_wave_data (data);
 }
 
+/**
+ * @brief Makes parsed samples playable
+ *
+ * Native samples are played straight from the image, anything else is
+ * converted to a heap copy and the image is released.
+ */
+static int load_wave_data (SoundData *data) {
+    const uint8_t *samples = data->data;
 
-static void play_audio (PlayData *play) {
-    register snd_pcm_uframes_t count, frames;
+    if (!data->data || !data->format || !data->channels) {
+        sound_free_data (data);
+        return FALSE;
+    }
 
-    // Output the wave data
-    count = 0;
-    do {
-        frames = snd_pcm_writei (play->pcm, play->soundData->data + count, play->soundData->size - count);
-        selfLogTrc ("written %ld frames of %ld left", frames, play->soundData->size - count);
+    if (convert_is_native (data) && !((uintptr_t) data->data % sizeof (int16_t))) {
+        if (data->mapSize)
+            madvise (data->map, data->mapSize, MADV_WILLNEED);
+        selfLogDbg ("Play [%s] in place, %lu frames", data->filename, data->size);
+        return TRUE;
+    }
 
-        // If an error, try to recover from it
-        if (frames < 0)
-            frames = snd_pcm_recover(play->pcm, frames, 0);
-        if (frames < 0) {
-            selfLogErr ("Error playing wave: %s", snd_strerror(frames));
-            break;
-        }
+    // Long sounds are decoded while playing instead of converted as a whole
+    if (data->mapSize && sound_converted_size (data) > STREAM_THRESHOLD) {
+        madvise (data->map, data->mapSize, MADV_SEQUENTIAL);
+        data->stream = stream_open (data);
+        if (data->stream)
+            return TRUE;
+        selfLogWrn ("Can't stream [%s], preload it", data->filename);
+    }
 
-        // Update our pointer
-        count += frames;
+    // Store data in the device format once instead of on every play
+    if (!convert_sound (data)) {
+        if (data->data == samples)
+            sound_free_data (data);
+        return FALSE;
+    }
 
-    } while (count < play->soundData->size);
+    return TRUE;
+}
 
-    // Wait for playback to completely finish
-    //if (count == WaveSize)
-        //snd_pcm_drain(PlaybackHandle);
+/**
+ * @brief Size of the sound once converted to the engine format
+ */
+static uint64_t sound_converted_size (const SoundData *data) {
+    return ((uint64_t) data->size * ENGINE_RATE + data->rate - 1) / data->rate * ENGINE_FRAME_BYTES;
 }
 
-static void * play_wave(void* ptr) {
-    // No wave data loaded yet
-    register int err;
-    PlayData play = { (SoundData *) ptr, NULL };
+static int sound_engine_cb (sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+    UNUSED_ARG (s);
+    UNUSED_ARG (fd);
+    UNUSED_ARG (revents);
+    UNUSED_ARG (userdata);
 
-    returnValIfFailWrn ((play.soundData->format && play.soundData->channels), NULL, "No sound data");
+    engine_dispatch ();
+    return 0;
+}
 
-    // Open audio card we wish to use for playback
-    err = snd_pcm_open (&(play.pcm), &card[0], SND_PCM_STREAM_PLAYBACK, 0);
-    if (err < 0)
-        selfLogErr ("Can't open audio %s: %s", &card[0], snd_strerror (err));
-    else {
+static int sound_download_cb (sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+    UNUSED_ARG (s);
+    UNUSED_ARG (fd);
+    UNUSED_ARG (revents);
+    UNUSED_ARG (userdata);
 
-        // Set the audio card's hardware parameters (sample rate, bit resolution, etc)
-        err = snd_pcm_set_params (play.pcm
-            , play.soundData->format        // Format
-            , SND_PCM_ACCESS_RW_INTERLEAVED // Access
-            , play.soundData->channels      // Channels
-            , play.soundData->rate          // Rate
-            , 1                             // Soft resample
-            , 100000);                      // Latency
+    download_dispatch ();
 
-        if (err < 0)
-            selfLogErr ("Can't set sound parameters: %s", snd_strerror(err));
-        else {
-            set_playing (play.soundData->type);
-            play_audio (&play);
-        }
+    // All downloads are loaded
+    if (state == SND_Downloading && !download_count ())
+        set_state (SND_Idle);
 
-        snd_pcm_drain (play.pcm);
-        snd_pcm_close (play.pcm);
+    return 0;
+}
 
-        reset_playing (play.soundData->type);
+static int sound_deferred_cb (sd_event_source *s, void *userdata) {
+    SoundShort snd;
+    int i;
+    UNUSED_ARG (s);
+    UNUSED_ARG (userdata);
+
+    for (i = SoundNone + 1; i < SoundMAX; i++) {
+        if (deferred[i].type == SoundNone)
+            continue;
+        snd = deferred[i];
+        sound_downloaded (&snd);
     }
 
-    pthread_exit (NULL);
+    return 0;
 }
 
 static void set_state (AppState newState) {
@@ -615,6 +845,8 @@ static void set_playing (SoundType type) {
         playingOpen = TRUE;
         emit = TRUE;
     }
+    if (type == SoundTest)
+        playingTest = TRUE;
     if (emit) dbus_emit_playing (playingCall, playingOpen);
 }
 
@@ -628,8 +860,17 @@ static void reset_playing (SoundType type) {
         playingOpen = FALSE;
         emit = TRUE;
     }
+    if (type == SoundTest)
+        playingTest = FALSE;
     if (emit) dbus_emit_playing (playingCall, playingOpen);
-    if (!playingCall && !playingOpen && state != SND_Idle) set_state (SND_Idle);
+    if (!playingCall && !playingOpen && !playingTest && state != SND_Idle) set_state (SND_Idle);
+    // Complete download waited for the progressive play to end, load it out of the engine callback
+    if (type > SoundNone && type < SoundMAX && deferred[type].type != SoundNone) {
+        if (deferSource)
+            sd_event_source_set_enabled (deferSource, SD_EVENT_ONESHOT);
+        else
+            sd_event_add_defer (loop_event (), &deferSource, sound_deferred_cb, NULL);
+    }
 }
 
 static const char * sound_type (SoundType type) {
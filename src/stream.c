@@ -0,0 +1,415 @@
+/**
+ * @file stream.c
+ * @author Denys Stovbun (denis.stovbun@lanars.com)
+ * @brief Streaming decoder for long sounds
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * Sounds above STREAM_THRESHOLD are not converted as a whole. A reader
+ * thread converts fixed-size chunks of the mapped file into a ring of
+ * STREAM_BUFFERS buffers in the engine format, and the audio thread
+ * takes frames from the ring as it mixes. The first chunk is decoded
+ * on open and kept, so a play request is served from memory right away
+ * no matter how long the file is.
+ *
+ * A sound still being downloaded is streamed the same way from the
+ * download buffer: the reader decodes what has arrived and waits for the
+ * rest, and the sound ends early if the download breaks off.
+ *
+ * The audio thread takes no locks: each buffer is handed over through
+ * an atomic filled flag, one side writing it and the other draining it,
+ * and the reader sleeps on an eventfd the audio thread kicks when it
+ * frees a buffer. A restart is only requested by the audio thread, which
+ * plays the head until the reader has dropped its buffers and says so.
+ *
+ */
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+
+#include "app.h"
+#include "engine.h"
+#include "stream.h"
+#include "sample.h"
+#include "convert.h"
+#include "resample.h"
+#include "growbuf.h"
+
+// Reader looks for more downloaded data this often (ms)
+#define STREAM_GROW_WAIT_MS     10
+
+struct SoundStreamStruct {
+    // Source, the data chunk of the mapped file
+    const uint8_t      *src;
+    snd_pcm_format_t    format;
+    snd_pcm_uframes_t   srcFrames;
+    uint32_t            rate;
+    uint16_t            align;
+    uint16_t            channels;
+    char                name[MAX_FILE_SIZE + 1];
+    GrowBuf            *grow;       // Download the source is in, NULL if it is complete
+
+    // Reader side, only touched by the reader thread
+    Resampler          *rs;
+    Resampler          *rsHead;     // Converter state right after the head chunk
+    snd_pcm_uframes_t   srcPos;     // Next source frame to decode
+    snd_pcm_uframes_t   headSrc;    // Source frames behind the head chunk
+    snd_pcm_uframes_t   outPos;     // Output position of the next decoded frame
+    snd_pcm_uframes_t   inChunk;    // Source frames per chunk
+    int                 flushed;    // Converter tail is out
+    int                 headFlushed; // The head chunk was the whole sound
+    int16_t            *s16;        // Source chunk as S16
+    int16_t            *remix;      // Source chunk in engine channels
+    int                 wr;         // Buffer the reader fills next
+    uint32_t            served;     // Last restart carried out
+
+    // Audio thread side
+    int                 rd;         // Buffer the audio thread reads
+    snd_pcm_uframes_t   cursor;     // Next output frame the audio thread wants
+
+    // Set up on open, read only after
+    int16_t            *head;       // First chunk, kept for restarts
+    snd_pcm_uframes_t   headFrames;
+    int16_t            *bufs[STREAM_BUFFERS];
+    snd_pcm_uframes_t   bufCap;
+    pthread_t           thread;
+    int                 wakeFd;     // Kicked when a buffer is free, a restart is asked or the stream closes
+
+    // Shared, a buffer and its bounds belong to the reader while it is not filled
+    snd_pcm_uframes_t   bufFrames[STREAM_BUFFERS];
+    snd_pcm_uframes_t   bufStart[STREAM_BUFFERS];
+    _Atomic int         filled[STREAM_BUFFERS];
+    _Atomic snd_pcm_uframes_t frames; // Output length
+    _Atomic uint32_t    request;    // Restarts asked by the audio thread
+    _Atomic uint32_t    done;       // Restarts the reader carried out, buffers are free again
+    _Atomic uint32_t    underruns;
+    _Atomic int         running;
+};
+
+static void * stream_process (void *ptr);
+static snd_pcm_uframes_t stream_decode (SoundStream *s, int16_t *out);
+static void stream_restart (SoundStream *s);
+static snd_pcm_uframes_t stream_available (SoundStream *s);
+static void stream_wait (SoundStream *s, int ms);
+
+/**
+ * @brief Opens a stream over parsed sound data and decodes its first chunk
+ *
+ * @param data sound with data pointing at the source samples, inside
+ * data->progress if it is still being downloaded
+ * @return SoundStream* stream or NULL on error
+ */
+SoundStream * stream_open (const SoundData *data) {
+    SoundStream *s;
+    int i, err;
+
+    returnValIfFailErr (data && data->data && data->channels && data->rate && data->align, NULL, "No sound data");
+
+    s = (SoundStream *) calloc (1, sizeof (SoundStream));
+    returnValIfFailErr (s, NULL, "Allocate stream error: %m");
+
+    s->src = data->data;
+    s->format = data->format;
+    s->srcFrames = data->size;
+    s->rate = data->rate;
+    s->align = data->align;
+    s->channels = data->channels;
+    strncpy (s->name, data->filename, MAX_FILE_SIZE);
+    s->grow = growbuf_ref (data->progress);
+    s->wakeFd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (s->wakeFd < 0)
+        goto fail;
+
+    s->inChunk = (snd_pcm_uframes_t) ((uint64_t) STREAM_CHUNK_FRAMES * s->rate / ENGINE_RATE);
+    if (!s->inChunk)
+        s->inChunk = 1;
+    atomic_init (&s->frames, (snd_pcm_uframes_t) (((uint64_t) s->srcFrames * ENGINE_RATE + s->rate - 1) / s->rate));
+    s->bufCap = s->inChunk;
+
+    if (s->rate != ENGINE_RATE) {
+        s->rs = resample_new (s->rate, ENGINE_RATE, ENGINE_CHANNELS, RESAMPLE_QUALITY);
+        s->rsHead = resample_new (s->rate, ENGINE_RATE, ENGINE_CHANNELS, RESAMPLE_QUALITY);
+        if (!s->rs || !s->rsHead)
+            goto fail;
+        // A chunk plus the converter tail on the last one
+        s->bufCap = resample_max_out (s->rs, s->inChunk) + resample_max_out (s->rs, 0);
+    }
+
+    s->s16 = (int16_t *) malloc (s->inChunk * s->channels * sizeof (int16_t));
+    s->remix = (int16_t *) malloc (s->inChunk * ENGINE_CHANNELS * sizeof (int16_t));
+    s->head = (int16_t *) malloc (s->bufCap * ENGINE_CHANNELS * sizeof (int16_t));
+    if (!s->s16 || !s->remix || !s->head)
+        goto fail;
+    for (i = 0; i < STREAM_BUFFERS; i++) {
+        s->bufs[i] = (int16_t *) malloc (s->bufCap * ENGINE_CHANNELS * sizeof (int16_t));
+        if (!s->bufs[i])
+            goto fail;
+    }
+
+    // Prime the head so the first period never waits for the reader
+    s->headFrames = stream_decode (s, s->head);
+    s->headSrc = s->srcPos;
+    s->headFlushed = s->flushed;
+    if (s->rs)
+        resample_copy (s->rsHead, s->rs);
+
+    atomic_store (&s->running, TRUE);
+    err = pthread_create (&s->thread, NULL, stream_process, s);
+    if (err) {
+        selfLogErr ("Create stream thread error(%d): %s", err, strerror (err));
+        atomic_store (&s->running, FALSE);
+        goto fail;
+    }
+
+    selfLogInf ("Stream [%s] %s %uHz %uch, %lu frames, head %lu frames"
+        , s->name, snd_pcm_format_name (s->format), s->rate, s->channels, atomic_load (&s->frames), s->headFrames);
+    return s;
+
+fail:
+    selfLogErr ("Open stream [%s] error: %m", data->filename);
+    stream_close (s);
+    return NULL;
+}
+
+void stream_close (SoundStream *s) {
+    int i;
+
+    if (!s)
+        return;
+
+    if (atomic_load (&s->running)) {
+        atomic_store (&s->running, FALSE);
+        eventfd_write (s->wakeFd, 1);
+        pthread_join (s->thread, NULL);
+    }
+
+    for (i = 0; i < STREAM_BUFFERS; i++)
+        free (s->bufs[i]);
+    free (s->head);
+    free (s->s16);
+    free (s->remix);
+    resample_free (s->rs);
+    resample_free (s->rsHead);
+    growbuf_unref (s->grow);
+    if (s->wakeFd >= 0)
+        close (s->wakeFd);
+    free (s);
+}
+
+/**
+ * @brief Output length in engine frames, shorter than announced if the
+ * download of the source breaks off
+ */
+snd_pcm_uframes_t stream_frames (SoundStream *s) {
+    return atomic_load_explicit (&s->frames, memory_order_relaxed);
+}
+
+/**
+ * @brief Takes decoded frames, called from the audio thread
+ *
+ * Never waits for the reader nor locks anything: if the next chunk is
+ * not ready yet, fewer frames are returned and the caller plays silence
+ * for the rest.
+ *
+ * @param s stream
+ * @param pos output position wanted, 0 restarts the stream
+ * @param dst destination in engine format
+ * @param frames frames wanted
+ * @return snd_pcm_uframes_t frames copied
+ */
+snd_pcm_uframes_t stream_read (SoundStream *s, snd_pcm_uframes_t pos, int16_t *dst, snd_pcm_uframes_t frames) {
+    snd_pcm_uframes_t n, off, total, copied = 0;
+
+    if (pos != s->cursor) {
+        if (pos)
+            selfLogWrn ("Stream [%s] seek to %lu is not supported, restart", s->name, pos);
+        stream_restart (s);
+    }
+
+    total = atomic_load_explicit (&s->frames, memory_order_relaxed);
+    if (frames > total - s->cursor)
+        frames = total - s->cursor;
+
+    while (copied < frames) {
+        if (s->cursor < s->headFrames) {
+            n = s->headFrames - s->cursor;
+            if (n > frames - copied)
+                n = frames - copied;
+            memcpy (dst + copied * ENGINE_CHANNELS, s->head + s->cursor * ENGINE_CHANNELS, n * ENGINE_CHANNELS * sizeof (int16_t));
+        } else {
+            // Buffers still hold the sound before the restart until the reader drops them
+            if (atomic_load_explicit (&s->done, memory_order_acquire) != atomic_load_explicit (&s->request, memory_order_relaxed)
+                    || !atomic_load_explicit (&s->filled[s->rd], memory_order_acquire)) {
+                atomic_store_explicit (&s->underruns, atomic_load_explicit (&s->underruns, memory_order_relaxed) + 1, memory_order_relaxed);
+                break;
+            }
+
+            off = s->cursor - s->bufStart[s->rd];
+            n = s->bufFrames[s->rd] - off;
+            if (n > frames - copied)
+                n = frames - copied;
+            memcpy (dst + copied * ENGINE_CHANNELS, s->bufs[s->rd] + off * ENGINE_CHANNELS, n * ENGINE_CHANNELS * sizeof (int16_t));
+
+            // Hand the drained buffer back to the reader
+            if (off + n >= s->bufFrames[s->rd]) {
+                atomic_store_explicit (&s->filled[s->rd], FALSE, memory_order_release);
+                s->rd = (s->rd + 1) % STREAM_BUFFERS;
+                eventfd_write (s->wakeFd, 1);
+            }
+        }
+
+        copied += n;
+        s->cursor += n;
+    }
+
+    return copied;
+}
+
+/**
+ * @brief Periods the reader was late for
+ */
+uint32_t stream_underruns (const SoundStream *s) {
+    return atomic_load_explicit (&s->underruns, memory_order_relaxed);
+}
+
+/**
+ * @brief Asks the reader to drop decoded chunks and go back right after the head
+ *
+ * Audio thread only. The buffers are left alone until the reader is done.
+ */
+static void stream_restart (SoundStream *s) {
+    s->rd = 0;
+    s->cursor = 0;
+    // Release: the reader may overwrite the buffers read so far once it sees the request
+    atomic_fetch_add_explicit (&s->request, 1, memory_order_release);
+    eventfd_write (s->wakeFd, 1);
+}
+
+static void * stream_process (void *ptr) {
+    SoundStream *s = (SoundStream *) ptr;
+    snd_pcm_uframes_t n, frames;
+    uint32_t request;
+    int i, w;
+
+    // Decoding goes on right after the head
+    s->outPos = s->headFrames;
+
+    while (atomic_load (&s->running)) {
+        request = atomic_load_explicit (&s->request, memory_order_acquire);
+        if (request != s->served) {
+            for (i = 0; i < STREAM_BUFFERS; i++)
+                atomic_store_explicit (&s->filled[i], FALSE, memory_order_relaxed);
+            s->wr = 0;
+            s->srcPos = s->headSrc;
+            s->outPos = s->headFrames;
+            s->flushed = s->headFlushed;
+            if (s->rs)
+                resample_copy (s->rs, s->rsHead);
+            s->served = request;
+            atomic_store_explicit (&s->done, request, memory_order_release);
+            continue;
+        }
+
+        // Wait for a free buffer or for more source
+        frames = atomic_load_explicit (&s->frames, memory_order_relaxed);
+        if (atomic_load_explicit (&s->filled[s->wr], memory_order_acquire)
+                || (s->srcPos >= s->srcFrames && s->flushed) || s->outPos >= frames) {
+            stream_wait (s, -1);
+            continue;
+        }
+
+        // Download is behind the reader, or broke off and the sound ends here
+        if (s->grow && s->srcPos < s->srcFrames && stream_available (s) <= s->srcPos) {
+            if (!growbuf_done (s->grow)) {
+                stream_wait (s, STREAM_GROW_WAIT_MS);
+                continue;
+            }
+            selfLogWrn ("Stream [%s] source ends at %lu of %lu frames", s->name, s->srcPos, s->srcFrames);
+            s->srcFrames = s->srcPos;
+            frames = (snd_pcm_uframes_t) (((uint64_t) s->srcFrames * ENGINE_RATE + s->rate - 1) / s->rate);
+            atomic_store_explicit (&s->frames, frames < s->outPos ? s->outPos : frames, memory_order_relaxed);
+        }
+
+        w = s->wr;
+        n = stream_decode (s, s->bufs[w]);
+
+        // Restarted while decoding, the reader state is reset on the next pass
+        if (atomic_load_explicit (&s->request, memory_order_relaxed) != s->served)
+            continue;
+
+        s->bufStart[w] = s->outPos;
+        s->bufFrames[w] = n;
+        s->outPos += n;
+        if (n) {
+            atomic_store_explicit (&s->filled[w], TRUE, memory_order_release);
+            s->wr = (w + 1) % STREAM_BUFFERS;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Converts the next source chunk into engine frames
+ *
+ * @return snd_pcm_uframes_t frames written to out
+ */
+static snd_pcm_uframes_t stream_decode (SoundStream *s, int16_t *out) {
+    snd_pcm_uframes_t n, got = 0;
+    int16_t *frames;
+
+    n = s->grow ? stream_available (s) : s->srcFrames;
+    n = n > s->srcPos ? n - s->srcPos : 0;
+
+    if (n > s->inChunk)
+        n = s->inChunk;
+
+    if (n) {
+        sample_to_s16 (s->format, s->src + s->srcPos * s->align, s->s16, n * s->channels);
+        frames = s->s16;
+        if (s->channels != ENGINE_CHANNELS) {
+            convert_remix (s->s16, n, s->channels, s->remix);
+            frames = s->remix;
+        }
+
+        if (s->rs) {
+            got = resample_process (s->rs, frames, n, out);
+        } else {
+            memcpy (out, frames, n * ENGINE_CHANNELS * sizeof (int16_t));
+            got = n;
+        }
+        s->srcPos += n;
+    }
+
+    // Push the converter delay out behind the last chunk
+    if (s->srcPos >= s->srcFrames && !s->flushed) {
+        if (s->rs)
+            got += resample_flush (s->rs, out + got * ENGINE_CHANNELS);
+        s->flushed = TRUE;
+    }
+
+    return got;
+}
+
+/**
+ * @brief Source frames downloaded so far
+ */
+static snd_pcm_uframes_t stream_available (SoundStream *s) {
+    size_t off = s->src - growbuf_data (s->grow), avail = growbuf_available (s->grow);
+    snd_pcm_uframes_t n = avail > off ? (avail - off) / s->align : 0;
+
+    return n < s->srcFrames ? n : s->srcFrames;
+}
+
+/**
+ * @brief Sleeps until the audio thread kicks the reader or ms pass, -1 for no limit
+ */
+static void stream_wait (SoundStream *s, int ms) {
+    struct pollfd pfd = { .fd = s->wakeFd, .events = POLLIN };
+    eventfd_t cnt;
+
+    if (poll (&pfd, 1, ms) > 0)
+        eventfd_read (s->wakeFd, &cnt);
+}
@@ -0,0 +1,239 @@
+/**
+ * @file wave.c
+ * @author Denys Stovbun (denis.stovbun@lanars.com)
+ * @brief Incremental RIFF/RIFX WAVE parser
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * Header, chunk headers and the fmt body are gathered into a small buffer
+ * inside the parser, so they may be split anywhere between pushes. Samples
+ * and skipped chunks are never copied.
+ *
+ */
+#include <string.h>
+
+#include "wave.h"
+#include "formats.h"
+
+static int wave_gather (WaveParser *p, const uint8_t **buf, size_t *len, uint32_t need);
+static void wave_advance (WaveParser *p, const uint8_t **buf, size_t *len, size_t n);
+static WaveEvent wave_fail (WaveParser *p, const char *error);
+static WaveEvent wave_chunk (WaveParser *p);
+static WaveEvent wave_fmt (WaveParser *p);
+
+void wave_init (WaveParser *p) {
+    memset (p, 0, sizeof (WaveParser));
+    p->format = SND_PCM_FORMAT_UNKNOWN;
+    p->state = WaveStateHeader;
+}
+
+/**
+ * @brief Parses the next piece of the pushed chunk
+ *
+ * Call it in a loop until it returns WaveNeedMore, WaveEnd or WaveError.
+ * buf and len are advanced past the bytes used.
+ *
+ * @param p parser
+ * @param buf chunk pointer
+ * @param len chunk length
+ * @param region samples, valid on WaveSamples until the chunk is released
+ * @return WaveEvent what is known now
+ */
+WaveEvent wave_parse (WaveParser *p, const uint8_t **buf, size_t *len, WaveRegion *region) {
+    WaveHeader  h;
+    WaveEvent   ev;
+    size_t      n;
+
+    for (;;) {
+        switch (p->state) {
+        case WaveStateHeader:
+            if (!wave_gather (p, buf, len, sizeof (WaveHeader)))
+                return WaveNeedMore;
+            memcpy (&h, p->hdr, sizeof (WaveHeader));
+            if (h.magic == WAV_RIFF)
+                p->bigEndian = 0;
+            else if (h.magic == WAV_RIFX)
+                p->bigEndian = 1;
+            else
+                return wave_fail (p, "Is not a RIFF/X file");
+            if (h.type != WAV_WAVE)
+                return wave_fail (p, "Is not a WAVE file");
+            p->have = 0;
+            p->state = WaveStateChunk;
+            break;
+
+        case WaveStateChunk:
+            if (!wave_gather (p, buf, len, sizeof (WaveChunkHeader)))
+                return WaveNeedMore;
+            p->have = 0;
+            if ((ev = wave_chunk (p)) != WaveNeedMore)
+                return ev;
+            break;
+
+        case WaveStateFmt:
+            if (!wave_gather (p, buf, len, p->chunk < WAVE_FMT_MAX ? p->chunk : WAVE_FMT_MAX))
+                return WaveNeedMore;
+            p->left -= p->have;
+            p->state = WaveStateSkip;
+            return wave_fmt (p);
+
+        case WaveStateSkip:
+            if (!p->left) {
+                p->have = 0;
+                p->state = WaveStateChunk;
+                break;
+            }
+            if (!*len)
+                return WaveNeedMore;
+            n = *len < p->left ? *len : p->left;
+            wave_advance (p, buf, len, n);
+            p->left -= n;
+            break;
+
+        case WaveStateData:
+            if (!p->left) {
+                p->state = WaveStateDone;
+                return WaveEnd;
+            }
+            if (!*len)
+                return WaveNeedMore;
+            n = *len < p->left ? *len : p->left;
+            region->data = *buf;
+            region->size = n;
+            region->offset = p->dataLength - p->left;
+            wave_advance (p, buf, len, n);
+            p->left -= n;
+            return WaveSamples;
+
+        case WaveStateDone:
+            return WaveEnd;
+
+        default:
+            return WaveError;
+        }
+    }
+}
+
+static int wave_gather (WaveParser *p, const uint8_t **buf, size_t *len, uint32_t need) {
+    size_t n = need - p->have;
+
+    if (n > *len)
+        n = *len;
+    memcpy (p->hdr + p->have, *buf, n);
+    p->have += n;
+    wave_advance (p, buf, len, n);
+
+    return p->have == need;
+}
+
+static void wave_advance (WaveParser *p, const uint8_t **buf, size_t *len, size_t n) {
+    *buf += n;
+    *len -= n;
+    p->pos += n;
+}
+
+static WaveEvent wave_fail (WaveParser *p, const char *error) {
+    p->error = error;
+    p->state = WaveStateError;
+    return WaveError;
+}
+
+static WaveEvent wave_chunk (WaveParser *p) {
+    WaveChunkHeader c;
+
+    memcpy (&c, p->hdr, sizeof (WaveChunkHeader));
+    p->chunk = TO_CPU_INT (c.length, p->bigEndian);
+    p->left = (uint64_t) p->chunk + p->chunk % 2;
+
+    if (c.type == WAV_FMT && !p->formatted) {
+        if (p->chunk < sizeof (WaveFmtBody))
+            return wave_fail (p, "Format chunk is too short");
+        p->state = WaveStateFmt;
+    } else if (c.type == WAV_DATA) {
+        if (!p->formatted)
+            return wave_fail (p, "Data chunk comes before the format");
+        // Padding after the samples does not matter, nothing is read past them
+        p->left = p->chunk;
+        p->dataOffset = p->pos;
+        p->dataLength = p->chunk;
+        p->state = WaveStateData;
+        return WaveData;
+    } else {
+        p->state = WaveStateSkip;
+    }
+
+    return WaveNeedMore;
+}
+
+static WaveEvent wave_fmt (WaveParser *p) {
+    WaveFmtBody            *f = (WaveFmtBody *) p->hdr;
+    WaveFmtExtensibleBody  *fe = (WaveFmtExtensibleBody *) p->hdr;
+    int                     be = p->bigEndian;
+    uint16_t                format;
+    uint16_t                vbps = 0;
+
+    format = TO_CPU_SHORT (f->format, be);
+
+    if (WAV_FMT_EXTENSIBLE == format) {
+        if (p->chunk < sizeof (WaveFmtExtensibleBody))
+            return wave_fail (p, "Extensible format chunk is too short");
+        if (memcmp (fe->guid_tag, WAV_GUID_TAG, 14) != 0)
+            return wave_fail (p, "Wrong format tag in extensible format chunk");
+        vbps = TO_CPU_SHORT (fe->bit_p_spl, be);
+        format = TO_CPU_SHORT (fe->guid_format, be);
+    }
+
+    // Can't handle compressed WAVE files
+    if (format != WAV_FMT_PCM && format != WAV_FMT_IEEE_FLOAT)
+        return wave_fail (p, "Format is not PCM or FLOAT encoded");
+
+    p->channels = TO_CPU_SHORT (f->channels, be);
+    p->rate = TO_CPU_INT (f->sample_fq, be);
+    p->align = TO_CPU_SHORT (f->byte_p_spl, be);
+    p->bits = TO_CPU_SHORT (f->bit_p_spl, be);
+
+    if (!p->channels)
+        return wave_fail (p, "No channels");
+    if (!p->align)
+        return wave_fail (p, "Zero block align");
+    if (vbps > p->bits)
+        return wave_fail (p, "Valid bits greater than bits per sample");
+
+    switch (p->bits) {
+    case 8:
+        p->format = SND_PCM_FORMAT_U8;
+        break;
+    case 16:
+        p->format = be ? SND_PCM_FORMAT_S16_BE : SND_PCM_FORMAT_S16_LE;
+        break;
+    case 24:
+        switch (p->align / p->channels) {
+        case 3:
+            p->format = be ? SND_PCM_FORMAT_S24_3BE : SND_PCM_FORMAT_S24_3LE;
+            break;
+        case 4:
+            p->format = be ? SND_PCM_FORMAT_S24_BE : SND_PCM_FORMAT_S24_LE;
+            break;
+        default:
+            return wave_fail (p, "Unsupported 24 bit sample width");
+        }
+        break;
+    case 32:
+        if (format == WAV_FMT_IEEE_FLOAT)
+            p->format = be ? SND_PCM_FORMAT_FLOAT_BE : SND_PCM_FORMAT_FLOAT_LE;
+        else if (vbps == 24)
+            p->format = be ? SND_PCM_FORMAT_S24_BE : SND_PCM_FORMAT_S24_LE;
+        else
+            p->format = be ? SND_PCM_FORMAT_S32_BE : SND_PCM_FORMAT_S32_LE;
+        break;
+    default:
+        return wave_fail (p, "Unsupported sample width");
+    }
+
+    // Frames are counted by the align but read by channels and sample width
+    if (p->align != p->channels * (snd_pcm_format_physical_width (p->format) / 8))
+        return wave_fail (p, "Block align does not match the sample width");
+
+    p->formatted = 1;
+    return WaveFormat;
+}
@@ -0,0 +1,254 @@
+/**
+ * @file bench_convert.c
+ * @author Denys Stovbun (denis.stovbun@lanars.com)
+ * @brief Sample conversion kernels microbenchmark
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * Loads every WAVE clip of a folder (files/sounds/dev by default),
+ * encodes it into each format the loader produces and times scalar
+ * against vector kernels, checking that both give identical output.
+ *
+ * Usage: bench-convert [folder] [repeat]
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <time.h>
+
+#include "sample.h"
+
+#define BENCH_DEFAULT_DIR   "files/sounds/dev"
+#define BENCH_REPEAT        50
+
+typedef struct BenchClipStruct {
+    char               *name;
+    int16_t            *pcm;
+    size_t              samples;
+} BenchClip;
+
+static const snd_pcm_format_t formats[] = {
+    SND_PCM_FORMAT_U8,
+    SND_PCM_FORMAT_S16_LE,
+    SND_PCM_FORMAT_S16_BE,
+    SND_PCM_FORMAT_S24_LE,
+    SND_PCM_FORMAT_S24_BE,
+    SND_PCM_FORMAT_S24_3LE,
+    SND_PCM_FORMAT_S24_3BE,
+    SND_PCM_FORMAT_S32_LE,
+    SND_PCM_FORMAT_S32_BE,
+    SND_PCM_FORMAT_FLOAT_LE,
+    SND_PCM_FORMAT_FLOAT_BE,
+};
+
+typedef enum BenchOpEnum {
+      BenchToS16
+    , BenchFromS16
+    , BenchToFloat
+    , BenchFromFloat
+    , BenchMAX
+} BenchOp;
+
+static const char *opNames[BenchMAX] = { "to_s16", "from_s16", "to_float", "from_float" };
+
+static double now_ns () {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+}
+
+static uint32_t rd32 (const uint8_t *p) { return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24; }
+static uint16_t rd16 (const uint8_t *p) { return p[0] | p[1] << 8; }
+
+/**
+ * @brief Minimal RIFF reader, the clip is decoded to S16 with the kernels under test
+ */
+static int load_clip (const char *path, BenchClip *clip) {
+    FILE *f = fopen (path, "rb");
+    uint8_t hdr[12], chunk[8], fmt[40] = { 0 };
+    snd_pcm_format_t format = SND_PCM_FORMAT_UNKNOWN;
+    uint8_t *data = NULL;
+    uint32_t size = 0, len;
+    uint16_t tag, bits;
+
+    if (!f)
+        return -1;
+
+    if (fread (hdr, 1, sizeof (hdr), f) != sizeof (hdr) || memcmp (hdr, "RIFF", 4) || memcmp (hdr + 8, "WAVE", 4))
+        goto fail;
+
+    while (fread (chunk, 1, sizeof (chunk), f) == sizeof (chunk)) {
+        len = rd32 (chunk + 4);
+        if (!memcmp (chunk, "fmt ", 4)) {
+            if (fread (fmt, 1, len < sizeof (fmt) ? len : sizeof (fmt), f) < 16)
+                goto fail;
+            if (len > sizeof (fmt))
+                fseek (f, len - sizeof (fmt), SEEK_CUR);
+        } else if (!memcmp (chunk, "data", 4)) {
+            data = (uint8_t *) malloc (len);
+            if (!data || (size = fread (data, 1, len, f)) == 0)
+                goto fail;
+            break;
+        } else {
+            fseek (f, len + (len & 1), SEEK_CUR);
+        }
+    }
+
+    tag = rd16 (fmt);
+    bits = rd16 (fmt + 14);
+    if (tag == 0xFFFE)
+        tag = rd16 (fmt + 24);
+    if (tag == 3 && bits == 32)
+        format = SND_PCM_FORMAT_FLOAT_LE;
+    else if (tag == 1 && bits == 8)
+        format = SND_PCM_FORMAT_U8;
+    else if (tag == 1 && bits == 16)
+        format = SND_PCM_FORMAT_S16_LE;
+    else if (tag == 1 && bits == 24)
+        format = SND_PCM_FORMAT_S24_3LE;
+    else if (tag == 1 && bits == 32)
+        format = SND_PCM_FORMAT_S32_LE;
+    if (!data || format == SND_PCM_FORMAT_UNKNOWN)
+        goto fail;
+
+    clip->samples = size / sample_width (format);
+    clip->pcm = (int16_t *) malloc (clip->samples * sizeof (int16_t));
+    if (!clip->pcm)
+        goto fail;
+
+    sample_to_s16 (format, data, clip->pcm, clip->samples);
+    clip->name = strdup (path);
+    free (data);
+    fclose (f);
+    return 0;
+
+fail:
+    free (data);
+    fclose (f);
+    return -1;
+}
+
+static void run_op (BenchOp op, snd_pcm_format_t format, const void *in, void *out, size_t samples) {
+    switch (op) {
+        case BenchToS16:     sample_to_s16 (format, in, (int16_t *) out, samples); break;
+        case BenchFromS16:   sample_from_s16 (format, (const int16_t *) in, out, samples); break;
+        case BenchToFloat:   sample_to_float (format, in, (float *) out, samples); break;
+        case BenchFromFloat: sample_from_float (format, (const float *) in, out, samples); break;
+        default: break;
+    }
+}
+
+static double time_op (BenchOp op, snd_pcm_format_t format, const void *in, void *out, size_t samples, int repeat) {
+    double best = 0, t;
+    int r;
+
+    for (r = 0; r < repeat; r++) {
+        t = now_ns ();
+        run_op (op, format, in, out, samples);
+        t = now_ns () - t;
+        if (!r || t < best)
+            best = t;
+    }
+    return best;
+}
+
+int main (int argc, char **argv) {
+    const char *dir = argc > 1 ? argv[1] : BENCH_DEFAULT_DIR;
+    int repeat = argc > 2 ? atoi (argv[2]) : BENCH_REPEAT;
+    BenchClip *clips = NULL;
+    size_t nClips = 0, total = 0, maxSamples = 0, c, f;
+    double scalarNs[BenchMAX], vectorNs[BenchMAX];
+    uint8_t *encoded, *outScalar, *outVector;
+    float *fl;
+    struct dirent *de;
+    char path[1024];
+    int op, rc = 0;
+    DIR *d;
+
+    d = opendir (dir);
+    if (!d) {
+        fprintf (stderr, "Can't open %s: %m\n", dir);
+        return 1;
+    }
+
+    while ((de = readdir (d))) {
+        size_t l = strlen (de->d_name);
+        if (l < 4 || strcasecmp (de->d_name + l - 4, ".wav"))
+            continue;
+        clips = (BenchClip *) realloc (clips, (nClips + 1) * sizeof (BenchClip));
+        snprintf (path, sizeof (path), "%s/%s", dir, de->d_name);
+        if (load_clip (path, &clips[nClips])) {
+            fprintf (stderr, "Skip %s: unsupported\n", path);
+            continue;
+        }
+        total += clips[nClips].samples;
+        if (clips[nClips].samples > maxSamples)
+            maxSamples = clips[nClips].samples;
+        nClips++;
+    }
+    closedir (d);
+
+    if (!nClips) {
+        fprintf (stderr, "No clips in %s\n", dir);
+        return 1;
+    }
+
+    encoded = (uint8_t *) malloc (maxSamples * sizeof (float));
+    outScalar = (uint8_t *) malloc (maxSamples * sizeof (float));
+    outVector = (uint8_t *) malloc (maxSamples * sizeof (float));
+    fl = (float *) malloc (maxSamples * sizeof (float));
+
+    sample_set_simd (1);
+    printf ("%zu clips, %zu samples, vector kernels: %s, best of %d\n\n", nClips, total, sample_simd_name (), repeat);
+    printf ("%-10s %-10s %12s %12s %8s\n", "format", "op", "scalar ns/s", "vector ns/s", "speedup");
+
+    for (f = 0; f < sizeof (formats) / sizeof (formats[0]); f++) {
+        size_t outBytes[BenchMAX];
+        memset (scalarNs, 0, sizeof (scalarNs));
+        memset (vectorNs, 0, sizeof (vectorNs));
+
+        for (c = 0; c < nClips; c++) {
+            const BenchClip *clip = &clips[c];
+            size_t n = clip->samples, w = sample_width (formats[f]);
+            const void *in[BenchMAX] = { encoded, clip->pcm, encoded, fl };
+
+            outBytes[BenchToS16] = n * sizeof (int16_t);
+            outBytes[BenchFromS16] = n * w;
+            outBytes[BenchToFloat] = n * sizeof (float);
+            outBytes[BenchFromFloat] = n * w;
+
+            sample_set_simd (0);
+            sample_from_s16 (formats[f], clip->pcm, encoded, n);
+            sample_to_float (formats[f], encoded, fl, n);
+
+            for (op = 0; op < BenchMAX; op++) {
+                sample_set_simd (0);
+                scalarNs[op] += time_op (op, formats[f], in[op], outScalar, n, repeat);
+                sample_set_simd (1);
+                vectorNs[op] += time_op (op, formats[f], in[op], outVector, n, repeat);
+                if (memcmp (outScalar, outVector, outBytes[op])) {
+                    fprintf (stderr, "MISMATCH %s %s %s\n", clip->name, snd_pcm_format_name (formats[f]), opNames[op]);
+                    rc = 1;
+                }
+            }
+        }
+
+        for (op = 0; op < BenchMAX; op++)
+            printf ("%-10s %-10s %12.3f %12.3f %7.2fx\n", snd_pcm_format_name (formats[f]), opNames[op]
+                , scalarNs[op] / total, vectorNs[op] / total, scalarNs[op] / vectorNs[op]);
+    }
+
+    for (c = 0; c < nClips; c++) {
+        free (clips[c].name);
+        free (clips[c].pcm);
+    }
+    free (clips);
+    free (encoded);
+    free (outScalar);
+    free (outVector);
+    free (fl);
+
+    return rc;
+}
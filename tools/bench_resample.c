@@ -0,0 +1,140 @@
+/**
+ * @file bench_resample.c
+ * @author Denys Stovbun (denis.stovbun@lanars.com)
+ * @brief Sample rate converter benchmark
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * Converts sine tones from the catalog rates (22.05k, 44.1k, 96k) to the
+ * device rate with each quality level and reports speed in ns per output
+ * sample for scalar and vector kernels, and SNR against the ideal tone
+ * (at 1 kHz and the worst of all test tones).
+ *
+ * Usage: bench-resample [seconds] [repeat]
+ *
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "resample.h"
+
+#define BENCH_OUT_RATE      48000
+#define BENCH_CHANNELS      2
+#define BENCH_AMPLITUDE     16384.0
+#define BENCH_SECONDS       2
+#define BENCH_REPEAT        5
+
+static const uint32_t rates[] = { 22050, 44100, 96000 };
+// Test tones, the highest one is close to the 22.05k passband edge
+static const double tones[] = { 440.0, 1000.0, 4000.0, 8000.0 };
+
+static double now_ns () {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+}
+
+static int16_t * make_tone (double freq, uint32_t rate, size_t frames) {
+    int16_t *buf = (int16_t *) malloc (frames * BENCH_CHANNELS * sizeof (int16_t));
+    size_t n;
+    int ch;
+
+    for (n = 0; n < frames; n++)
+        for (ch = 0; ch < BENCH_CHANNELS; ch++)
+            buf[n * BENCH_CHANNELS + ch] = (int16_t) lrint (BENCH_AMPLITUDE * sin (2.0 * M_PI * freq * n / rate));
+    return buf;
+}
+
+/**
+ * @brief SNR of the first channel against the ideal tone, edges skipped
+ */
+static double tone_snr (const int16_t *buf, size_t frames, double freq) {
+    double sig = 0, err = 0, ref, d;
+    size_t n, skip = BENCH_OUT_RATE / 100;
+
+    for (n = skip; n + skip < frames; n++) {
+        ref = BENCH_AMPLITUDE * sin (2.0 * M_PI * freq * n / BENCH_OUT_RATE);
+        d = buf[n * BENCH_CHANNELS] - ref;
+        sig += ref * ref;
+        err += d * d;
+    }
+    return err > 0 ? 10.0 * log10 (sig / err) : INFINITY;
+}
+
+static double time_convert (const int16_t *in, size_t frames, uint32_t rate, ResampleQuality q, int repeat
+    , int16_t **out, size_t *outFrames) {
+    double best = 0, t;
+    int r;
+
+    for (r = 0; r < repeat; r++) {
+        free (*out);
+        t = now_ns ();
+        *out = resample_buffer (in, frames, rate, BENCH_OUT_RATE, BENCH_CHANNELS, q, outFrames);
+        t = now_ns () - t;
+        if (!r || t < best)
+            best = t;
+    }
+    return best;
+}
+
+int main (int argc, char **argv) {
+    int seconds = argc > 1 ? atoi (argv[1]) : BENCH_SECONDS;
+    int repeat = argc > 2 ? atoi (argv[2]) : BENCH_REPEAT;
+    double scalarNs, vectorNs, snr, worst, ref;
+    size_t r, t, frames, outScalar, outVector, samples;
+    int16_t *in, *bufScalar = NULL, *bufVector = NULL;
+    int q, rc = 0;
+
+    if (seconds <= 0 || repeat <= 0) {
+        fprintf (stderr, "Usage: %s [seconds] [repeat]\n", argv[0]);
+        return 1;
+    }
+
+    printf ("%d s stereo tones to %u Hz, best of %d\n\n", seconds, BENCH_OUT_RATE, repeat);
+    printf ("%-8s %-8s %12s %12s %8s %10s %10s\n", "rate", "quality", "scalar ns/s", "vector ns/s", "speedup"
+        , "1k SNR dB", "min SNR dB");
+
+    for (r = 0; r < sizeof (rates) / sizeof (rates[0]); r++) {
+        frames = (size_t) rates[r] * seconds;
+
+        for (q = 0; q < ResampleQualityMAX; q++) {
+            scalarNs = vectorNs = 0;
+            worst = INFINITY;
+            ref = 0;
+            samples = 0;
+
+            for (t = 0; t < sizeof (tones) / sizeof (tones[0]); t++) {
+                in = make_tone (tones[t], rates[r], frames);
+
+                resample_set_simd (0);
+                scalarNs += time_convert (in, frames, rates[r], q, repeat, &bufScalar, &outScalar);
+                resample_set_simd (1);
+                vectorNs += time_convert (in, frames, rates[r], q, repeat, &bufVector, &outVector);
+
+                if (!bufScalar || !bufVector || outScalar != outVector
+                    || memcmp (bufScalar, bufVector, outScalar * BENCH_CHANNELS * sizeof (int16_t))) {
+                    fprintf (stderr, "MISMATCH %u Hz %s %.0f Hz\n", rates[r], resample_quality_name (q), tones[t]);
+                    rc = 1;
+                }
+
+                snr = tone_snr (bufVector, outVector, tones[t]);
+                if (tones[t] == 1000.0)
+                    ref = snr;
+                if (snr < worst)
+                    worst = snr;
+                samples += outVector * BENCH_CHANNELS;
+                free (in);
+            }
+
+            printf ("%-8u %-8s %12.3f %12.3f %7.2fx %10.1f %10.1f\n", rates[r], resample_quality_name (q)
+                , scalarNs / samples, vectorNs / samples, scalarNs / vectorNs, ref, worst);
+        }
+    }
+
+    free (bufScalar);
+    free (bufVector);
+    return rc;
+}
@@ -0,0 +1,202 @@
+/**
+ * @file bench_wave.c
+ * @author Denys Stovbun (denis.stovbun@lanars.com)
+ * @brief Incremental WAVE parser throughput benchmark
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * Loads every WAVE file under a folder (files/sounds by default) and
+ * pushes it through the parser whole and in chunks of several sizes, the
+ * way a mapping and curl write callbacks feed it. Every split must give
+ * the same format and the same samples as the whole image.
+ *
+ * Usage: bench-wave [folder] [repeat]
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <time.h>
+
+#include "wave.h"
+
+#define BENCH_DEFAULT_DIR   "files/sounds"
+#define BENCH_REPEAT        200
+
+typedef struct BenchFileStruct {
+    char               *name;
+    uint8_t            *buf;
+    size_t              size;
+} BenchFile;
+
+typedef struct BenchResultStruct {
+    snd_pcm_format_t    format;
+    uint32_t            rate;
+    uint16_t            channels;
+    uint64_t            samples;    // Sample bytes yielded
+    uint64_t            headerAt;   // Bytes pushed when the format was known
+    uint32_t            misplaced;  // Regions not pointing at their file offset
+} BenchResult;
+
+// Whole image, 16 KiB is the largest curl write callback, then worst cases
+static const size_t chunks[] = { 0, 16384, 1024, 64, 1 };
+
+static double now_ns () {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+}
+
+static int load_file (const char *path, BenchFile *file) {
+    FILE *f = fopen (path, "rb");
+    long size;
+
+    if (!f)
+        return -1;
+
+    if (fseek (f, 0, SEEK_END) || (size = ftell (f)) <= 0 || fseek (f, 0, SEEK_SET))
+        goto fail;
+
+    file->buf = (uint8_t *) malloc (size);
+    if (!file->buf || fread (file->buf, 1, size, f) != (size_t) size) {
+        free (file->buf);
+        goto fail;
+    }
+
+    file->size = size;
+    file->name = strdup (path);
+    fclose (f);
+    return 0;
+
+fail:
+    fclose (f);
+    return -1;
+}
+
+static void load_dir (const char *dir, BenchFile **files, size_t *nFiles) {
+    struct dirent *de;
+    char path[1024];
+    DIR *d = opendir (dir);
+
+    if (!d)
+        return;
+
+    while ((de = readdir (d))) {
+        size_t l = strlen (de->d_name);
+        if (de->d_name[0] == '.')
+            continue;
+        snprintf (path, sizeof (path), "%s/%s", dir, de->d_name);
+        if (de->d_type == DT_DIR) {
+            load_dir (path, files, nFiles);
+            continue;
+        }
+        if (l < 4 || strcasecmp (de->d_name + l - 4, ".wav"))
+            continue;
+        *files = (BenchFile *) realloc (*files, (*nFiles + 1) * sizeof (BenchFile));
+        if (!load_file (path, &(*files)[*nFiles]))
+            (*nFiles)++;
+    }
+    closedir (d);
+}
+
+/**
+ * @brief Pushes the file in chunks of the given size, 0 for the whole image
+ */
+static int parse_file (const BenchFile *file, size_t chunk, BenchResult *res) {
+    WaveParser p;
+    WaveRegion r;
+    WaveEvent ev = WaveNeedMore;
+    size_t off = 0, len, n;
+    const uint8_t *buf;
+
+    memset (res, 0, sizeof (BenchResult));
+    wave_init (&p);
+
+    while (off < file->size && ev != WaveEnd) {
+        n = chunk && file->size - off > chunk ? chunk : file->size - off;
+        buf = file->buf + off;
+        len = n;
+        while ((ev = wave_parse (&p, &buf, &len, &r)) != WaveNeedMore && ev != WaveEnd) {
+            if (ev == WaveError)
+                return -1;
+            if (ev == WaveFormat)
+                res->headerAt = off + n - len;
+            if (ev == WaveSamples) {
+                res->samples += r.size;
+                // Zero-copy: the region is the file bytes themselves
+                if (r.data != file->buf + p.dataOffset + r.offset)
+                    res->misplaced++;
+            }
+        }
+        off += n;
+    }
+
+    res->format = p.format;
+    res->rate = p.rate;
+    res->channels = p.channels;
+    return 0;
+}
+
+int main (int argc, char **argv) {
+    const char *dir = argc > 1 ? argv[1] : BENCH_DEFAULT_DIR;
+    int repeat = argc > 2 ? atoi (argv[2]) : BENCH_REPEAT;
+    BenchFile *files = NULL;
+    BenchResult whole, res;
+    size_t nFiles = 0, total = 0, f, c;
+    double best = 0, t, sum;
+    int i, rc = 0;
+
+    load_dir (dir, &files, &nFiles);
+    if (!nFiles) {
+        fprintf (stderr, "No WAVE files in %s\n", dir);
+        return 1;
+    }
+
+    for (f = 0; f < nFiles; f++) {
+        total += files[f].size;
+        if (parse_file (&files[f], 0, &whole)) {
+            printf ("%-40s rejected\n", files[f].name);
+            continue;
+        }
+        printf ("%-40s %-10s %6uHz %uch header at %lu, %lu sample bytes\n", files[f].name
+            , snd_pcm_format_name (whole.format), whole.rate, whole.channels, whole.headerAt, whole.samples);
+    }
+
+    printf ("\n%zu files, %zu bytes, best of %d\n\n", nFiles, total, repeat);
+    printf ("%-10s %12s %12s\n", "chunk", "ns/file", "MB/s");
+
+    for (c = 0; c < sizeof (chunks) / sizeof (chunks[0]); c++) {
+        sum = 0;
+        for (f = 0; f < nFiles; f++) {
+            int ok = !parse_file (&files[f], 0, &whole);
+
+            for (i = 0; i < repeat; i++) {
+                t = now_ns ();
+                parse_file (&files[f], chunks[c], &res);
+                t = now_ns () - t;
+                if (!i || t < best)
+                    best = t;
+            }
+            sum += best;
+
+            if (ok && (res.format != whole.format || res.rate != whole.rate || res.channels != whole.channels
+                    || res.samples != whole.samples || res.misplaced)) {
+                fprintf (stderr, "MISMATCH %s chunk %zu\n", files[f].name, chunks[c]);
+                rc = 1;
+            }
+        }
+        if (chunks[c])
+            printf ("%-10zu %12.0f %12.1f\n", chunks[c], sum / nFiles, total / (sum / 1e3));
+        else
+            printf ("%-10s %12.0f %12.1f\n", "whole", sum / nFiles, total / (sum / 1e3));
+    }
+
+    for (f = 0; f < nFiles; f++) {
+        free (files[f].name);
+        free (files[f].buf);
+    }
+    free (files);
+
+    return rc;
+}
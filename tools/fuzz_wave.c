@@ -0,0 +1,248 @@
+/**
+ * @file fuzz_wave.c
+ * @author Denys Stovbun (denis.stovbun@lanars.com)
+ * @brief Incremental WAVE parser fuzzing harness
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * Each input is parsed as a whole image and again split at points taken
+ * from the input itself. Both runs must agree on every event, and every
+ * region must lie inside the pushed bytes at its own file offset. The
+ * block align must be the frame width, so frames counted by the align
+ * are read by the converters inside the data chunk.
+ *
+ * With libFuzzer (clang -fsanitize=fuzzer -DFUZZ_LIBFUZZER) it is a fuzz
+ * target. Otherwise it replays the given files, or every WAVE file under
+ * files/sounds, plus random mutations of each.
+ *
+ * Usage: fuzz-wave [file|folder ...] [-n mutations] [-s seed]
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "wave.h"
+
+#define FUZZ_DEFAULT_DIR    "files/sounds"
+#define FUZZ_MUTATIONS      2000
+#define FUZZ_EVENTS         64
+
+typedef struct FuzzTraceStruct {
+    WaveEvent           events[FUZZ_EVENTS];
+    int                 count;
+    snd_pcm_format_t    format;
+    uint64_t            dataOffset;
+    uint64_t            dataLength;
+    uint64_t            samples;
+} FuzzTrace;
+
+int LLVMFuzzerTestOneInput (const uint8_t *data, size_t size);
+
+static void fuzz_check (int ok, const char *what) {
+    if (ok)
+        return;
+    fprintf (stderr, "FAILED: %s\n", what);
+    abort ();
+}
+
+static void fuzz_event (FuzzTrace *t, WaveEvent ev) {
+    // Consecutive regions of one chunk count as one, splits only change their number
+    if (ev == WaveSamples && t->count && t->events[t->count - 1] == WaveSamples)
+        return;
+    if (t->count < FUZZ_EVENTS)
+        t->events[t->count++] = ev;
+}
+
+/**
+ * @brief Pushes the input in pieces, the split points come from a seed
+ */
+static void fuzz_run (const uint8_t *data, size_t size, uint32_t seed, FuzzTrace *t) {
+    WaveParser p;
+    WaveRegion r;
+    WaveEvent ev = WaveNeedMore;
+    size_t off = 0, n, len, width;
+    uint64_t frames;
+    const uint8_t *buf;
+
+    memset (t, 0, sizeof (FuzzTrace));
+    wave_init (&p);
+
+    while (off < size && ev != WaveEnd && ev != WaveError) {
+        if (seed) {
+            seed = seed * 1103515245 + 12345;
+            n = 1 + (seed >> 16) % 97;
+            if (n > size - off)
+                n = size - off;
+        } else {
+            n = size - off;
+        }
+        buf = data + off;
+        len = n;
+
+        while ((ev = wave_parse (&p, &buf, &len, &r)) != WaveNeedMore) {
+            fuzz_event (t, ev);
+            if (ev == WaveEnd || ev == WaveError)
+                break;
+            if (ev == WaveSamples) {
+                fuzz_check (r.size > 0, "empty region");
+                fuzz_check (r.data >= data + off && r.data + r.size <= data + off + n, "region out of the chunk");
+                fuzz_check (r.data == data + p.dataOffset + r.offset, "region not at its file offset");
+                fuzz_check (r.offset + r.size <= p.dataLength, "region past the data chunk");
+                t->samples += r.size;
+            }
+            if (ev == WaveFormat) {
+                fuzz_check (p.channels && p.align && p.format != SND_PCM_FORMAT_UNKNOWN, "format without fields");
+                width = snd_pcm_format_physical_width (p.format) / 8;
+                fuzz_check (p.align == p.channels * width, "align is not the frame width");
+            }
+            if (ev == WaveData) {
+                // The frame count sound.c takes, read as channels by sample width
+                frames = p.dataLength / p.align;
+                fuzz_check (frames * p.align <= p.dataLength, "frames past the data chunk");
+                fuzz_check (frames * p.channels * (snd_pcm_format_physical_width (p.format) / 8) <= p.dataLength
+                    , "samples read past the data chunk");
+            }
+        }
+        fuzz_check (buf == data + off + n - len, "input pointer and length disagree");
+        fuzz_check (ev != WaveNeedMore || !len, "input left over");
+        off += n;
+    }
+
+    fuzz_check (p.pos <= size, "consumed more than pushed");
+    t->format = p.format;
+    t->dataOffset = p.dataOffset;
+    t->dataLength = p.dataLength;
+}
+
+int LLVMFuzzerTestOneInput (const uint8_t *data, size_t size) {
+    FuzzTrace whole, split;
+    uint32_t seed = 1;
+    size_t i;
+
+    for (i = 0; i < size && i < 8; i++)
+        seed = seed * 31 + data[i];
+
+    fuzz_run (data, size, 0, &whole);
+    fuzz_run (data, size, seed | 1, &split);
+
+    fuzz_check (whole.count == split.count && !memcmp (whole.events, split.events, whole.count * sizeof (WaveEvent)), "events differ");
+    fuzz_check (whole.format == split.format, "format differs");
+    fuzz_check (whole.dataOffset == split.dataOffset && whole.dataLength == split.dataLength, "data chunk differs");
+    fuzz_check (whole.samples == split.samples, "samples differ");
+
+    return 0;
+}
+
+#ifndef FUZZ_LIBFUZZER
+
+static size_t fuzz_file (const char *path, int mutations) {
+    FILE *f = fopen (path, "rb");
+    uint8_t *buf, *mut;
+    long size;
+    int m, k;
+
+    if (!f)
+        return 0;
+    if (fseek (f, 0, SEEK_END) || (size = ftell (f)) <= 0 || fseek (f, 0, SEEK_SET)) {
+        fclose (f);
+        return 0;
+    }
+
+    buf = (uint8_t *) malloc (size);
+    mut = (uint8_t *) malloc (size);
+    if (!buf || !mut || fread (buf, 1, size, f) != (size_t) size) {
+        free (buf);
+        free (mut);
+        fclose (f);
+        return 0;
+    }
+    fclose (f);
+
+    LLVMFuzzerTestOneInput (buf, size);
+
+    // Headers are where the parser branches, so mutate the first bytes mostly
+    for (m = 0; m < mutations; m++) {
+        size_t len = size;
+        long span = size < 256 ? size : 256;
+
+        memcpy (mut, buf, size);
+        for (k = 0; k < 1 + rand () % 4; k++)
+            mut[rand () % span] ^= 1 << (rand () % 8);
+        if (!(rand () % 4))
+            len = rand () % size;
+
+        LLVMFuzzerTestOneInput (mut, len);
+    }
+
+    free (buf);
+    free (mut);
+    return 1;
+}
+
+static size_t fuzz_path (const char *path, int mutations) {
+    struct dirent *de;
+    struct stat st;
+    char sub[1024];
+    size_t count = 0;
+    DIR *d;
+
+    if (stat (path, &st))
+        return 0;
+    if (!S_ISDIR (st.st_mode))
+        return fuzz_file (path, mutations);
+
+    if (!(d = opendir (path)))
+        return 0;
+    while ((de = readdir (d))) {
+        size_t l = strlen (de->d_name);
+        if (de->d_name[0] == '.')
+            continue;
+        snprintf (sub, sizeof (sub), "%s/%s", path, de->d_name);
+        if (de->d_type == DT_DIR)
+            count += fuzz_path (sub, mutations);
+        else if (l >= 4 && !strcasecmp (de->d_name + l - 4, ".wav"))
+            count += fuzz_file (sub, mutations);
+    }
+    closedir (d);
+
+    return count;
+}
+
+int main (int argc, char **argv) {
+    int mutations = FUZZ_MUTATIONS;
+    unsigned seed = 1;
+    size_t count = 0;
+    int i, paths = 0;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp (argv[i], "-n") && i + 1 < argc)
+            mutations = atoi (argv[++i]);
+        else if (!strcmp (argv[i], "-s") && i + 1 < argc)
+            seed = strtoul (argv[++i], NULL, 0);
+    }
+    srand (seed);
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp (argv[i], "-n") || !strcmp (argv[i], "-s")) {
+            i++;
+            continue;
+        }
+        count += fuzz_path (argv[i], mutations);
+        paths++;
+    }
+    if (!paths)
+        count = fuzz_path (FUZZ_DEFAULT_DIR, mutations);
+
+    if (!count) {
+        fprintf (stderr, "No inputs\n");
+        return 1;
+    }
+
+    printf ("%zu inputs, %d mutations each, seed %u: OK\n", count, mutations, seed);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,162 @@
+/**
+ * @file stress_bus.c
+ * @author Denys Stovbun (denis.stovbun@lanars.com)
+ * @brief Play/stop stress test over D-Bus
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * Hammers the running service with play and stop calls of random sound
+ * types at random short intervals, restarts included. Then it stops
+ * everything and checks that the service settles: the state is back to
+ * idle, nothing is reported playing and the service still answers.
+ *
+ * Usage: stress-bus [-n calls] [-d max delay ms] [-s seed]
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <systemd/sd-bus.h>
+
+#include "app.h"
+#include "bus.h"
+
+#define STRESS_CALLS        2000
+#define STRESS_DELAY        20      // ms
+#define STRESS_SETTLE       3000    // ms to get back to idle
+
+static sd_bus *bus = NULL;
+
+static void sleep_ms (long ms) {
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep (&ts, NULL);
+}
+
+static int call (const char *method, uint8_t type) {
+    sd_bus_error err = SD_BUS_ERROR_NULL;
+    sd_bus_message *reply = NULL;
+    int ok = 0, r;
+
+    r = sd_bus_call_method (bus, DBUS_THIS_NAME, DBUS_THIS_PATH, DBUS_THIS_INTERFACE
+        , method, &err, &reply, "y", type);
+    if (r < 0)
+        fprintf (stderr, "%s %u: %s\n", method, type, err.message ? err.message : strerror (-r));
+    else if (sd_bus_message_read (reply, SOUND_METHOD_RETURN, &ok) < 0)
+        r = -1;
+
+    sd_bus_error_free (&err);
+    sd_bus_message_unref (reply);
+    return r < 0 ? -1 : ok;
+}
+
+static int get_state (uint8_t *state) {
+    sd_bus_error err = SD_BUS_ERROR_NULL;
+    int r;
+
+    r = sd_bus_get_property_trivial (bus, DBUS_THIS_NAME, DBUS_THIS_PATH, DBUS_THIS_INTERFACE
+        , SOUND_PROP_STATE, &err, 'y', state);
+    sd_bus_error_free (&err);
+    return r;
+}
+
+static int get_playing (int *count) {
+    sd_bus_error err = SD_BUS_ERROR_NULL;
+    sd_bus_message *reply = NULL;
+    const uint8_t *arr;
+    size_t size, i;
+    int r;
+
+    *count = 0;
+    r = sd_bus_get_property (bus, DBUS_THIS_NAME, DBUS_THIS_PATH, DBUS_THIS_INTERFACE
+        , SOUND_PROP_PLAYING, &err, &reply, "ay");
+    if (r >= 0)
+        r = sd_bus_message_read_array (reply, 'y', (const void **) &arr, &size);
+    if (r >= 0)
+        for (i = 0; i < size; i++)
+            *count += arr[i] != 0;
+
+    sd_bus_error_free (&err);
+    sd_bus_message_unref (reply);
+    return r;
+}
+
+static int ping () {
+    sd_bus_error err = SD_BUS_ERROR_NULL;
+    int r;
+
+    r = sd_bus_call_method (bus, DBUS_THIS_NAME, DBUS_THIS_PATH, DBUS_PEER_INTERFACE
+        , "Ping", &err, NULL, "");
+    sd_bus_error_free (&err);
+    return r;
+}
+
+int main (int argc, char **argv) {
+    int calls = STRESS_CALLS, delay = STRESS_DELAY;
+    unsigned seed = (unsigned) time (NULL);
+    int i, r, ok, failed = 0, refused = 0, playing = 0, waited;
+    uint8_t type, state = 0;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp (argv[i], "-n") && i + 1 < argc)
+            calls = atoi (argv[++i]);
+        else if (!strcmp (argv[i], "-d") && i + 1 < argc)
+            delay = atoi (argv[++i]);
+        else if (!strcmp (argv[i], "-s") && i + 1 < argc)
+            seed = strtoul (argv[++i], NULL, 0);
+    }
+    srand (seed);
+
+    r = sd_bus_open_system (&bus);
+    if (r < 0) {
+        fprintf (stderr, "Can't connect to the system bus: %s\n", strerror (-r));
+        return 1;
+    }
+    if (ping () < 0) {
+        fprintf (stderr, "%s is not running\n", DBUS_THIS_NAME);
+        sd_bus_unref (bus);
+        return 1;
+    }
+
+    for (i = 0; i < calls; i++) {
+        type = SoundTest + rand () % (SoundMAX - SoundTest);
+        // Plays outnumber stops, so restarts of a sound still heard happen too
+        ok = call (rand () % 3 ? SOUND_METHOD_PLAY : SOUND_METHOD_STOP, type);
+        if (ok < 0)
+            failed++;
+        else if (!ok)
+            refused++;
+        if (delay)
+            sleep_ms (rand () % (delay + 1));
+    }
+
+    for (type = SoundTest; type < SoundMAX; type++)
+        if (call (SOUND_METHOD_STOP, type) < 0)
+            failed++;
+
+    // Stopped sounds fade out, give the events time to come back
+    for (waited = 0; waited < STRESS_SETTLE; waited += 10) {
+        if (get_state (&state) >= 0 && get_playing (&playing) >= 0 && state == SND_Idle && !playing)
+            break;
+        sleep_ms (10);
+    }
+
+    printf ("%d calls, seed %u: %d failed, %d refused, settled in %d ms\n", calls, seed, failed, refused, waited);
+
+    r = 0;
+    if (failed) {
+        fprintf (stderr, "FAILED: calls failed\n");
+        r = 1;
+    }
+    if (state != SND_Idle || playing) {
+        fprintf (stderr, "FAILED: state %u with %d sounds playing after stop\n", state, playing);
+        r = 1;
+    }
+    if (ping () < 0) {
+        fprintf (stderr, "FAILED: service stopped answering\n");
+        r = 1;
+    }
+
+    sd_bus_unref (bus);
+    return r;
+}